@@ -0,0 +1,266 @@
+#include "animation.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "parser.h"
+#include "raytrace.h"
+#include "utils.h"
+
+// Digits of the frame number added to output names without a run of '#'
+#define FRAME_NUMBER_DIGITS 4
+
+// Room for a frame number and its separator in an output name
+#define FRAME_NUMBER_LENGTH 16
+
+// Keyframe vectors interpolated along the path, in setCameraView() argument order
+static const size_t keyframeVectors[] = {
+    offsetof(Keyframe, position), offsetof(Keyframe, target), offsetof(Keyframe, up)
+};
+
+#define NUM_KEYFRAME_VECTORS (sizeof(keyframeVectors) / sizeof(keyframeVectors[0]))
+
+/**
+ Writes finished frames on its own thread, one at a time, so writing a frame overlaps rendering
+ the next
+ */
+typedef struct FrameWriter {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+
+    // Frame handed over by the render loop, pending until it has been written
+    PPM ppm;
+    int format;
+    char *fileName;
+    bool pending, shuttingDown;
+} FrameWriter;
+
+void loadCameraPath(const char *fileName, CameraPath *path) {
+    int fd = open(fileName, O_RDONLY);
+    checkError(fd < 0, "Error: Could not open camera path \"%s\"!\n", fileName);
+
+    struct stat fileStat;
+    checkError(fstat(fd, &fileStat) != 0, "Error: Could not read camera path \"%s\"!\n",
+               fileName);
+
+    size_t fileSize = fileStat.st_size;
+    const char *file = "";
+
+    if (fileSize > 0) {
+        file = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        checkError(file == MAP_FAILED, "Error: Could not map camera path \"%s\"!\n", fileName);
+    }
+
+    close(fd);
+
+    *path = (CameraPath) {};
+    parseCameraPath(file, fileSize, fileName, path);
+
+    if (fileSize > 0)
+        munmap((void *) file, fileSize);
+}
+
+void freeCameraPath(CameraPath *path) {
+    free(path->keyframes);
+    *path = (CameraPath) {};
+}
+
+static inline float keyframeValue(const Keyframe *keyframe, size_t vector, int axis) {
+    return ((const float *) ((const char *) keyframe + keyframeVectors[vector]))[axis];
+}
+
+// Change per frame of a vector component at keyframe index, measured between its neighbors (or
+//   up to the keyframe itself at either end of the path)
+static float keyframeSlope(const CameraPath *path, size_t index, size_t vector, int axis) {
+    const Keyframe *before = &path->keyframes[index > 0 ? index - 1 : index];
+    const Keyframe *after = &path->keyframes[index + 1 < path->numKeyframes ? index + 1 : index];
+
+    if (before == after)
+        return 0;
+
+    return (keyframeValue(after, vector, axis) - keyframeValue(before, vector, axis))
+           / (after->frame - before->frame);
+}
+
+void setCameraAtFrame(const CameraPath *path, int frame, SceneData *sceneData) {
+    size_t index = 0;
+
+    while (index + 1 < path->numKeyframes && path->keyframes[index + 1].frame <= frame)
+        index++;
+
+    const Keyframe *start = &path->keyframes[index];
+    float vectors[NUM_KEYFRAME_VECTORS][3];
+
+    if (index + 1 == path->numKeyframes || frame <= start->frame) {
+        for (size_t vector = 0; vector < NUM_KEYFRAME_VECTORS; vector++) {
+            for (int axis = 0; axis < 3; axis++)
+                vectors[vector][axis] = keyframeValue(start, vector, axis);
+        }
+    }
+    else {
+        const Keyframe *end = &path->keyframes[index + 1];
+        float span = end->frame - start->frame;
+        float t = (frame - start->frame) / span;
+
+        // Cubic Hermite basis functions
+        float t2 = t * t, t3 = t2 * t;
+        float startWeight = 2 * t3 - 3 * t2 + 1;
+        float startSlopeWeight = (t3 - 2 * t2 + t) * span;
+        float endWeight = -2 * t3 + 3 * t2;
+        float endSlopeWeight = (t3 - t2) * span;
+
+        for (size_t vector = 0; vector < NUM_KEYFRAME_VECTORS; vector++) {
+            for (int axis = 0; axis < 3; axis++) {
+                vectors[vector][axis] =
+                  startWeight * keyframeValue(start, vector, axis)
+                  + startSlopeWeight * keyframeSlope(path, index, vector, axis)
+                  + endWeight * keyframeValue(end, vector, axis)
+                  + endSlopeWeight * keyframeSlope(path, index + 1, vector, axis);
+            }
+        }
+    }
+
+    setCameraView(&sceneData->camera, vectors[0], vectors[1], vectors[2]);
+}
+
+static char *frameFileName(const char *pattern, int frame) {
+    size_t length = strlen(pattern);
+    size_t size = length + FRAME_NUMBER_LENGTH;
+    char *fileName = malloc(size);
+    checkError(fileName == NULL, "Error: Could not allocate memory for a file name!\n");
+
+    const char *runEnd = strrchr(pattern, '#');
+
+    if (runEnd != NULL) {
+        const char *runStart = runEnd;
+
+        while (runStart > pattern && runStart[-1] == '#')
+            runStart--;
+
+        snprintf(fileName, size, "%.*s%0*d%s", (int) (runStart - pattern), pattern,
+                 (int) (runEnd - runStart + 1), frame, runEnd + 1);
+    }
+    else {
+        // The number goes before the extension of the last path component, if it has one
+        const char *extension = strrchr(pattern, '.');
+        const char *slash = strrchr(pattern, '/');
+
+        if (extension == NULL || (slash != NULL && extension < slash))
+            extension = pattern + length;
+
+        snprintf(fileName, size, "%.*s-%0*d%s", (int) (extension - pattern), pattern,
+                 FRAME_NUMBER_DIGITS, frame, extension);
+    }
+
+    return fileName;
+}
+
+static void *writerMain(void *argument) {
+    FrameWriter *writer = argument;
+
+    pthread_mutex_lock(&writer->mutex);
+
+    while (true) {
+        while (!writer->pending && !writer->shuttingDown)
+            pthread_cond_wait(&writer->changed, &writer->mutex);
+
+        if (!writer->pending)
+            break;
+
+        PPM ppm = writer->ppm;
+        int format = writer->format;
+        char *fileName = writer->fileName;
+        pthread_mutex_unlock(&writer->mutex);
+
+        writeImage(ppm, format, fileName);
+        free(fileName);
+
+        pthread_mutex_lock(&writer->mutex);
+        writer->pending = false;
+        pthread_cond_broadcast(&writer->changed);
+    }
+
+    pthread_mutex_unlock(&writer->mutex);
+
+    return NULL;
+}
+
+// Hand ppm to the writer once it has finished the previous frame, so the image that frame was
+//   rendered into can be reused
+static void submitFrame(FrameWriter *writer, PPM ppm, int format, char *fileName) {
+    pthread_mutex_lock(&writer->mutex);
+
+    while (writer->pending)
+        pthread_cond_wait(&writer->changed, &writer->mutex);
+
+    writer->ppm = ppm;
+    writer->format = format;
+    writer->fileName = fileName;
+    writer->pending = true;
+    pthread_cond_broadcast(&writer->changed);
+
+    pthread_mutex_unlock(&writer->mutex);
+}
+
+void renderAnimation(SceneData *sceneData, const CameraPath *path, TileScheduler *scheduler,
+                     int format, const char *outputPattern) {
+    int width = sceneData->camera.imageWidth;
+    int height = sceneData->camera.imageHeight;
+    int firstFrame = path->keyframes[0].frame;
+    int lastFrame = path->keyframes[path->numKeyframes - 1].frame;
+
+    // One image renders while the other is written
+    Pixel *images[2];
+
+    for (int index = 0; index < 2; index++) {
+        images[index] = calloc((size_t) width * height, sizeof(Pixel));
+        checkError(images[index] == NULL, "Error: Could not allocate memory for the image!\n");
+    }
+
+    FrameWriter writer = {};
+    pthread_mutex_init(&writer.mutex, NULL);
+    pthread_cond_init(&writer.changed, NULL);
+    checkError(pthread_create(&writer.thread, NULL, writerMain, &writer) != 0,
+               "Error: Could not start the frame writer thread!\n");
+
+    for (int frame = firstFrame; frame <= lastFrame; frame++) {
+        Pixel *image = images[(frame - firstFrame) % 2];
+
+        setCameraAtFrame(path, frame, sceneData);
+        renderScene(sceneData, image, scheduler, NULL, NULL);
+
+        PPM ppm;
+        ppm.format = format;
+        ppm.maxColorVal = 255;
+        ppm.width = width;
+        ppm.height = height;
+        ppm.imageData = image;
+
+        submitFrame(&writer, ppm, format, frameFileName(outputPattern, frame));
+    }
+
+    // Let the last frame finish before stopping the writer
+    pthread_mutex_lock(&writer.mutex);
+
+    while (writer.pending)
+        pthread_cond_wait(&writer.changed, &writer.mutex);
+
+    writer.shuttingDown = true;
+    pthread_cond_broadcast(&writer.changed);
+    pthread_mutex_unlock(&writer.mutex);
+
+    pthread_join(writer.thread, NULL);
+    pthread_cond_destroy(&writer.changed);
+    pthread_mutex_destroy(&writer.mutex);
+
+    free(images[0]);
+    free(images[1]);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+
+// Keyframes allocated before the first one is parsed, doubled whenever they run out
+#define PATH_INITIAL_CAPACITY 16
+
+// Largest frame number, below which every whole number is an exact float
+#define MAX_FRAME 16777216
+
+struct SceneData;
+struct TileScheduler;
+
+/**
+ Camera view at one frame of an animation
+ */
+typedef struct Keyframe {
+    float frame;
+    float position[3];
+    float target[3];
+    float up[3];
+} Keyframe;
+
+/**
+ Keyframes in increasing frame order. The camera moves along a cubic Hermite spline through them,
+ with the tangent at each keyframe taken from its neighbors.
+ */
+typedef struct CameraPath {
+    Keyframe *keyframes;
+    size_t numKeyframes, keyframeCapacity;
+} CameraPath;
+
+/**
+ Load the camera path in fileName into path (see parseCameraPath() for the syntax). Exits with an
+ error if the file cannot be read.
+ */
+void loadCameraPath(const char *fileName, CameraPath *path);
+
+void freeCameraPath(CameraPath *path);
+
+/**
+ Point the camera of sceneData to where path has it at frame. Frames before the first keyframe or
+ after the last one keep its view.
+ */
+void setCameraAtFrame(const CameraPath *path, int frame, struct SceneData *sceneData);
+
+/**
+ Render every frame from the first keyframe of path to the last with the threads of scheduler,
+ writing each as a PPM of the given format. Each frame is written on a separate thread while the
+ next one renders. The file name of a frame is outputPattern with its last run of '#' replaced by
+ the frame number, zero-padded to the length of the run, or with "-" and the number padded to four
+ digits inserted before the extension if it has no '#'.
+ */
+void renderAnimation(struct SceneData *sceneData, const CameraPath *path,
+                     struct TileScheduler *scheduler, int format, const char *outputPattern);
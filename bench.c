@@ -0,0 +1,356 @@
+#include "bench.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "kernels.h"
+#include "raytrace.h"
+#include "scenefile.h"
+#include "utils.h"
+
+typedef struct BenchScene {
+    const char *name;
+
+    // Bundled scene file to parse, or NULL to generate numSpheres spheres above a ground plane lit
+    //   by numLights point lights
+    const char *fileName;
+    size_t numSpheres, numLights;
+    float reflectivity;
+} BenchScene;
+
+typedef struct BenchRun {
+    size_t numObjects, numLights;
+    double parseMs, renderMs, writeMs;
+
+    // Accelerator build time (included in parseMs) and memory
+    double accelBuildMs;
+    size_t accelMemory;
+
+    // Accelerator the rays actually went through, and the intersection kernels they used
+    const char *accelName, *kernelsName;
+} BenchRun;
+
+static const BenchScene benchScenes[] = {
+    { "input", "input.scene" },
+    { "demo", "demo.scene" },
+    { "spheres-10-matte", NULL, 10, 1, 0 },
+    { "spheres-10-mirror", NULL, 10, 1, 0.8f },
+    { "spheres-100-matte", NULL, 100, 1, 0 },
+    { "spheres-100-mirror", NULL, 100, 1, 0.8f },
+    { "spheres-1000-matte", NULL, 1000, 1, 0 },
+    { "spheres-1000-mirror", NULL, 1000, 1, 0.8f },
+    { "spheres-10000-matte", NULL, 10000, 1, 0 },
+    { "spheres-10000-mirror", NULL, 10000, 1, 0.8f },
+    { "spheres-100000-matte", NULL, 100000, 1, 0 },
+    { "spheres-100000-mirror", NULL, 100000, 1, 0.8f },
+    { "lights-64", NULL, 100, 64, 0 }
+};
+
+// Uniform value in [min, max) from a xorshift generator, so every run sees the same scene
+static float randomFloat(uint32_t *state, float min, float max) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+
+    return min + (max - min) * (x >> 8) * (1.0f / (1 << 24));
+}
+
+static int compareDoubles(const void *a, const void *b) {
+    double first = *(const double *) a, second = *(const double *) b;
+
+    return (first > second) - (first < second);
+}
+
+// Median of values, which are sorted in place
+static double median(double *values, int count) {
+    qsort(values, count, sizeof(double), compareDoubles);
+
+    return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+// Thread counts measured are 1, 2, 4, ... and finally maxThreads
+static int nextThreadCount(int numThreads, int maxThreads) {
+    return numThreads * 2 < maxThreads ? numThreads * 2 : maxThreads;
+}
+
+// Path of the bundled scene fileName in options->benchScenesDir, or else next to the executable,
+//   where it is in the source tree, so the suite runs the same from any working directory
+static void findBundledScene(const RenderOptions *options, const char *fileName, char *path) {
+    char directory[PATH_MAX] = ".";
+
+    if (options->benchScenesDir != NULL) {
+        snprintf(directory, sizeof(directory), "%s", options->benchScenesDir);
+    }
+    else {
+        ssize_t length = readlink("/proc/self/exe", directory, sizeof(directory) - 1);
+
+        if (length > 0) {
+            directory[length] = '\0';
+            *strrchr(directory, '/') = '\0';
+        }
+    }
+
+    int length = snprintf(path, PATH_MAX, "%s/%s", directory, fileName);
+    checkError(length >= PATH_MAX, "Error: The path of benchmark scene \"%s\" is too long!\n",
+               fileName);
+}
+
+static bool isSceneAvailable(const char *fileName) {
+    FILE *inputFile = fopen(fileName, "r");
+
+    if (inputFile == NULL)
+        return false;
+
+    fclose(inputFile);
+    return true;
+}
+
+static void generateScene(const BenchScene *bench, SceneData *sceneData) {
+    uint32_t state = 0x9e3779b9;
+
+    sceneData->camera.vpWidth = 2;
+    sceneData->camera.vpHeight = 2;
+    resetCameraView(&sceneData->camera);
+
+    reserveSceneStorage(sceneData, bench->numSpheres + 1, bench->numLights);
+
+    Object *ground = &sceneData->objects[0];
+    ground->type = PLANE;
+    ground->diffuseColor = (PixelN) { 0.5f, 0.5f, 0.52f };
+    ground->reflectivity = bench->reflectivity / 2;
+    ground->ns = DEFAULT_NS;
+    ground->pn[1] = 1;
+    ground->d = 2;
+
+    // Spheres fill a box in front of the camera with a radius that keeps the part of the box they
+    //   cover about the same for every sphere count
+    const float boxMin[3] = { -8, -2, -30 };
+    const float boxMax[3] = { 8, 6, -6 };
+    float radius = 0.35f * cbrtf(16 * 8 * 24 / (float) bench->numSpheres);
+
+    for (size_t index = 1; index <= bench->numSpheres; index++) {
+        Object *sphere = &sceneData->objects[index];
+        sphere->type = SPHERE;
+        sphere->diffuseColor.r = randomFloat(&state, 0.2f, 1);
+        sphere->diffuseColor.g = randomFloat(&state, 0.2f, 1);
+        sphere->diffuseColor.b = randomFloat(&state, 0.2f, 1);
+        sphere->specularColor = (PixelN) { 1, 1, 1 };
+        sphere->reflectivity = bench->reflectivity;
+        sphere->ns = DEFAULT_NS;
+        sphere->radius = radius;
+
+        for (int axis = 0; axis < 3; axis++)
+            sphere->center[axis] = randomFloat(&state, boxMin[axis], boxMax[axis]);
+    }
+
+    // Split the brightness of a single light between all of them
+    float intensity = 4.0f / bench->numLights;
+
+    for (size_t index = 0; index < bench->numLights; index++) {
+        Light *light = &sceneData->lights[index];
+        light->type = POINT;
+        light->color = (PixelN) { intensity, intensity, intensity };
+        light->radialA0 = 0.0125f;
+        light->radialA1 = 0.0125f;
+        light->radialA2 = 0.01f;
+        light->position[0] = randomFloat(&state, -20, 20);
+        light->position[1] = randomFloat(&state, 8, 20);
+        light->position[2] = randomFloat(&state, -30, 10);
+    }
+
+    sceneData->numObjects = bench->numSpheres + 1;
+    sceneData->numLights = bench->numLights;
+
+    compileScene(sceneData);
+}
+
+static BenchRun runBenchmark(const BenchScene *bench, const char *sceneFileName,
+                             const RenderOptions *options, TileScheduler *scheduler,
+                             const char *outputFileName) {
+    BenchRun timing;
+    double start = nowMs();
+
+    SceneData sceneData = {};
+    sceneData.camera.imageWidth = BENCH_WIDTH;
+    sceneData.camera.imageHeight = BENCH_HEIGHT;
+    sceneData.camera.vpDistance = 1;
+    sceneData.minContribution = options->minContribution;
+    sceneData.maxSamples = options->maxSamples;
+    sceneData.progressive = options->progressive;
+    sceneData.specularMode = options->specularMode;
+    sceneData.accelerator = options->accelerator;
+
+    if (sceneFileName != NULL) {
+        loadScene(sceneFileName, &sceneData);
+    }
+    else {
+        generateScene(bench, &sceneData);
+    }
+
+    timing.parseMs = nowMs() - start;
+    timing.numObjects = sceneData.numObjects;
+    timing.numLights = sceneData.numLights;
+    timing.accelBuildMs = sceneData.accelBuildMs;
+    timing.accelMemory = sceneData.accelMemory;
+
+    // Without bounded objects there is no BVH or grid and every ray takes the linear scan, the
+    //   only path the SIMD kernels run on. BVH leaves and grid cells are tested object by object.
+    bool linear = sceneData.bvh.numNodes == 0 && sceneData.grid.numCells == 0;
+    timing.accelName = acceleratorNames[linear ? ACCEL_LINEAR : sceneData.accelerator];
+    timing.kernelsName = linear ? intersectionKernels.name : "scalar";
+
+    Pixel *image = calloc(BENCH_WIDTH * BENCH_HEIGHT, sizeof(Pixel));
+    checkError(image == NULL, "Error: Could not allocate memory for the image!\n");
+
+    start = nowMs();
+    renderScene(&sceneData, image, scheduler, NULL, NULL);
+    timing.renderMs = nowMs() - start;
+
+    PPM outputPpm;
+    outputPpm.format = 6;
+    outputPpm.maxColorVal = 255;
+    outputPpm.width = BENCH_WIDTH;
+    outputPpm.height = BENCH_HEIGHT;
+    outputPpm.imageData = image;
+
+    start = nowMs();
+    writeImage(outputPpm, outputPpm.format, outputFileName);
+    timing.writeMs = nowMs() - start;
+
+    free(image);
+    freeSceneData(&sceneData);
+
+    return timing;
+}
+
+void runBenchmarks(const RenderOptions *options) {
+    int maxThreads = options->numThreads > 0 ? options->numThreads : defaultThreadCount();
+    int runs = options->benchRuns;
+    bool json = options->benchFormat == BENCH_JSON;
+
+    // Bundled scenes are found before anything is measured, so a missing one fails right away.
+    //   Generated and skipped scenes are left with an empty path.
+    size_t numScenes = sizeof(benchScenes) / sizeof(benchScenes[0]);
+    char sceneFileNames[numScenes][PATH_MAX];
+
+    for (size_t sceneIndex = 0; sceneIndex < numScenes; sceneIndex++) {
+        const BenchScene *bench = &benchScenes[sceneIndex];
+        char *sceneFileName = sceneFileNames[sceneIndex];
+        *sceneFileName = '\0';
+
+        if (bench->fileName == NULL)
+            continue;
+
+        findBundledScene(options, bench->fileName, sceneFileName);
+
+        if (!isSceneAvailable(sceneFileName)) {
+            checkError(!options->benchSkipMissing,
+                       "Error: Benchmark scene \"%s\" is missing; give its directory with "
+                       "--bench-scenes or skip it with --bench-skip-missing!\n", sceneFileName);
+            fprintf(stderr, "Skipping benchmark \"%s\": \"%s\" is missing\n", bench->name,
+                    sceneFileName);
+            *sceneFileName = '\0';
+        }
+    }
+
+    // Images are written to a scratch file so the write phase includes real file I/O
+    char outputFileName[] = "/tmp/raytrace-bench-XXXXXX";
+    int outputFile = mkstemp(outputFileName);
+    checkError(outputFile < 0, "Error: Could not create a temporary output file!\n");
+    close(outputFile);
+
+    double *parseMs = malloc(4 * runs * sizeof(double));
+    checkError(parseMs == NULL, "Error: Could not allocate memory for %i runs!\n", runs);
+    double *renderMs = parseMs + runs;
+    double *writeMs = renderMs + runs;
+    double *accelBuildMs = writeMs + runs;
+
+    if (json) {
+        printf("{\n  \"width\": %i,\n  \"height\": %i,\n  \"runs\": %i,\n  \"results\": [",
+               BENCH_WIDTH, BENCH_HEIGHT, runs);
+    }
+    else {
+        printf("scene,objects,lights,width,height,threads,runs,parse_ms,render_ms,render_min_ms,"
+               "write_ms,primary_rays_per_second,speedup,kernels,accel,accel_build_ms,"
+               "accel_bytes\n");
+    }
+
+    bool firstResult = true;
+
+    for (size_t sceneIndex = 0; sceneIndex < numScenes; sceneIndex++) {
+        const BenchScene *bench = &benchScenes[sceneIndex];
+        const char *sceneFileName = sceneFileNames[sceneIndex];
+
+        if (bench->fileName != NULL && *sceneFileName == '\0')
+            continue;
+
+        double singleThreadMs = 0;
+
+        for (int numThreads = 1;; numThreads = nextThreadCount(numThreads, maxThreads)) {
+            TileScheduler scheduler;
+            createTileScheduler(&scheduler, numThreads);
+
+            BenchRun timing = {};
+
+            for (int run = 0; run < runs; run++) {
+                timing = runBenchmark(bench, *sceneFileName ? sceneFileName : NULL, options,
+                                      &scheduler, outputFileName);
+                parseMs[run] = timing.parseMs;
+                renderMs[run] = timing.renderMs;
+                writeMs[run] = timing.writeMs;
+                accelBuildMs[run] = timing.accelBuildMs;
+            }
+
+            destroyTileScheduler(&scheduler);
+
+            double renderMedian = median(renderMs, runs);
+            double renderMin = renderMs[0]; // Sorted by median()
+            double raysPerSecond = (double) BENCH_WIDTH * BENCH_HEIGHT / (renderMedian / 1e3);
+
+            if (numThreads == 1)
+                singleThreadMs = renderMedian;
+
+            double speedup = singleThreadMs / renderMedian;
+            double parseMedian = median(parseMs, runs), writeMedian = median(writeMs, runs);
+            double accelBuildMedian = median(accelBuildMs, runs);
+
+            if (json) {
+                printf("%s\n    { \"scene\": \"%s\", \"objects\": %zu, \"lights\": %zu, "
+                       "\"threads\": %i, \"parse_ms\": %.3f, \"render_ms\": %.3f, "
+                       "\"render_min_ms\": %.3f, \"write_ms\": %.3f, "
+                       "\"primary_rays_per_second\": %.0f, \"speedup\": %.3f, "
+                       "\"kernels\": \"%s\", \"accel\": \"%s\", \"accel_build_ms\": %.3f, "
+                       "\"accel_bytes\": %zu }",
+                       firstResult ? "" : ",", bench->name, timing.numObjects, timing.numLights,
+                       numThreads, parseMedian, renderMedian, renderMin, writeMedian, raysPerSecond,
+                       speedup, timing.kernelsName, timing.accelName, accelBuildMedian,
+                       timing.accelMemory);
+            }
+            else {
+                printf("%s,%zu,%zu,%i,%i,%i,%i,%.3f,%.3f,%.3f,%.3f,%.0f,%.3f,%s,%s,%.3f,%zu\n",
+                       bench->name, timing.numObjects, timing.numLights, BENCH_WIDTH, BENCH_HEIGHT,
+                       numThreads, runs, parseMedian, renderMedian, renderMin, writeMedian,
+                       raysPerSecond, speedup, timing.kernelsName, timing.accelName,
+                       accelBuildMedian, timing.accelMemory);
+            }
+
+            firstResult = false;
+            fflush(stdout);
+
+            if (numThreads == maxThreads)
+                break;
+        }
+    }
+
+    if (json)
+        printf("\n  ]\n}\n");
+
+    free(parseMs);
+    unlink(outputFileName);
+}
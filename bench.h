@@ -0,0 +1,20 @@
+#pragma once
+
+#include "options.h"
+
+// Resolution every benchmark scene is rendered at
+#define BENCH_WIDTH 512
+#define BENCH_HEIGHT 512
+
+#define BENCH_DEFAULT_RUNS 3
+
+/**
+ Render the bundled scenes and a set of generated ones (spheres from 10 to 100000, matte or
+ mirrored, and a scene lit by many lights) at BENCH_WIDTH x BENCH_HEIGHT with 1, 2, 4, ... up to
+ options->numThreads threads. Every measurement is repeated options->benchRuns times, and the
+ median parse, render and write times, the primary rays traced per second and the speedup over
+ one thread are printed to stdout as CSV or JSON. The bundled scenes are read from
+ options->benchScenesDir, or else from the directory of the executable. A missing one is an error
+ unless options->benchSkipMissing is set, which skips it with a note on stderr.
+ */
+void runBenchmarks(const RenderOptions *options);
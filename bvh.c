@@ -0,0 +1,638 @@
+#include "bvh.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "geometry.h"
+#include "raytrace.h"
+#include "utils.h"
+#include "v3math.h"
+
+typedef struct {
+    float boundsMin[3];
+    float boundsMax[3];
+    size_t count;
+} BVHBin;
+
+typedef struct {
+    uint32_t nodeIndex;
+    int depth;
+} BVHBuildEntry;
+
+typedef struct {
+    const BVHNode *node;
+    float tNear;
+} BVHStackEntry;
+
+static void growBounds(float *boundsMin, float *boundsMax, const float *otherMin,
+                       const float *otherMax) {
+    for (int axis = 0; axis < 3; axis++) {
+        boundsMin[axis] = f_min(boundsMin[axis], otherMin[axis]);
+        boundsMax[axis] = f_max(boundsMax[axis], otherMax[axis]);
+    }
+}
+
+static float surfaceArea(const float *boundsMin, const float *boundsMax) {
+    float extent[3];
+    f3_subtract(extent, (float *) boundsMax, (float *) boundsMin);
+
+    return 2 * (extent[0] * extent[1] + extent[1] * extent[2] + extent[2] * extent[0]);
+}
+
+static void padBounds(float *boundsMin, float *boundsMax) {
+    for (int axis = 0; axis < 3; axis++) {
+        float magnitude = f_max(fabsf(boundsMin[axis]), fabsf(boundsMax[axis]));
+        float pad = BVH_BOUNDS_EPSILON * (1 + magnitude + (boundsMax[axis] - boundsMin[axis]));
+
+        boundsMin[axis] -= pad;
+        boundsMax[axis] += pad;
+    }
+}
+
+static bool calculateQuadricBounds(QuadricVariables *q, float *boundsMin, float *boundsMax) {
+    // raycastQuadric() folds G into the z term of Cq, so a quadric with a linear x term does not
+    //   describe a consistent surface and is treated as unbounded
+    if (q->g != 0)
+        return false;
+
+    // Symmetric matrix M of the quadratic form x^T M x + L . x + J = 0
+    double m[3][3] = {
+        { q->a,     q->d / 2, q->e / 2 },
+        { q->d / 2, q->b,     q->f / 2 },
+        { q->e / 2, q->f / 2, q->c     }
+    };
+    double l[3] = { q->g, q->h, q->i };
+    double j = q->j;
+
+    // Negative definite forms describe the same ellipsoid with the sign flipped
+    if (m[0][0] < 0) {
+        for (int row = 0; row < 3; row++) {
+            for (int col = 0; col < 3; col++)
+                m[row][col] = -m[row][col];
+            l[row] = -l[row];
+        }
+        j = -j;
+    }
+
+    // Only ellipsoids (positive definite M, by Sylvester's criterion) are bounded
+    double minor2 = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+    double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+               - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+               + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+
+    if (m[0][0] <= 0 || minor2 <= 0 || det <= 0)
+        return false;
+
+    double inverse[3][3] = {
+        { (m[1][1] * m[2][2] - m[1][2] * m[2][1]) / det,
+          (m[0][2] * m[2][1] - m[0][1] * m[2][2]) / det,
+          (m[0][1] * m[1][2] - m[0][2] * m[1][1]) / det },
+        { (m[1][2] * m[2][0] - m[1][0] * m[2][2]) / det,
+          (m[0][0] * m[2][2] - m[0][2] * m[2][0]) / det,
+          (m[0][2] * m[1][0] - m[0][0] * m[1][2]) / det },
+        { (m[1][0] * m[2][1] - m[1][1] * m[2][0]) / det,
+          (m[0][1] * m[2][0] - m[0][0] * m[2][1]) / det,
+          (m[0][0] * m[1][1] - m[0][1] * m[1][0]) / det }
+    };
+
+    // Center c = -M^-1 L / 2, giving (x - c)^T M (x - c) = c^T M c - J
+    double center[3];
+    for (int row = 0; row < 3; row++)
+        center[row] = -(inverse[row][0] * l[0] + inverse[row][1] * l[1]
+                        + inverse[row][2] * l[2]) / 2;
+
+    double r = -j;
+    for (int row = 0; row < 3; row++)
+        for (int col = 0; col < 3; col++)
+            r += center[row] * m[row][col] * center[col];
+
+    // Empty or degenerate ellipsoids are left to the unbounded list to be safe
+    if (r <= 0)
+        return false;
+
+    for (int axis = 0; axis < 3; axis++) {
+        double halfExtent = sqrt(r * inverse[axis][axis]);
+
+        boundsMin[axis] = center[axis] - halfExtent;
+        boundsMax[axis] = center[axis] + halfExtent;
+    }
+
+    return true;
+}
+
+bool calculateObjectBounds(Object *object, float *boundsMin, float *boundsMax) {
+    switch (object->type) {
+        case PLANE:
+            return false;
+        case SPHERE:
+            for (int axis = 0; axis < 3; axis++) {
+                boundsMin[axis] = object->center[axis] - fabsf(object->radius);
+                boundsMax[axis] = object->center[axis] + fabsf(object->radius);
+            }
+            break;
+        case QUADRIC:
+            if (!calculateQuadricBounds(&object->quadricVars, boundsMin, boundsMax))
+                return false;
+            break;
+    }
+
+    padBounds(boundsMin, boundsMax);
+
+    return true;
+}
+
+static int binIndex(float centroid, float centroidMin, float binScale) {
+    int bin = (int) ((centroid - centroidMin) * binScale);
+
+    return bin < 0 ? 0 : (bin >= BVH_NUM_BINS ? BVH_NUM_BINS - 1 : bin);
+}
+
+static void updateNodeBounds(BVH *bvh, BVHNode *node, float (*primMin)[3], float (*primMax)[3]) {
+    node->boundsMin[0] = node->boundsMin[1] = node->boundsMin[2] = FLT_MAX;
+    node->boundsMax[0] = node->boundsMax[1] = node->boundsMax[2] = -FLT_MAX;
+
+    for (uint32_t index = 0; index < node->count; index++) {
+        uint32_t primIndex = bvh->objectIndices[node->leftFirst + index];
+        growBounds(node->boundsMin, node->boundsMax, primMin[primIndex], primMax[primIndex]);
+    }
+}
+
+// Find the cheapest binned SAH split of node, returning its cost or FLT_MAX if none exists
+static float findBestSplit(BVH *bvh, BVHNode *node, float (*centroids)[3],
+                           float (*primMin)[3], float (*primMax)[3], int *bestAxis,
+                           float *bestPosition, float *centroidMinOut, float *binScaleOut) {
+    float bestCost = FLT_MAX;
+
+    for (int axis = 0; axis < 3; axis++) {
+        float centroidMin = FLT_MAX, centroidMax = -FLT_MAX;
+
+        for (uint32_t index = 0; index < node->count; index++) {
+            float centroid = centroids[bvh->objectIndices[node->leftFirst + index]][axis];
+            centroidMin = f_min(centroidMin, centroid);
+            centroidMax = f_max(centroidMax, centroid);
+        }
+
+        if (centroidMin == centroidMax)
+            continue;
+
+        BVHBin bins[BVH_NUM_BINS];
+        for (int bin = 0; bin < BVH_NUM_BINS; bin++) {
+            bins[bin].boundsMin[0] = bins[bin].boundsMin[1] = bins[bin].boundsMin[2] = FLT_MAX;
+            bins[bin].boundsMax[0] = bins[bin].boundsMax[1] = bins[bin].boundsMax[2] = -FLT_MAX;
+            bins[bin].count = 0;
+        }
+
+        float binScale = BVH_NUM_BINS / (centroidMax - centroidMin);
+
+        for (uint32_t index = 0; index < node->count; index++) {
+            uint32_t primIndex = bvh->objectIndices[node->leftFirst + index];
+            BVHBin *bin = &bins[binIndex(centroids[primIndex][axis], centroidMin, binScale)];
+
+            growBounds(bin->boundsMin, bin->boundsMax, primMin[primIndex], primMax[primIndex]);
+            bin->count++;
+        }
+
+        // Sweep from both sides to get the area and count left and right of every bin plane
+        float leftArea[BVH_NUM_BINS - 1], rightArea[BVH_NUM_BINS - 1];
+        size_t leftCount[BVH_NUM_BINS - 1], rightCount[BVH_NUM_BINS - 1];
+        float leftMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        float leftMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        float rightMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        float rightMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        size_t leftSum = 0, rightSum = 0;
+
+        for (int plane = 0; plane < BVH_NUM_BINS - 1; plane++) {
+            BVHBin *left = &bins[plane];
+            BVHBin *right = &bins[BVH_NUM_BINS - 1 - plane];
+
+            leftSum += left->count;
+            leftCount[plane] = leftSum;
+            if (left->count > 0)
+                growBounds(leftMin, leftMax, left->boundsMin, left->boundsMax);
+            leftArea[plane] = leftSum > 0 ? surfaceArea(leftMin, leftMax) : 0;
+
+            int rightPlane = BVH_NUM_BINS - 2 - plane;
+            rightSum += right->count;
+            rightCount[rightPlane] = rightSum;
+            if (right->count > 0)
+                growBounds(rightMin, rightMax, right->boundsMin, right->boundsMax);
+            rightArea[rightPlane] = rightSum > 0 ? surfaceArea(rightMin, rightMax) : 0;
+        }
+
+        for (int plane = 0; plane < BVH_NUM_BINS - 1; plane++) {
+            if (leftCount[plane] == 0 || rightCount[plane] == 0)
+                continue;
+
+            float cost = leftCount[plane] * leftArea[plane] + rightCount[plane] * rightArea[plane];
+
+            if (cost < bestCost) {
+                bestCost = cost;
+                *bestAxis = axis;
+                *bestPosition = plane + 1;
+                *centroidMinOut = centroidMin;
+                *binScaleOut = binScale;
+            }
+        }
+    }
+
+    return bestCost;
+}
+
+void buildBVH(SceneData *sceneData) {
+    BVH *bvh = &sceneData->bvh;
+    size_t numObjects = sceneData->numObjects;
+
+    freeBVH(bvh);
+
+    float (*primMin)[3] = malloc(numObjects * sizeof(*primMin));
+    float (*primMax)[3] = malloc(numObjects * sizeof(*primMax));
+    float (*centroids)[3] = malloc(numObjects * sizeof(*centroids));
+    bvh->objectIndices = malloc(numObjects * sizeof(uint32_t));
+    bvh->unboundedIndices = malloc(numObjects * sizeof(uint32_t));
+    checkError(numObjects > 0 && (!primMin || !primMax || !centroids || !bvh->objectIndices
+                                  || !bvh->unboundedIndices),
+               "Error: Could not allocate memory for the BVH!\n");
+
+    size_t numBounded = 0;
+
+    for (size_t index = 0; index < numObjects; index++) {
+        if (calculateObjectBounds(&sceneData->objects[index], primMin[index], primMax[index])) {
+            for (int axis = 0; axis < 3; axis++)
+                centroids[index][axis] = (primMin[index][axis] + primMax[index][axis]) * .5f;
+
+            bvh->objectIndices[numBounded++] = index;
+        }
+        else {
+            bvh->unboundedIndices[bvh->numUnbounded++] = index;
+        }
+    }
+
+    if (numBounded > 0) {
+        // A binary tree with numBounded leaves at most has 2 * numBounded - 1 nodes
+        bvh->nodes = malloc((2 * numBounded - 1) * sizeof(BVHNode));
+        checkError(!bvh->nodes, "Error: Could not allocate memory for the BVH!\n");
+
+        BVHNode *root = &bvh->nodes[0];
+        root->leftFirst = 0;
+        root->count = numBounded;
+        updateNodeBounds(bvh, root, primMin, primMax);
+        bvh->numNodes = 1;
+
+        BVHBuildEntry stack[BVH_MAX_DEPTH + 2];
+        size_t stackSize = 0;
+        stack[stackSize++] = (BVHBuildEntry) { 0, 0 };
+
+        while (stackSize > 0) {
+            BVHBuildEntry entry = stack[--stackSize];
+            BVHNode *node = &bvh->nodes[entry.nodeIndex];
+
+            if (node->count <= 1 || entry.depth >= BVH_MAX_DEPTH)
+                continue;
+
+            int axis = 0;
+            float splitBin = 0, centroidMin = 0, binScale = 0;
+            float splitCost = findBestSplit(bvh, node, centroids, primMin, primMax, &axis,
+                                            &splitBin, &centroidMin, &binScale);
+            float leafCost = node->count * surfaceArea(node->boundsMin, node->boundsMax);
+
+            if (splitCost >= leafCost)
+                continue;
+
+            // Partition the leaf's object indices in place around the split plane
+            uint32_t *first = &bvh->objectIndices[node->leftFirst];
+            int64_t i = 0, j = (int64_t) node->count - 1;
+
+            while (i <= j) {
+                if (binIndex(centroids[first[i]][axis], centroidMin, binScale) < splitBin) {
+                    i++;
+                }
+                else {
+                    uint32_t swap = first[i];
+                    first[i] = first[j];
+                    first[j--] = swap;
+                }
+            }
+
+            if (i == 0 || i == node->count)
+                continue;
+
+            uint32_t leftIndex = bvh->numNodes;
+            BVHNode *left = &bvh->nodes[leftIndex];
+            BVHNode *right = &bvh->nodes[leftIndex + 1];
+            bvh->numNodes += 2;
+
+            left->leftFirst = node->leftFirst;
+            left->count = i;
+            right->leftFirst = node->leftFirst + i;
+            right->count = node->count - i;
+            updateNodeBounds(bvh, left, primMin, primMax);
+            updateNodeBounds(bvh, right, primMin, primMax);
+
+            node->leftFirst = leftIndex;
+            node->count = 0;
+
+            stack[stackSize++] = (BVHBuildEntry) { leftIndex, entry.depth + 1 };
+            stack[stackSize++] = (BVHBuildEntry) { leftIndex + 1, entry.depth + 1 };
+        }
+    }
+
+    free(primMin);
+    free(primMax);
+    free(centroids);
+}
+
+void freeBVH(BVH *bvh) {
+    free(bvh->nodes);
+    free(bvh->objectIndices);
+    free(bvh->unboundedIndices);
+
+    bvh->nodes = NULL;
+    bvh->numNodes = 0;
+    bvh->objectIndices = NULL;
+    bvh->unboundedIndices = NULL;
+    bvh->numUnbounded = 0;
+}
+
+size_t bvhMemory(const BVH *bvh) {
+    size_t numReferences = bvh->numUnbounded;
+
+    for (size_t index = 0; index < bvh->numNodes; index++)
+        numReferences += bvh->nodes[index].count;
+
+    return bvh->numNodes * sizeof(BVHNode) + numReferences * sizeof(uint32_t);
+}
+
+static inline bool intersectNodeBounds(const BVHNode *node, const float *R0, const float *invRd,
+                                       float rayPad, float maxT, float *tNear) {
+    float tx0 = (node->boundsMin[0] - rayPad - R0[0]) * invRd[0];
+    float tx1 = (node->boundsMax[0] + rayPad - R0[0]) * invRd[0];
+    float ty0 = (node->boundsMin[1] - rayPad - R0[1]) * invRd[1];
+    float ty1 = (node->boundsMax[1] + rayPad - R0[1]) * invRd[1];
+    float tz0 = (node->boundsMin[2] - rayPad - R0[2]) * invRd[2];
+    float tz1 = (node->boundsMax[2] + rayPad - R0[2]) * invRd[2];
+
+    float tEnter = f_max(f_max(f_min(tx0, tx1), f_min(ty0, ty1)), f_min(tz0, tz1));
+    float tExit = f_min(f_min(f_max(tx0, tx1), f_max(ty0, ty1)), f_max(tz0, tz1));
+
+    *tNear = tEnter;
+
+    // Ties with the current nearest hit must still be visited to keep the lowest object index
+    return tExit >= tEnter && tExit >= 0 && tEnter <= maxT;
+}
+
+static inline void testObject(SceneData *sceneData, uint32_t index, float *R0, float *Rd,
+                              Object *ignoredObject, bool largestT, float *bestT,
+                              uint32_t *bestIndex) {
+    if (&sceneData->objects[index] == ignoredObject)
+        return;
+
+    float t = raycastGeometryObject(&sceneData->geometry, index, R0, Rd, largestT);
+
+    if (t > 0 && (t < *bestT || (t == *bestT && index < *bestIndex))) {
+        *bestT = t;
+        *bestIndex = index;
+    }
+}
+
+static inline float prepareRay(float *R0, float *Rd, float *invRd) {
+    // Axis-parallel rays get a huge but finite inverse so the slab test never produces NaNs
+    for (int axis = 0; axis < 3; axis++)
+        invRd[axis] = 1 / (fabsf(Rd[axis]) > 1e-20f ? Rd[axis] : copysignf(1e-20f, Rd[axis]));
+
+    // Bounds padding for this ray
+    return BVH_RAY_EPSILON * f_max(f_max(fabsf(R0[0]), fabsf(R0[1])), fabsf(R0[2]));
+}
+
+Object *raycastBVH(SceneData *sceneData, float *R0, float *Rd, Object *ignoredObject,
+                   bool largestT, float *nearestT) {
+    BVH *bvh = &sceneData->bvh;
+    float bestT = INFINITY;
+    uint32_t bestIndex = UINT32_MAX;
+
+    for (size_t index = 0; index < bvh->numUnbounded; index++)
+        testObject(sceneData, bvh->unboundedIndices[index], R0, Rd, ignoredObject, largestT,
+                   &bestT, &bestIndex);
+
+    float invRd[3];
+    float rayPad = prepareRay(R0, Rd, invRd);
+
+    BVHStackEntry stack[BVH_STACK_SIZE];
+    size_t stackSize = 0;
+    const BVHNode *node = &bvh->nodes[0];
+    float tNear;
+
+    if (bvh->numNodes == 0 || !intersectNodeBounds(node, R0, invRd, rayPad, bestT, &tNear))
+        node = NULL;
+
+    while (node != NULL) {
+        if (node->count > 0) {
+            for (uint32_t index = 0; index < node->count; index++)
+                testObject(sceneData, bvh->objectIndices[node->leftFirst + index], R0, Rd,
+                           ignoredObject, largestT, &bestT, &bestIndex);
+            node = NULL;
+        }
+        else {
+            const BVHNode *near = &bvh->nodes[node->leftFirst];
+            const BVHNode *far = near + 1;
+            float tNearLeft, tNearRight;
+            bool hitLeft = intersectNodeBounds(near, R0, invRd, rayPad, bestT, &tNearLeft);
+            bool hitRight = intersectNodeBounds(far, R0, invRd, rayPad, bestT, &tNearRight);
+
+            if (hitLeft && hitRight) {
+                // Visit the nearer child first so the farther one can often be culled
+                if (tNearRight < tNearLeft) {
+                    const BVHNode *swap = near;
+                    near = far;
+                    far = swap;
+                    tNearRight = tNearLeft;
+                }
+
+                stack[stackSize++] = (BVHStackEntry) { far, tNearRight };
+                node = near;
+            }
+            else if (hitLeft) {
+                node = near;
+            }
+            else if (hitRight) {
+                node = far;
+            }
+            else {
+                node = NULL;
+            }
+        }
+
+        // Pop the next subtree that can still contain a nearer hit
+        while (node == NULL && stackSize > 0) {
+            BVHStackEntry entry = stack[--stackSize];
+
+            if (entry.tNear <= bestT)
+                node = entry.node;
+        }
+    }
+
+    *nearestT = bestT;
+
+    return bestIndex == UINT32_MAX ? NULL : &sceneData->objects[bestIndex];
+}
+
+static inline bool occludedByObject(SceneData *sceneData, uint32_t index, float *R0, float *Rd,
+                                    float tMax, Object *ignoredObject) {
+    if (&sceneData->objects[index] == ignoredObject)
+        return false;
+
+    float t = raycastGeometryObject(&sceneData->geometry, index, R0, Rd, false);
+
+    return t > 0 && t < tMax;
+}
+
+bool raycastOccludedBVH(SceneData *sceneData, float *R0, float *Rd, float tMax,
+                        Object *ignoredObject) {
+    BVH *bvh = &sceneData->bvh;
+
+    for (size_t index = 0; index < bvh->numUnbounded; index++) {
+        if (occludedByObject(sceneData, bvh->unboundedIndices[index], R0, Rd, tMax,
+                             ignoredObject))
+            return true;
+    }
+
+    float invRd[3];
+    float rayPad = prepareRay(R0, Rd, invRd);
+
+    // Any blocker will do, so children are visited in storage order without sorting
+    const BVHNode *stack[BVH_STACK_SIZE];
+    size_t stackSize = 0;
+    float tNear;
+
+    if (bvh->numNodes > 0 && intersectNodeBounds(&bvh->nodes[0], R0, invRd, rayPad, tMax, &tNear))
+        stack[stackSize++] = &bvh->nodes[0];
+
+    while (stackSize > 0) {
+        const BVHNode *node = stack[--stackSize];
+
+        if (node->count > 0) {
+            for (uint32_t index = 0; index < node->count; index++) {
+                if (occludedByObject(sceneData, bvh->objectIndices[node->leftFirst + index], R0,
+                                     Rd, tMax, ignoredObject))
+                    return true;
+            }
+        }
+        else {
+            const BVHNode *left = &bvh->nodes[node->leftFirst];
+
+            if (intersectNodeBounds(left + 1, R0, invRd, rayPad, tMax, &tNear))
+                stack[stackSize++] = left + 1;
+            if (intersectNodeBounds(left, R0, invRd, rayPad, tMax, &tNear))
+                stack[stackSize++] = left;
+        }
+    }
+
+    return false;
+}
+
+// Slab test of node against every ray of a packet sharing the origin R0. The per-ray arithmetic
+//   is that of intersectNodeBounds() with the origin terms hoisted, so a ray is marked active
+//   exactly when its single-ray traversal would enter the node.
+static inline bool intersectPacketBounds(const BVHNode *node, const float *R0, const float *invX,
+                                         const float *invY, const float *invZ, float rayPad,
+                                         const RayPacket *packet, uint32_t *active) {
+    float x0 = node->boundsMin[0] - rayPad - R0[0];
+    float x1 = node->boundsMax[0] + rayPad - R0[0];
+    float y0 = node->boundsMin[1] - rayPad - R0[1];
+    float y1 = node->boundsMax[1] + rayPad - R0[1];
+    float z0 = node->boundsMin[2] - rayPad - R0[2];
+    float z1 = node->boundsMax[2] + rayPad - R0[2];
+    int anyHit = 0;
+
+    for (size_t ray = 0; ray < packet->count; ray++) {
+        float tx0 = x0 * invX[ray];
+        float tx1 = x1 * invX[ray];
+        float ty0 = y0 * invY[ray];
+        float ty1 = y1 * invY[ray];
+        float tz0 = z0 * invZ[ray];
+        float tz1 = z1 * invZ[ray];
+
+        float tEnter = f_max(f_max(f_min(tx0, tx1), f_min(ty0, ty1)), f_min(tz0, tz1));
+        float tExit = f_min(f_min(f_max(tx0, tx1), f_max(ty0, ty1)), f_max(tz0, tz1));
+        bool hit = (tExit >= tEnter) & (tExit >= 0) & (tEnter <= packet->nearestT[ray]);
+
+        active[ray] = hit;
+        anyHit |= hit;
+    }
+
+    return anyHit;
+}
+
+static float distanceToBounds2(const BVHNode *node, const float *R0) {
+    float distance2 = 0;
+
+    for (int axis = 0; axis < 3; axis++) {
+        float center = (node->boundsMin[axis] + node->boundsMax[axis]) * .5f;
+        distance2 += (center - R0[axis]) * (center - R0[axis]);
+    }
+
+    return distance2;
+}
+
+void raycastPacketBVH(SceneData *sceneData, float *R0, RayPacket *packet) {
+    BVH *bvh = &sceneData->bvh;
+    SceneGeometry *geometry = &sceneData->geometry;
+    _Alignas(GEOMETRY_ALIGNMENT) float invX[RAY_PACKET_SIZE];
+    _Alignas(GEOMETRY_ALIGNMENT) float invY[RAY_PACKET_SIZE];
+    _Alignas(GEOMETRY_ALIGNMENT) float invZ[RAY_PACKET_SIZE];
+    uint32_t active[RAY_PACKET_SIZE];
+    float rayPad = 0;
+
+    clearRayPacket(packet);
+
+    for (size_t ray = 0; ray < packet->count; ray++) {
+        float Rd[3] = { packet->directionX[ray], packet->directionY[ray],
+                        packet->directionZ[ray] };
+        float invRd[3];
+
+        // The padding only depends on the shared origin
+        rayPad = prepareRay(R0, Rd, invRd);
+        invX[ray] = invRd[0];
+        invY[ray] = invRd[1];
+        invZ[ray] = invRd[2];
+        active[ray] = 1;
+    }
+
+    for (size_t index = 0; index < bvh->numUnbounded; index++)
+        raycastGeometryPacketObject(geometry, bvh->unboundedIndices[index], R0, packet, active);
+
+    // Nodes are tested when popped, against the nearest hits found so far, so a subtree pushed
+    //   early is still culled for every ray that found a nearer hit in the meantime
+    const BVHNode *stack[BVH_STACK_SIZE];
+    size_t stackSize = 0;
+
+    if (bvh->numNodes > 0)
+        stack[stackSize++] = &bvh->nodes[0];
+
+    while (stackSize > 0) {
+        const BVHNode *node = stack[--stackSize];
+
+        if (!intersectPacketBounds(node, R0, invX, invY, invZ, rayPad, packet, active))
+            continue;
+
+        if (node->count > 0) {
+            for (uint32_t index = 0; index < node->count; index++)
+                raycastGeometryPacketObject(geometry, bvh->objectIndices[node->leftFirst + index],
+                                            R0, packet, active);
+        }
+        else {
+            const BVHNode *near = &bvh->nodes[node->leftFirst];
+            const BVHNode *far = near + 1;
+
+            // All rays start at R0, so the child centered closer to it is visited first
+            if (distanceToBounds2(far, R0) < distanceToBounds2(near, R0)) {
+                far = near;
+                near = far + 1;
+            }
+
+            stack[stackSize++] = far;
+            stack[stackSize++] = near;
+        }
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of centroid bins evaluated per axis when searching for the cheapest SAH split
+#define BVH_NUM_BINS 16
+
+// Nodes deeper than this are always turned into leaves so traversal fits a fixed stack
+#define BVH_MAX_DEPTH 48
+#define BVH_STACK_SIZE 64
+
+// Relative padding applied to primitive bounds to absorb intersection rounding error
+#define BVH_BOUNDS_EPSILON 1e-4f
+
+// Extra padding per unit of ray origin magnitude, since rounding error grows with distance
+#define BVH_RAY_EPSILON 1e-6f
+
+#include "geometry.h"
+
+struct SceneData;
+struct Object;
+
+// Flattened BVH node (32 bytes, two per cache line)
+typedef struct BVHNode {
+    float boundsMin[3];
+    uint32_t leftFirst; // Left child index for interior nodes, first object index for leaves
+    float boundsMax[3];
+    uint32_t count;     // Number of objects in a leaf, 0 for interior nodes
+} BVHNode;
+
+typedef struct BVH {
+    BVHNode *nodes;
+    size_t numNodes;
+
+    // Leaf object references into SceneData.objects, ordered so every leaf is contiguous
+    uint32_t *objectIndices;
+
+    // Planes and unbounded quadrics, tested for every ray
+    uint32_t *unboundedIndices;
+    size_t numUnbounded;
+} BVH;
+
+/**
+ Compute the axis-aligned bounds of object, storing them in boundsMin and boundsMax. Returns false
+ if the object is unbounded (planes and non-ellipsoid quadrics).
+ */
+bool calculateObjectBounds(struct Object *object, float *boundsMin, float *boundsMax);
+
+/**
+ Build a SAH BVH over the bounded objects of sceneData, storing it in sceneData->bvh. Any
+ previously built BVH is freed first.
+ */
+void buildBVH(struct SceneData *sceneData);
+
+/**
+ Free the memory held by bvh and reset it to an empty hierarchy.
+ */
+void freeBVH(BVH *bvh);
+
+/**
+ Bytes of memory held by bvh
+ */
+size_t bvhMemory(const BVH *bvh);
+
+/**
+ Find the nearest object hit by the ray R0 + t * Rd (t > 0) using the BVH of sceneData, skipping
+ ignoredObject. Produces the same result as the linear scan in raycast(), including choosing the
+ lowest object index when two hits are equally near.
+ */
+struct Object *raycastBVH(struct SceneData *sceneData, float *R0, float *Rd,
+                          struct Object *ignoredObject, bool largestT, float *nearestT);
+
+/**
+ Test whether any object other than ignoredObject is hit by the ray R0 + t * Rd with 0 < t < tMax
+ using the BVH of sceneData, returning as soon as the first such hit is found.
+ */
+bool raycastOccludedBVH(struct SceneData *sceneData, float *R0, float *Rd, float tMax,
+                        struct Object *ignoredObject);
+
+/**
+ Find the nearest object hit by every ray of packet, all starting at R0, traversing the BVH of
+ sceneData once for the whole packet. Each ray gets the same result as raycastBVH() with no ignored
+ object.
+ */
+void raycastPacketBVH(struct SceneData *sceneData, float *R0, RayPacket *packet);
@@ -0,0 +1,264 @@
+#include "checkpoint.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "partial.h"
+#include "ppmrw.h"
+#include "raytrace.h"
+#include "stats.h"
+#include "utils.h"
+
+// Render in progress, with what its checkpoints hold
+typedef struct Checkpoint {
+    SceneData *sceneData;
+    MappedPPM image;
+
+    // Index file, and the temporary file it is written to before replacing it
+    char *indexFileName;
+    char *temporaryFileName;
+
+    // Index lines before the tile list, identifying the render
+    char settings[CHECKPOINT_SETTINGS_LENGTH];
+
+    // Tiles of the frame whose pixels are in the output, numbered row by row
+    bool *finishedTiles;
+    int tileColumns, tileRows;
+
+    double intervalMs, lastSaved;
+} Checkpoint;
+
+static volatile sig_atomic_t stopRequested;
+
+static void requestStop(int signal) {
+    (void) signal;
+    stopRequested = 1;
+}
+
+static uint64_t hashSceneFile(const char *fileName) {
+    int fd = open(fileName, O_RDONLY);
+    checkError(fd < 0, "Error: Could not open input file \"%s\"!\n", fileName);
+
+    struct stat fileStat;
+    checkError(fstat(fd, &fileStat) != 0, "Error: Could not read input file \"%s\"!\n", fileName);
+
+    size_t size = fileStat.st_size;
+    uint64_t hash = hashBytes("", 0);
+
+    if (size > 0) {
+        void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        checkError(data == MAP_FAILED, "Error: Could not read input file \"%s\"!\n", fileName);
+
+        hash = hashBytes(data, size);
+        munmap(data, size);
+    }
+
+    close(fd);
+
+    return hash;
+}
+
+static char *appendSuffix(const char *fileName, const char *suffix) {
+    size_t length = strlen(fileName);
+    char *name = malloc(length + strlen(suffix) + 1);
+    checkError(name == NULL, "Error: Could not allocate memory for a file name!\n");
+
+    memcpy(name, fileName, length);
+    strcpy(name + length, suffix);
+
+    return name;
+}
+
+static void saveCheckpoint(Checkpoint *checkpoint) {
+    const SceneData *sceneData = checkpoint->sceneData;
+
+    // The pixels go first, so the index never lists tiles the output does not hold yet
+    syncImage(&checkpoint->image);
+
+    char *tileList = formatTileList(checkpoint->finishedTiles, sceneData->camera.imageWidth,
+                                    sceneData->camera.imageHeight);
+
+    FILE *file = fopen(checkpoint->temporaryFileName, "w");
+    checkError(file == NULL, "Error: Could not open checkpoint \"%s\"!\n",
+               checkpoint->temporaryFileName);
+
+    fprintf(file, "%stiles %s\n", checkpoint->settings, tileList);
+    checkError(fflush(file) != 0 || fsync(fileno(file)) != 0 || fclose(file) != 0,
+               "Error: Could not write checkpoint \"%s\"!\n", checkpoint->temporaryFileName);
+    checkError(rename(checkpoint->temporaryFileName, checkpoint->indexFileName) != 0,
+               "Error: Could not replace checkpoint \"%s\"!\n", checkpoint->indexFileName);
+
+    free(tileList);
+    checkpoint->lastSaved = nowMs();
+}
+
+// Mark the tiles listed in the existing index as finished, returning false if there is none
+static bool loadCheckpoint(Checkpoint *checkpoint) {
+    const SceneData *sceneData = checkpoint->sceneData;
+    const char *fileName = checkpoint->indexFileName;
+
+    FILE *file = fopen(fileName, "r");
+
+    if (file == NULL) {
+        checkError(errno != ENOENT, "Error: Could not open checkpoint \"%s\"!\n", fileName);
+        return false;
+    }
+
+    char *text = NULL;
+    size_t textCapacity = 0;
+    bool readFailed = getdelim(&text, &textCapacity, '\0', file) < 0;
+    fclose(file);
+    checkError(readFailed, "Error: Could not read checkpoint \"%s\"!\n", fileName);
+
+    size_t settingsLength = strlen(checkpoint->settings);
+    checkError(strncmp(text, checkpoint->settings, settingsLength) != 0,
+               "Error: \"%s\" is a checkpoint of another frame, scene or settings!\n", fileName);
+
+    char *tileList = text + settingsLength;
+    size_t listLength = strlen(tileList);
+    checkError(strncmp(tileList, "tiles ", strlen("tiles ")) != 0
+               || tileList[listLength - 1] != '\n',
+               "Error: Invalid checkpoint \"%s\"!\n", fileName);
+
+    tileList[listLength - 1] = '\0';
+    tileList += strlen("tiles ");
+
+    if (*tileList != '\0') {
+        bool *tiles = parseTileList(tileList, sceneData->camera.imageWidth,
+                                    sceneData->camera.imageHeight);
+        memcpy(checkpoint->finishedTiles, tiles,
+               (size_t) checkpoint->tileColumns * checkpoint->tileRows * sizeof(bool));
+        free(tiles);
+    }
+
+    free(text);
+
+    return true;
+}
+
+static bool isTileRowFinished(const Checkpoint *checkpoint, int tileRow) {
+    for (int column = 0; column < checkpoint->tileColumns; column++) {
+        if (!checkpoint->finishedTiles[(size_t) tileRow * checkpoint->tileColumns + column])
+            return false;
+    }
+
+    return true;
+}
+
+// BandFunction storing a finished row of tiles in the output
+static void finishTileRow(void *context, const Pixel *rows, int firstRow, int numRows) {
+    Checkpoint *checkpoint = context;
+    int width = checkpoint->sceneData->camera.imageWidth;
+    int tileRow = firstRow / TILE_SIZE;
+
+    memcpy(&checkpoint->image.imageData[(size_t) firstRow * width], rows,
+           (size_t) width * numRows * sizeof(Pixel));
+    memset(&checkpoint->finishedTiles[(size_t) tileRow * checkpoint->tileColumns], true,
+           checkpoint->tileColumns * sizeof(bool));
+
+    if (stopRequested) {
+        saveCheckpoint(checkpoint);
+
+        int finishedRows = 0;
+
+        for (int row = 0; row < checkpoint->tileRows; row++)
+            finishedRows += isTileRowFinished(checkpoint, row);
+
+        fprintf(stderr, "Stopped with %i of %i rows of tiles done; continue with --resume\n",
+                finishedRows, checkpoint->tileRows);
+        exit(EXIT_FAILURE);
+    }
+
+    if (nowMs() - checkpoint->lastSaved >= checkpoint->intervalMs)
+        saveCheckpoint(checkpoint);
+}
+
+void renderCheckpointed(SceneData *sceneData, const char *sceneFileName, int intervalSeconds,
+                        bool resume, TileScheduler *scheduler, const char *outputFilename) {
+    int width = sceneData->camera.imageWidth;
+    int height = sceneData->camera.imageHeight;
+
+    Checkpoint checkpoint = { sceneData };
+    checkpoint.indexFileName = appendSuffix(outputFilename, CHECKPOINT_SUFFIX);
+    checkpoint.temporaryFileName = appendSuffix(checkpoint.indexFileName, ".tmp");
+    checkpoint.tileColumns = (width + TILE_SIZE - 1) / TILE_SIZE;
+    checkpoint.tileRows = (height + TILE_SIZE - 1) / TILE_SIZE;
+    checkpoint.intervalMs = intervalSeconds * 1e3;
+
+    checkpoint.finishedTiles = calloc((size_t) checkpoint.tileColumns * checkpoint.tileRows,
+                                      sizeof(bool));
+    checkError(checkpoint.finishedTiles == NULL,
+               "Error: Could not allocate memory for the checkpoint!\n");
+
+    snprintf(checkpoint.settings, sizeof(checkpoint.settings),
+             "raytrace checkpoint 1\n"
+             "frame %i %i\n"
+             "scene %016" PRIx64 "\n"
+             "samples %i\n"
+             "min-contribution %.9g\n"
+             "specular %i\n",
+             width, height, hashSceneFile(sceneFileName), sceneData->maxSamples,
+             sceneData->minContribution, sceneData->specularMode);
+
+    // An index without its unfinished image is left over from a render that completed
+    bool resumed = resume && loadCheckpoint(&checkpoint)
+                   && reopenImage(&checkpoint.image, width, height, 255, outputFilename);
+
+    if (!resumed) {
+        // An index left by an earlier render would otherwise describe the new, black image
+        memset(checkpoint.finishedTiles, false,
+               (size_t) checkpoint.tileColumns * checkpoint.tileRows * sizeof(bool));
+        checkError(unlink(checkpoint.indexFileName) != 0 && errno != ENOENT,
+                   "Error: Could not remove checkpoint \"%s\"!\n", checkpoint.indexFileName);
+        checkError(!mapImage(&checkpoint.image, width, height, 255, outputFilename),
+                   "Error: Could not map an image for \"%s\", which checkpoints need!\n",
+                   outputFilename);
+    }
+
+    struct sigaction stopAction = {};
+    stopAction.sa_handler = requestStop;
+    sigaction(SIGINT, &stopAction, NULL);
+    sigaction(SIGTERM, &stopAction, NULL);
+
+    checkpoint.lastSaved = nowMs();
+
+    // Runs of unfinished rows of tiles are rendered together, a row of tiles per band
+    for (int tileRow = 0; tileRow < checkpoint.tileRows; tileRow++) {
+        if (isTileRowFinished(&checkpoint, tileRow))
+            continue;
+
+        int endTileRow = tileRow + 1;
+
+        while (endTileRow < checkpoint.tileRows && !isTileRowFinished(&checkpoint, endTileRow))
+            endTileRow++;
+
+        int endRow = endTileRow * TILE_SIZE < height ? endTileRow * TILE_SIZE : height;
+        Tile rows = { 0, tileRow * TILE_SIZE, width, endRow - tileRow * TILE_SIZE };
+        renderSceneRegion(sceneData, &rows, TILE_SIZE, scheduler, finishTileRow, &checkpoint);
+
+        tileRow = endTileRow;
+    }
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    STATS_PHASE_BEGIN(PHASE_WRITE);
+    syncImage(&checkpoint.image);
+    unmapImage(&checkpoint.image);
+    STATS_PHASE_END(PHASE_WRITE);
+
+    checkError(unlink(checkpoint.indexFileName) != 0 && errno != ENOENT,
+               "Error: Could not remove checkpoint \"%s\"!\n", checkpoint.indexFileName);
+
+    free(checkpoint.finishedTiles);
+    free(checkpoint.temporaryFileName);
+    free(checkpoint.indexFileName);
+}
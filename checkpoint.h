@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "scheduler.h"
+
+// Seconds between checkpoints when --resume is given without --checkpoint-interval
+#define DEFAULT_CHECKPOINT_INTERVAL 60
+
+// Added to the output path to name its checkpoint index
+#define CHECKPOINT_SUFFIX ".checkpoint"
+
+// Room for the lines of a checkpoint index before its tile list
+#define CHECKPOINT_SETTINGS_LENGTH 256
+
+struct SceneData;
+
+/*
+ A checkpoint is the partly rendered P6 image mapImage() keeps next to the output, together with
+ an index next to it, a text file of the lines
+
+   raytrace checkpoint 1
+   frame WIDTH HEIGHT
+   scene HASH
+   samples N
+   min-contribution W
+   specular MODE
+   tiles LIST
+
+ naming the frame, scene contents and render settings it belongs to, then the tiles of the output
+ that are finished (see parseTileList()). The index is only replaced once the pixels it lists are
+ stored in the image, and is removed when the image is complete and has replaced the output.
+ */
+
+/**
+ Render the frame of sceneData, loaded from sceneFileName, straight into a mapped P6 image for
+ outputFilename a row of tiles at a time, saving a checkpoint whenever intervalSeconds have passed
+ since the last one. When resume is set and outputFilename has a checkpoint, the tiles it lists
+ are kept rather than rendered again; without one, or without its image, the render starts over.
+ Exits with an error if the checkpoint is of another frame, scene or settings. SIGINT and SIGTERM
+ stop the render at the next row of tiles, after saving a checkpoint.
+ */
+void renderCheckpointed(struct SceneData *sceneData, const char *sceneFileName,
+                        int intervalSeconds, bool resume, TileScheduler *scheduler,
+                        const char *outputFilename);
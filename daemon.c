@@ -0,0 +1,512 @@
+#include "daemon.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "partial.h"
+#include "ppmrw.h"
+#include "raytrace.h"
+#include "scenefile.h"
+#include "scheduler.h"
+#include "utils.h"
+
+// Longest request line, which holds at most a keyword and a path
+#define MAX_REQUEST_LINE 8192
+
+typedef struct CachedScene {
+    SceneData sceneData;
+    uint64_t hash;
+    size_t size;
+
+    // Number of the job that used the scene last, 0 for an empty slot
+    uint64_t lastUsed;
+} CachedScene;
+
+typedef struct Daemon {
+    const RenderOptions *options;
+    TileScheduler scheduler;
+    CachedScene cache[SCENE_CACHE_SIZE];
+    uint64_t numJobs;
+} Daemon;
+
+/**
+ Job being read from a connection or rendered, with everything it holds so that it can be
+ released when it fails halfway
+ */
+typedef struct DaemonJob {
+    char *sceneFileName;
+    char *inlineScene;
+    size_t inlineSize;
+    int width, height;
+    Tile region;
+    bool hasRegion;
+    int maxSamples, format;
+    char *outputFileName;
+
+    // First error in the request lines, reported instead of rendering
+    char error[ERROR_MESSAGE_LENGTH];
+    bool failed;
+
+    // Held while the job runs
+    const char *mappedScene;
+    size_t mappedSize;
+    SceneData loadingScene;
+    bool isLoading;
+    PPMStream stream;
+    bool isStreaming;
+    Pixel *regionRows;
+
+    FILE *reply;
+    int rowsDone;
+} DaemonJob;
+
+static volatile sig_atomic_t stopRequested;
+
+static void requestStop(int signal) {
+    (void) signal;
+    stopRequested = 1;
+}
+
+static void startJob(DaemonJob *job, const RenderOptions *options, FILE *reply) {
+    *job = (DaemonJob) {};
+    job->maxSamples = options->maxSamples;
+    job->format = options->outputFormat;
+    job->reply = reply;
+}
+
+static void releaseJob(DaemonJob *job) {
+    free(job->sceneFileName);
+    free(job->inlineScene);
+    free(job->outputFileName);
+    free(job->regionRows);
+
+    if (job->mappedScene)
+        munmap((void *) job->mappedScene, job->mappedSize);
+
+    if (job->isLoading)
+        freeSceneData(&job->loadingScene);
+
+    // A failed job leaves its output as it was
+    if (job->isStreaming)
+        abortImageStream(&job->stream);
+
+    job->mappedScene = NULL;
+    job->isLoading = job->isStreaming = false;
+}
+
+static char *copyString(const char *text) {
+    char *copy = strdup(text);
+    checkError(copy == NULL, "Error: Could not allocate memory for a request!\n");
+
+    return copy;
+}
+
+static int parseJobInt(const char *text, const char *name, int min) {
+    char *end;
+    long value = strtol(text, &end, 10);
+
+    checkError(*text == '\0' || *end != '\0' || value < min || value > INT32_MAX,
+               "Error: Invalid %s \"%s\"!\n", name, text);
+
+    return (int) value;
+}
+
+// Split the values of a request line into fields, returning how many there were
+static int splitFields(char *text, char **fields, int maxFields) {
+    int numFields = 0;
+
+    for (char *field = strtok(text, " \t"); field; field = strtok(NULL, " \t")) {
+        checkError(numFields == maxFields, "Error: Too many values in a request line!\n");
+        fields[numFields++] = field;
+    }
+
+    return numFields;
+}
+
+// Add the request line to job, reading an inline scene from input
+static void readJobLine(DaemonJob *job, char *line, FILE *input) {
+    char *values = line + strcspn(line, " \t");
+
+    if (*values != '\0')
+        *values++ = '\0';
+
+    char *fields[4];
+    int numFields;
+
+    if (strcmp(line, "scene") == 0) {
+        checkError(*values == '\0', "Error: Missing scene path!\n");
+        free(job->sceneFileName);
+        job->sceneFileName = copyString(values);
+    }
+    else if (strcmp(line, "inline-scene") == 0) {
+        numFields = splitFields(values, fields, 1);
+        checkError(numFields != 1, "Error: inline-scene takes a length!\n");
+
+        char *end;
+        unsigned long long size = strtoull(fields[0], &end, 10);
+        checkError(*fields[0] < '0' || *fields[0] > '9' || *end != '\0' || size >= SIZE_MAX,
+                   "Error: Invalid scene length \"%s\"!\n", fields[0]);
+
+        free(job->inlineScene);
+        job->inlineScene = malloc(size > 0 ? size : 1);
+        checkError(job->inlineScene == NULL,
+                   "Error: Could not allocate memory for a %llu byte scene!\n", size);
+
+        job->inlineSize = fread(job->inlineScene, 1, size, input);
+        checkError(job->inlineSize != size, "Error: The inline scene ended early!\n");
+    }
+    else if (strcmp(line, "size") == 0) {
+        numFields = splitFields(values, fields, 2);
+        checkError(numFields != 2, "Error: size takes a width and a height!\n");
+        job->width = parseJobInt(fields[0], "width", 1);
+        job->height = parseJobInt(fields[1], "height", 1);
+    }
+    else if (strcmp(line, "region") == 0) {
+        numFields = splitFields(values, fields, 4);
+        checkError(numFields != 4, "Error: region takes x, y, width and height!\n");
+        job->region.x = parseJobInt(fields[0], "region x", 0);
+        job->region.y = parseJobInt(fields[1], "region y", 0);
+        job->region.width = parseJobInt(fields[2], "region width", 1);
+        job->region.height = parseJobInt(fields[3], "region height", 1);
+        job->hasRegion = true;
+    }
+    else if (strcmp(line, "aa") == 0) {
+        numFields = splitFields(values, fields, 1);
+        checkError(numFields != 1, "Error: aa takes a sample count!\n");
+
+        int samples = parseJobInt(fields[0], "sample count", 1);
+        int side = 1;
+
+        while ((side + 1) * (side + 1) <= samples)
+            side++;
+
+        checkError(side * side != samples || samples > MAX_SAMPLES,
+                   "Error: The sample count must be a square number up to %i!\n", MAX_SAMPLES);
+        job->maxSamples = samples;
+    }
+    else if (strcmp(line, "format") == 0) {
+        if (strcmp(values, "p3") == 0)
+            job->format = 3;
+        else if (strcmp(values, "p6") == 0)
+            job->format = 6;
+        else
+            checkError(true, "Error: Unknown output format \"%s\"!\n", values);
+    }
+    else if (strcmp(line, "output") == 0) {
+        checkError(*values == '\0', "Error: Missing output path!\n");
+        free(job->outputFileName);
+        job->outputFileName = copyString(values);
+    }
+    else {
+        checkError(true, "Error: Unknown request \"%s\"!\n", line);
+    }
+}
+
+// Scene of the job, from the cache or loaded into it
+static SceneData *jobScene(Daemon *daemon, DaemonJob *job) {
+    double start = nowMs();
+    const char *data = job->inlineScene;
+    size_t size = job->inlineSize;
+    const char *fileName = "inline scene";
+
+    if (data == NULL) {
+        fileName = job->sceneFileName;
+
+        int fd = open(fileName, O_RDONLY);
+        checkError(fd < 0, "Error: Could not open input file \"%s\"!\n", fileName);
+
+        struct stat fileStat;
+        bool statFailed = fstat(fd, &fileStat) != 0;
+        size = statFailed ? 0 : fileStat.st_size;
+        data = "";
+
+        if (size > 0) {
+            data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            data = data == MAP_FAILED ? NULL : data;
+        }
+
+        close(fd);
+        checkError(statFailed || data == NULL, "Error: Could not read input file \"%s\"!\n",
+                   fileName);
+
+        if (size > 0) {
+            job->mappedScene = data;
+            job->mappedSize = size;
+        }
+    }
+
+    uint64_t hash = hashBytes(data, size);
+    CachedScene *cached = NULL, *oldest = &daemon->cache[0];
+
+    for (int slot = 0; slot < SCENE_CACHE_SIZE; slot++) {
+        CachedScene *entry = &daemon->cache[slot];
+
+        if (entry->lastUsed > 0 && entry->hash == hash && entry->size == size)
+            cached = entry;
+
+        if (entry->lastUsed < oldest->lastUsed)
+            oldest = entry;
+    }
+
+    bool isCached = cached != NULL;
+
+    if (!isCached) {
+        // The scene is loaded aside so a failure leaves the cache as it was
+        const RenderOptions *options = daemon->options;
+        job->loadingScene = (SceneData) {};
+        job->loadingScene.camera.vpDistance = 1;
+        job->loadingScene.minContribution = options->minContribution;
+        job->loadingScene.specularMode = options->specularMode;
+        job->loadingScene.accelerator = options->accelerator;
+        job->isLoading = true;
+
+        loadSceneData(data, size, fileName, &job->loadingScene);
+
+        cached = oldest;
+
+        if (cached->lastUsed > 0)
+            freeSceneData(&cached->sceneData);
+
+        cached->sceneData = job->loadingScene;
+        cached->hash = hash;
+        cached->size = size;
+        job->isLoading = false;
+    }
+
+    cached->lastUsed = ++daemon->numJobs;
+
+    fprintf(job->reply, "scene %s %016" PRIx64 " %.3f\n", isCached ? "cached" : "loaded", hash,
+            nowMs() - start);
+    fflush(job->reply);
+
+    return &cached->sceneData;
+}
+
+static void writeJobBand(void *context, const Pixel *rows, int firstRow, int numRows) {
+    DaemonJob *job = context;
+    int width = job->width, regionWidth = job->region.width;
+
+    (void) firstRow;
+
+    for (int row = 0; row < numRows; row++) {
+        memcpy(&job->regionRows[(size_t) row * regionWidth],
+               &rows[(size_t) row * width + job->region.x], regionWidth * sizeof(Pixel));
+    }
+
+    writeImageRows(&job->stream, job->regionRows, numRows);
+    job->rowsDone += numRows;
+
+    fprintf(job->reply, "progress %i %i\n", job->rowsDone, job->region.height);
+    fflush(job->reply);
+}
+
+static void runJob(Daemon *daemon, DaemonJob *job) {
+    double start = nowMs();
+
+    checkError(job->width == 0, "Error: The job has no size!\n");
+    checkError(job->outputFileName == NULL, "Error: The job has no output path!\n");
+    checkError(job->sceneFileName == NULL && job->inlineScene == NULL,
+               "Error: The job has no scene!\n");
+
+    if (!job->hasRegion)
+        job->region = (Tile) { 0, 0, job->width, job->height };
+
+    checkError(job->region.width > job->width - job->region.x
+               || job->region.height > job->height - job->region.y,
+               "Error: The region does not fit in the %ix%i frame!\n", job->width, job->height);
+
+    SceneData *sceneData = jobScene(daemon, job);
+
+    if (job->mappedScene) {
+        munmap((void *) job->mappedScene, job->mappedSize);
+        job->mappedScene = NULL;
+    }
+
+    sceneData->camera.imageWidth = job->width;
+    sceneData->camera.imageHeight = job->height;
+    sceneData->maxSamples = job->maxSamples;
+
+    job->regionRows = malloc((size_t) job->region.width * DAEMON_BAND_ROWS * sizeof(Pixel));
+    checkError(job->regionRows == NULL, "Error: Could not allocate memory for %i rows!\n",
+               DAEMON_BAND_ROWS);
+
+    // Regions are written as partial images, so the parts of a frame can be merged
+    char comment[REGION_COMMENT_LENGTH];
+    formatRegionComment(comment, sizeof(comment), &job->region, job->width, job->height);
+
+    beginImageStreamAtomically(&job->stream, job->region.width, job->region.height, 255,
+                               job->format, job->hasRegion ? comment : NULL, job->outputFileName,
+                               &daemon->scheduler);
+    job->isStreaming = true;
+
+    renderSceneRegion(sceneData, &job->region, DAEMON_BAND_ROWS, &daemon->scheduler,
+                      writeJobBand, job);
+    endImageStream(&job->stream);
+    job->isStreaming = false;
+
+    fprintf(job->reply, "done %.3f\n", nowMs() - start);
+    fflush(job->reply);
+}
+
+// The first line of a checkError() message, without its "Error: " prefix
+static const char *errorLine(char *message) {
+    message[strcspn(message, "\n")] = '\0';
+
+    return strncmp(message, "Error: ", 7) == 0 ? message + 7 : message;
+}
+
+// Add a request line to job, or run the job if the line ends it. Errors are reported to the
+//   client when the job ends.
+static void handleRequestLine(Daemon *daemon, DaemonJob *job, char *line, bool isComplete,
+                              FILE *input) {
+    bool isRender = strcmp(line, "render") == 0;
+    jmp_buf jump;
+
+    if (setjmp(jump) != 0) {
+        errorJump = NULL;
+
+        if (isRender) {
+            fprintf(job->reply, "error %s\n", errorLine(errorMessage));
+            fflush(job->reply);
+        }
+        else if (!job->failed) {
+            snprintf(job->error, sizeof(job->error), "%s", errorLine(errorMessage));
+            job->failed = true;
+        }
+
+        return;
+    }
+
+    errorJump = &jump;
+    checkError(!isComplete, "Error: Request line longer than %i bytes!\n", MAX_REQUEST_LINE - 2);
+
+    if (isRender && job->failed) {
+        fprintf(job->reply, "error %s\n", job->error);
+        fflush(job->reply);
+    }
+    else if (isRender) {
+        runJob(daemon, job);
+    }
+    else if (line[0] != '\0') {
+        // Lines after an error are still read, so an inline scene is not taken for requests
+        readJobLine(job, line, input);
+    }
+
+    errorJump = NULL;
+}
+
+static void serveConnection(Daemon *daemon, int connection) {
+    int replyConnection = dup(connection);
+    FILE *input = fdopen(connection, "r");
+    FILE *reply = replyConnection >= 0 ? fdopen(replyConnection, "w") : NULL;
+
+    if (input == NULL || reply == NULL) {
+        fprintf(stderr, "Error: Could not open a connection!\n");
+
+        if (input)
+            fclose(input);
+        else
+            close(connection);
+
+        if (reply)
+            fclose(reply);
+        else if (replyConnection >= 0)
+            close(replyConnection);
+
+        return;
+    }
+
+    DaemonJob job;
+    startJob(&job, daemon->options, reply);
+
+    char line[MAX_REQUEST_LINE];
+
+    while (fgets(line, sizeof(line), input)) {
+        size_t length = strcspn(line, "\r\n");
+        bool isComplete = line[length] != '\0' || feof(input);
+        line[length] = '\0';
+
+        bool isRender = strcmp(line, "render") == 0;
+        handleRequestLine(daemon, &job, line, isComplete, input);
+
+        // The rest of an overlong line is skipped so it is not read as requests
+        while (!isComplete && fgets(line, sizeof(line), input))
+            isComplete = line[strcspn(line, "\n")] != '\0';
+
+        if (isRender) {
+            releaseJob(&job);
+            startJob(&job, daemon->options, reply);
+        }
+    }
+
+    releaseJob(&job);
+    fclose(input);
+    fclose(reply);
+}
+
+void runDaemon(const char *socketName, const RenderOptions *options) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    checkError(strlen(socketName) >= sizeof(address.sun_path),
+               "Error: Socket path \"%s\" is too long!\n", socketName);
+    strcpy(address.sun_path, socketName);
+
+    // A socket left behind by a daemon that was killed is replaced, anything else is kept
+    struct stat fileStat;
+
+    if (lstat(socketName, &fileStat) == 0 && S_ISSOCK(fileStat.st_mode))
+        unlink(socketName);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    checkError(listener < 0, "Error: Could not create a socket!\n");
+    checkError(bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0,
+               "Error: Could not bind a socket to \"%s\"!\n", socketName);
+    checkError(listen(listener, DAEMON_BACKLOG) != 0,
+               "Error: Could not listen on \"%s\"!\n", socketName);
+
+    // Clients that hang up are noticed through failed writes; stop signals interrupt accept()
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sigaction stopAction = {};
+    stopAction.sa_handler = requestStop;
+    sigaction(SIGINT, &stopAction, NULL);
+    sigaction(SIGTERM, &stopAction, NULL);
+
+    Daemon daemon = { options };
+    createTileScheduler(&daemon.scheduler, options->numThreads);
+
+    printf("Listening on \"%s\" with %i threads\n", socketName, daemon.scheduler.numThreads);
+    fflush(stdout);
+
+    while (!stopRequested) {
+        int connection = accept(listener, NULL, NULL);
+
+        if (connection < 0) {
+            checkError(errno != EINTR && errno != ECONNABORTED,
+                       "Error: Could not accept a connection!\n");
+            continue;
+        }
+
+        serveConnection(&daemon, connection);
+    }
+
+    close(listener);
+    unlink(socketName);
+    destroyTileScheduler(&daemon.scheduler);
+
+    for (int slot = 0; slot < SCENE_CACHE_SIZE; slot++) {
+        if (daemon.cache[slot].lastUsed > 0)
+            freeSceneData(&daemon.cache[slot].sceneData);
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "options.h"
+
+// Compiled scenes kept between jobs; a new scene replaces the one used least recently
+#define SCENE_CACHE_SIZE 4
+
+// Rows rendered between progress reports
+#define DAEMON_BAND_ROWS 64
+
+// Connections queued while a job renders before new ones are refused
+#define DAEMON_BACKLOG 16
+
+/**
+ Serve render jobs on a Unix domain socket created at socketName, with one pool of render threads
+ and a cache of compiled scenes, keyed by a hash of their contents, shared by every job. Runs
+ until SIGINT or SIGTERM, then removes the socket.
+
+ A client sends jobs as lines of a keyword followed by its values, each job ended by a "render"
+ line:
+ - scene PATH: render the text or binary scene file at PATH
+ - inline-scene LENGTH: render the LENGTH bytes of scene text or binary scene that follow this
+   line
+ - size WIDTH HEIGHT: resolution of the frame
+ - region X Y WIDTH HEIGHT: only render this rectangle of the frame, written as a partial image
+   of its size that mergePartialImages() accepts (the whole frame by default)
+ - aa N and format p3|p6: as the command line options, which give their defaults
+ - output PATH: where the PPM is written
+
+ Each job is answered with a "scene cached|loaded HASH MS" line once its scene is ready, a
+ "progress ROWS TOTAL" line after every band of rows, then "done MS" when the output is complete,
+ or "error MESSAGE" at any point if the job fails, after which the connection takes the next job.
+ Connections are served one at a time, each job rendering on every thread. The render options
+ other than --aa and --format are fixed by options.
+ */
+void runDaemon(const char *socketName, const RenderOptions *options);
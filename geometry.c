@@ -0,0 +1,356 @@
+#include "geometry.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernels.h"
+#include "raytrace.h"
+#include "stats.h"
+#include "utils.h"
+
+const char *const acceleratorNames[] = { "bvh", "grid", "linear" };
+
+static inline void reduceNearest(const float *tBuffer, const uint32_t *objectIndices,
+                                 size_t count, uint32_t ignoredIndex, float *bestT,
+                                 uint32_t *bestIndex) {
+    for (size_t index = 0; index < count; index++) {
+        float t = tBuffer[index];
+        uint32_t objectIndex = objectIndices[index];
+
+        if (t > 0 && objectIndex != ignoredIndex
+            && (t < *bestT || (t == *bestT && objectIndex < *bestIndex))) {
+            *bestT = t;
+            *bestIndex = objectIndex;
+        }
+    }
+}
+
+static inline bool anyOccluding(const float *tBuffer, const uint32_t *objectIndices, size_t count,
+                                uint32_t ignoredIndex, float tMax) {
+    for (size_t index = 0; index < count; index++) {
+        if (tBuffer[index] > 0 && tBuffer[index] < tMax && objectIndices[index] != ignoredIndex)
+            return true;
+    }
+
+    return false;
+}
+
+static void *carveArray(char **cursor, size_t count, size_t elementSize) {
+    size_t paddedCount = (count + GEOMETRY_PADDING - 1) / GEOMETRY_PADDING * GEOMETRY_PADDING;
+    size_t size = paddedCount * elementSize;
+    void *array = *cursor;
+
+    // Keep the next array on its own cache line
+    *cursor += (size + GEOMETRY_ALIGNMENT - 1) / GEOMETRY_ALIGNMENT * GEOMETRY_ALIGNMENT;
+
+    return array;
+}
+
+static size_t arraySize(size_t count, size_t elementSize) {
+    size_t paddedCount = (count + GEOMETRY_PADDING - 1) / GEOMETRY_PADDING * GEOMETRY_PADDING;
+
+    return (paddedCount * elementSize + GEOMETRY_ALIGNMENT - 1) / GEOMETRY_ALIGNMENT
+           * GEOMETRY_ALIGNMENT;
+}
+
+void buildSceneGeometry(SceneData *sceneData) {
+    SceneGeometry *geometry = &sceneData->geometry;
+    size_t numObjects = sceneData->numObjects;
+    size_t numSpheres = 0, numPlanes = 0, numQuadrics = 0;
+
+    freeSceneGeometry(geometry);
+    selectIntersectionKernels();
+
+    for (size_t index = 0; index < numObjects; index++) {
+        switch (sceneData->objects[index].type) {
+            case PLANE:
+                numPlanes++;
+                break;
+            case SPHERE:
+                numSpheres++;
+                break;
+            case QUADRIC:
+                numQuadrics++;
+                break;
+        }
+    }
+
+    size_t storageSize = 4 * arraySize(numSpheres, sizeof(float))
+                       + arraySize(numSpheres, sizeof(uint32_t))
+                       + 4 * arraySize(numPlanes, sizeof(float))
+                       + arraySize(numPlanes, sizeof(uint32_t))
+                       + 10 * arraySize(numQuadrics, sizeof(float))
+                       + arraySize(numQuadrics, sizeof(uint32_t))
+                       + arraySize(numObjects, sizeof(uint8_t))
+                       + arraySize(numObjects, sizeof(uint32_t));
+
+    if (storageSize == 0)
+        storageSize = GEOMETRY_ALIGNMENT;
+
+    geometry->storage = aligned_alloc(GEOMETRY_ALIGNMENT, storageSize);
+    checkError(!geometry->storage, "Error: Could not allocate memory for the scene geometry!\n");
+
+    // Zeroed so the padding lanes hold harmless values
+    memset(geometry->storage, 0, storageSize);
+
+    char *cursor = geometry->storage;
+
+    SphereArrays *spheres = &geometry->spheres;
+    spheres->centerX = carveArray(&cursor, numSpheres, sizeof(float));
+    spheres->centerY = carveArray(&cursor, numSpheres, sizeof(float));
+    spheres->centerZ = carveArray(&cursor, numSpheres, sizeof(float));
+    spheres->radius2 = carveArray(&cursor, numSpheres, sizeof(float));
+    spheres->objectIndices = carveArray(&cursor, numSpheres, sizeof(uint32_t));
+
+    PlaneArrays *planes = &geometry->planes;
+    planes->normalX = carveArray(&cursor, numPlanes, sizeof(float));
+    planes->normalY = carveArray(&cursor, numPlanes, sizeof(float));
+    planes->normalZ = carveArray(&cursor, numPlanes, sizeof(float));
+    planes->d = carveArray(&cursor, numPlanes, sizeof(float));
+    planes->objectIndices = carveArray(&cursor, numPlanes, sizeof(uint32_t));
+
+    QuadricArrays *quadrics = &geometry->quadrics;
+    quadrics->a = carveArray(&cursor, numQuadrics, sizeof(float));
+    quadrics->b = carveArray(&cursor, numQuadrics, sizeof(float));
+    quadrics->c = carveArray(&cursor, numQuadrics, sizeof(float));
+    quadrics->d = carveArray(&cursor, numQuadrics, sizeof(float));
+    quadrics->e = carveArray(&cursor, numQuadrics, sizeof(float));
+    quadrics->f = carveArray(&cursor, numQuadrics, sizeof(float));
+    quadrics->g = carveArray(&cursor, numQuadrics, sizeof(float));
+    quadrics->h = carveArray(&cursor, numQuadrics, sizeof(float));
+    quadrics->i = carveArray(&cursor, numQuadrics, sizeof(float));
+    quadrics->j = carveArray(&cursor, numQuadrics, sizeof(float));
+    quadrics->objectIndices = carveArray(&cursor, numQuadrics, sizeof(uint32_t));
+
+    geometry->objectTypes = carveArray(&cursor, numObjects, sizeof(uint8_t));
+    geometry->objectSlots = carveArray(&cursor, numObjects, sizeof(uint32_t));
+
+    for (size_t index = 0; index < numObjects; index++) {
+        Object *object = &sceneData->objects[index];
+        size_t slot = 0;
+
+        switch (object->type) {
+            case PLANE:
+                slot = planes->count++;
+                planes->normalX[slot] = object->pn[0];
+                planes->normalY[slot] = object->pn[1];
+                planes->normalZ[slot] = object->pn[2];
+                planes->d[slot] = object->d;
+                planes->objectIndices[slot] = index;
+                break;
+            case SPHERE:
+                slot = spheres->count++;
+                spheres->centerX[slot] = object->center[0];
+                spheres->centerY[slot] = object->center[1];
+                spheres->centerZ[slot] = object->center[2];
+                spheres->radius2[slot] = object->radius2;
+                spheres->objectIndices[slot] = index;
+                break;
+            case QUADRIC:
+                slot = quadrics->count++;
+                quadrics->a[slot] = object->quadricVars.a;
+                quadrics->b[slot] = object->quadricVars.b;
+                quadrics->c[slot] = object->quadricVars.c;
+                quadrics->d[slot] = object->quadricVars.d;
+                quadrics->e[slot] = object->quadricVars.e;
+                quadrics->f[slot] = object->quadricVars.f;
+                quadrics->g[slot] = object->quadricVars.g;
+                quadrics->h[slot] = object->quadricVars.h;
+                quadrics->i[slot] = object->quadricVars.i;
+                quadrics->j[slot] = object->quadricVars.j;
+                quadrics->objectIndices[slot] = index;
+                break;
+        }
+
+        geometry->objectTypes[index] = object->type;
+        geometry->objectSlots[index] = slot;
+    }
+}
+
+void freeSceneGeometry(SceneGeometry *geometry) {
+    free(geometry->storage);
+    memset(geometry, 0, sizeof(SceneGeometry));
+}
+
+float raycastGeometryObject(SceneGeometry *geometry, uint32_t objectIndex, float *R0, float *Rd,
+                            bool largestT) {
+    uint32_t slot = geometry->objectSlots[objectIndex];
+
+    STATS_ADD(intersectionTests[geometry->objectTypes[objectIndex]], 1);
+
+    switch (geometry->objectTypes[objectIndex]) {
+        case PLANE:
+            return planeIntersection(&geometry->planes, slot, R0, Rd);
+        case SPHERE:
+            return sphereIntersection(&geometry->spheres, slot, R0, Rd, largestT);
+        case QUADRIC:
+            return quadricIntersection(&geometry->quadrics, slot, R0, Rd, largestT);
+    }
+
+    return 0;
+}
+
+uint32_t raycastGeometryNearest(SceneGeometry *geometry, float *R0, float *Rd,
+                                uint32_t ignoredIndex, bool largestT, float *nearestT) {
+    _Alignas(GEOMETRY_ALIGNMENT) float tBuffer[GEOMETRY_BATCH_SIZE];
+    float bestT = INFINITY;
+    uint32_t bestIndex = GEOMETRY_NO_OBJECT;
+
+    SphereArrays *spheres = &geometry->spheres;
+    for (size_t first = 0; first < spheres->count; first += GEOMETRY_BATCH_SIZE) {
+        size_t count = spheres->count - first;
+        count = count < GEOMETRY_BATCH_SIZE ? count : GEOMETRY_BATCH_SIZE;
+
+        STATS_ADD(intersectionTests[SPHERE], count);
+        intersectionKernels.spheres(spheres, first, count, R0, Rd, largestT, tBuffer);
+
+        reduceNearest(tBuffer, &spheres->objectIndices[first], count, ignoredIndex, &bestT,
+                      &bestIndex);
+    }
+
+    PlaneArrays *planes = &geometry->planes;
+    for (size_t first = 0; first < planes->count; first += GEOMETRY_BATCH_SIZE) {
+        size_t count = planes->count - first;
+        count = count < GEOMETRY_BATCH_SIZE ? count : GEOMETRY_BATCH_SIZE;
+
+        STATS_ADD(intersectionTests[PLANE], count);
+        intersectionKernels.planes(planes, first, count, R0, Rd, tBuffer);
+
+        reduceNearest(tBuffer, &planes->objectIndices[first], count, ignoredIndex, &bestT,
+                      &bestIndex);
+    }
+
+    QuadricArrays *quadrics = &geometry->quadrics;
+    for (size_t first = 0; first < quadrics->count; first += GEOMETRY_BATCH_SIZE) {
+        size_t count = quadrics->count - first;
+        count = count < GEOMETRY_BATCH_SIZE ? count : GEOMETRY_BATCH_SIZE;
+
+        STATS_ADD(intersectionTests[QUADRIC], count);
+
+        for (size_t index = 0; index < count; index++)
+            tBuffer[index] = quadricIntersection(quadrics, first + index, R0, Rd, largestT);
+
+        reduceNearest(tBuffer, &quadrics->objectIndices[first], count, ignoredIndex, &bestT,
+                      &bestIndex);
+    }
+
+    *nearestT = bestT;
+
+    return bestIndex;
+}
+
+bool raycastGeometryOccluded(SceneGeometry *geometry, float *R0, float *Rd, float tMax,
+                             uint32_t ignoredIndex) {
+    _Alignas(GEOMETRY_ALIGNMENT) float tBuffer[GEOMETRY_BATCH_SIZE];
+
+    SphereArrays *spheres = &geometry->spheres;
+    for (size_t first = 0; first < spheres->count; first += GEOMETRY_BATCH_SIZE) {
+        size_t count = spheres->count - first;
+        count = count < GEOMETRY_BATCH_SIZE ? count : GEOMETRY_BATCH_SIZE;
+
+        STATS_ADD(intersectionTests[SPHERE], count);
+        intersectionKernels.spheres(spheres, first, count, R0, Rd, false, tBuffer);
+
+        if (anyOccluding(tBuffer, &spheres->objectIndices[first], count, ignoredIndex, tMax))
+            return true;
+    }
+
+    PlaneArrays *planes = &geometry->planes;
+    for (size_t first = 0; first < planes->count; first += GEOMETRY_BATCH_SIZE) {
+        size_t count = planes->count - first;
+        count = count < GEOMETRY_BATCH_SIZE ? count : GEOMETRY_BATCH_SIZE;
+
+        STATS_ADD(intersectionTests[PLANE], count);
+        intersectionKernels.planes(planes, first, count, R0, Rd, tBuffer);
+
+        if (anyOccluding(tBuffer, &planes->objectIndices[first], count, ignoredIndex, tMax))
+            return true;
+    }
+
+    QuadricArrays *quadrics = &geometry->quadrics;
+    for (size_t first = 0; first < quadrics->count; first += GEOMETRY_BATCH_SIZE) {
+        size_t count = quadrics->count - first;
+        count = count < GEOMETRY_BATCH_SIZE ? count : GEOMETRY_BATCH_SIZE;
+
+        STATS_ADD(intersectionTests[QUADRIC], count);
+
+        for (size_t index = 0; index < count; index++)
+            tBuffer[index] = quadricIntersection(quadrics, first + index, R0, Rd, false);
+
+        if (anyOccluding(tBuffer, &quadrics->objectIndices[first], count, ignoredIndex, tMax))
+            return true;
+    }
+
+    return false;
+}
+
+void clearRayPacket(RayPacket *packet) {
+    for (size_t ray = 0; ray < RAY_PACKET_SIZE; ray++) {
+        packet->nearestT[ray] = INFINITY;
+        packet->nearestIndex[ray] = GEOMETRY_NO_OBJECT;
+    }
+}
+
+void raycastGeometryPacketObject(SceneGeometry *geometry, uint32_t objectIndex, float *R0,
+                                 RayPacket *packet, const uint32_t *active) {
+    _Alignas(GEOMETRY_ALIGNMENT) float tBuffer[RAY_PACKET_SIZE];
+    uint32_t slot = geometry->objectSlots[objectIndex];
+    size_t count = packet->count;
+
+    STATS_ADD(intersectionTests[geometry->objectTypes[objectIndex]], count);
+
+    // One primitive against many rays: the primitive data stays in registers while the loops
+    //   below vectorize over the rays
+    switch (geometry->objectTypes[objectIndex]) {
+        case PLANE:
+            for (size_t ray = 0; ray < count; ray++) {
+                float Rd[3] = { packet->directionX[ray], packet->directionY[ray],
+                                packet->directionZ[ray] };
+                tBuffer[ray] = planeIntersection(&geometry->planes, slot, R0, Rd);
+            }
+            break;
+        case SPHERE:
+            for (size_t ray = 0; ray < count; ray++) {
+                float Rd[3] = { packet->directionX[ray], packet->directionY[ray],
+                                packet->directionZ[ray] };
+                tBuffer[ray] = sphereIntersection(&geometry->spheres, slot, R0, Rd, false);
+            }
+            break;
+        case QUADRIC:
+            for (size_t ray = 0; ray < count; ray++) {
+                float Rd[3] = { packet->directionX[ray], packet->directionY[ray],
+                                packet->directionZ[ray] };
+                tBuffer[ray] = quadricIntersection(&geometry->quadrics, slot, R0, Rd, false);
+            }
+            break;
+    }
+
+    for (size_t ray = 0; ray < count; ray++) {
+        float t = tBuffer[ray];
+        float bestT = packet->nearestT[ray];
+        uint32_t bestIndex = packet->nearestIndex[ray];
+
+        // Bitwise operators keep the loop free of branches so it vectorizes
+        bool nearer = active[ray] & (t > 0)
+                      & ((t < bestT) | ((t == bestT) & (objectIndex < bestIndex)));
+
+        packet->nearestT[ray] = nearer ? t : bestT;
+        packet->nearestIndex[ray] = nearer ? objectIndex : bestIndex;
+    }
+}
+
+void raycastGeometryPacket(SceneGeometry *geometry, float *R0, RayPacket *packet) {
+    size_t numObjects = geometry->spheres.count + geometry->planes.count
+                      + geometry->quadrics.count;
+    uint32_t active[RAY_PACKET_SIZE];
+
+    for (size_t ray = 0; ray < RAY_PACKET_SIZE; ray++)
+        active[ray] = 1;
+
+    clearRayPacket(packet);
+
+    for (size_t index = 0; index < numObjects; index++)
+        raycastGeometryPacketObject(geometry, index, R0, packet, active);
+}
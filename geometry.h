@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of primitives whose t values are computed together before reducing to the nearest
+#define GEOMETRY_BATCH_SIZE 64
+
+// Every array is padded to a multiple of this many floats and aligned to a cache line
+#define GEOMETRY_ALIGNMENT 64
+#define GEOMETRY_PADDING 16
+
+// Returned by the nearest-hit kernels when no primitive is hit
+#define GEOMETRY_NO_OBJECT UINT32_MAX
+
+// Primary rays are cast in square packets of this many rays per side
+#define RAY_PACKET_WIDTH 8
+#define RAY_PACKET_SIZE (RAY_PACKET_WIDTH * RAY_PACKET_WIDTH)
+
+struct SceneData;
+
+// Structure used to find the objects hit by a ray
+typedef enum {
+    ACCEL_BVH    = 0, // SAH bounding volume hierarchy
+    ACCEL_GRID   = 1, // Uniform grid
+    ACCEL_LINEAR = 2  // Every object tested for every ray
+} Accelerator;
+
+// Names of the accelerators as given to --accel
+extern const char *const acceleratorNames[];
+
+typedef struct SphereArrays {
+    float *centerX, *centerY, *centerZ;
+    float *radius2;
+    uint32_t *objectIndices;
+    size_t count;
+} SphereArrays;
+
+typedef struct PlaneArrays {
+    float *normalX, *normalY, *normalZ;
+    float *d;
+    uint32_t *objectIndices;
+    size_t count;
+} PlaneArrays;
+
+typedef struct QuadricArrays {
+    float *a, *b, *c, *d, *e, *f, *g, *h, *i, *j;
+    uint32_t *objectIndices;
+    size_t count;
+} QuadricArrays;
+
+/**
+ Structure-of-arrays view of the geometry in SceneData.objects. Only the data needed to intersect
+ a ray is stored here, so the intersection loops never touch colors or material properties.
+ */
+typedef struct SceneGeometry {
+    SphereArrays spheres;
+    PlaneArrays planes;
+    QuadricArrays quadrics;
+
+    // Per object: its ObjectType and its index within the arrays of that type
+    uint8_t *objectTypes;
+    uint32_t *objectSlots;
+
+    // Single allocation backing all arrays above
+    void *storage;
+} SceneGeometry;
+
+/**
+ Up to RAY_PACKET_SIZE rays sharing one origin, stored as structure of arrays so each primitive can
+ be tested against every ray of the packet in one vectorized loop. The casts fill nearestT and
+ nearestIndex (GEOMETRY_NO_OBJECT for rays that miss everything).
+ */
+typedef struct RayPacket {
+    _Alignas(GEOMETRY_ALIGNMENT) float directionX[RAY_PACKET_SIZE];
+    _Alignas(GEOMETRY_ALIGNMENT) float directionY[RAY_PACKET_SIZE];
+    _Alignas(GEOMETRY_ALIGNMENT) float directionZ[RAY_PACKET_SIZE];
+    _Alignas(GEOMETRY_ALIGNMENT) float nearestT[RAY_PACKET_SIZE];
+    _Alignas(GEOMETRY_ALIGNMENT) uint32_t nearestIndex[RAY_PACKET_SIZE];
+    size_t count;
+} RayPacket;
+
+/**
+ Build the structure-of-arrays geometry view of sceneData->objects into sceneData->geometry. Any
+ previously built view is freed first.
+ */
+void buildSceneGeometry(struct SceneData *sceneData);
+
+/**
+ Free the memory held by geometry and reset it to an empty view.
+ */
+void freeSceneGeometry(SceneGeometry *geometry);
+
+/**
+ Calculate the intersection t of the ray R0 + t * Rd with the object at objectIndex. Gives the same
+ result as raycastObject() on the corresponding object.
+ */
+float raycastGeometryObject(SceneGeometry *geometry, uint32_t objectIndex, float *R0, float *Rd,
+                            bool largestT);
+
+/**
+ Find the nearest primitive hit by the ray R0 + t * Rd (t > 0), skipping ignoredIndex. The object
+ index is returned (GEOMETRY_NO_OBJECT if nothing is hit) and its t is stored in nearestT. Ties are
+ broken by the lowest object index, matching a linear scan over SceneData.objects.
+ */
+uint32_t raycastGeometryNearest(SceneGeometry *geometry, float *R0, float *Rd,
+                                uint32_t ignoredIndex, bool largestT, float *nearestT);
+
+/**
+ Test whether any primitive other than ignoredIndex is hit by the ray R0 + t * Rd with
+ 0 < t < tMax.
+ */
+bool raycastGeometryOccluded(SceneGeometry *geometry, float *R0, float *Rd, float tMax,
+                             uint32_t ignoredIndex);
+
+/**
+ Reset the nearest hits of packet before casting it.
+ */
+void clearRayPacket(RayPacket *packet);
+
+/**
+ Intersect the object at objectIndex with every ray of packet whose active entry is nonzero,
+ keeping the nearest hit of each ray in the packet. Each ray gets the same t as
+ raycastGeometryObject() would give it, and ties are broken by the lowest object index.
+ */
+void raycastGeometryPacketObject(SceneGeometry *geometry, uint32_t objectIndex, float *R0,
+                                 RayPacket *packet, const uint32_t *active);
+
+/**
+ Find the nearest primitive hit by every ray of packet (origin R0) by testing all primitives.
+ Gives each ray the same result as raycastGeometryNearest() with no ignored object.
+ */
+void raycastGeometryPacket(SceneGeometry *geometry, float *R0, RayPacket *packet);
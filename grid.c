@@ -0,0 +1,343 @@
+#include "grid.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bvh.h"
+#include "geometry.h"
+#include "raytrace.h"
+#include "utils.h"
+#include "v3math.h"
+
+// Position of a ray in the grid while it is walked from cell to cell
+typedef struct GridWalk {
+    int cell[3];
+    int step[3];
+    float invRd[3];
+    float tEnd; // Where the ray leaves the grid
+} GridWalk;
+
+static inline int cellCoordinate(const Grid *grid, float position, int axis) {
+    int cell = (int) ((position - grid->boundsMin[axis]) * grid->invCellSize[axis]);
+
+    return cell < 0 ? 0 : (cell >= grid->resolution[axis] ? grid->resolution[axis] - 1 : cell);
+}
+
+void buildGrid(SceneData *sceneData) {
+    Grid *grid = &sceneData->grid;
+    size_t numObjects = sceneData->numObjects;
+
+    freeGrid(grid);
+
+    float (*primMin)[3] = malloc(numObjects * sizeof(*primMin));
+    float (*primMax)[3] = malloc(numObjects * sizeof(*primMax));
+    uint32_t *boundedIndices = malloc(numObjects * sizeof(uint32_t));
+    grid->unboundedIndices = malloc(numObjects * sizeof(uint32_t));
+    checkError(numObjects > 0 && (!primMin || !primMax || !boundedIndices
+                                  || !grid->unboundedIndices),
+               "Error: Could not allocate memory for the grid!\n");
+
+    size_t numBounded = 0;
+
+    for (int axis = 0; axis < 3; axis++) {
+        grid->boundsMin[axis] = INFINITY;
+        grid->boundsMax[axis] = -INFINITY;
+    }
+
+    for (size_t index = 0; index < numObjects; index++) {
+        if (calculateObjectBounds(&sceneData->objects[index], primMin[index], primMax[index])) {
+            for (int axis = 0; axis < 3; axis++) {
+                grid->boundsMin[axis] = f_min(grid->boundsMin[axis], primMin[index][axis]);
+                grid->boundsMax[axis] = f_max(grid->boundsMax[axis], primMax[index][axis]);
+            }
+
+            boundedIndices[numBounded++] = index;
+        }
+        else {
+            grid->unboundedIndices[grid->numUnbounded++] = index;
+        }
+    }
+
+    if (numBounded > 0) {
+        // Cubic cells sized for about GRID_CELLS_PER_OBJECT cells per object, with flat scenes
+        //   given some thickness so the volume never vanishes
+        float extent[3];
+        float maxExtent = 0;
+
+        for (int axis = 0; axis < 3; axis++) {
+            extent[axis] = grid->boundsMax[axis] - grid->boundsMin[axis];
+            maxExtent = f_max(maxExtent, extent[axis]);
+        }
+
+        for (int axis = 0; axis < 3; axis++)
+            extent[axis] = f_max(extent[axis], maxExtent * 1e-3f);
+
+        float cellSide = cbrtf(extent[0] * extent[1] * extent[2]
+                               / (GRID_CELLS_PER_OBJECT * (float) numBounded));
+        grid->numCells = 1;
+
+        for (int axis = 0; axis < 3; axis++) {
+            int resolution = (int) ceilf(extent[axis] / cellSide);
+            resolution = resolution < 1 ? 1 : resolution;
+            resolution = resolution > GRID_MAX_RESOLUTION ? GRID_MAX_RESOLUTION : resolution;
+
+            grid->resolution[axis] = resolution;
+            grid->boundsMax[axis] = grid->boundsMin[axis] + extent[axis];
+            grid->cellSize[axis] = extent[axis] / resolution;
+            grid->invCellSize[axis] = resolution / extent[axis];
+            grid->numCells *= resolution;
+        }
+
+        // Count the objects of every cell one slot ahead, so the prefix sum below turns the
+        //   counts into start offsets
+        grid->cellStarts = calloc(grid->numCells + 1, sizeof(uint32_t));
+        checkError(!grid->cellStarts, "Error: Could not allocate memory for the grid!\n");
+
+        int firstCell[3], lastCell[3];
+        int resolutionX = grid->resolution[0];
+        size_t resolutionXY = (size_t) resolutionX * grid->resolution[1];
+
+        for (size_t bounded = 0; bounded < numBounded; bounded++) {
+            uint32_t index = boundedIndices[bounded];
+
+            for (int axis = 0; axis < 3; axis++) {
+                firstCell[axis] = cellCoordinate(grid, primMin[index][axis], axis);
+                lastCell[axis] = cellCoordinate(grid, primMax[index][axis], axis);
+            }
+
+            for (int z = firstCell[2]; z <= lastCell[2]; z++) {
+                for (int y = firstCell[1]; y <= lastCell[1]; y++) {
+                    for (int x = firstCell[0]; x <= lastCell[0]; x++)
+                        grid->cellStarts[z * resolutionXY + (size_t) y * resolutionX + x + 1]++;
+                }
+            }
+        }
+
+        uint64_t numReferences = 0;
+
+        for (size_t cell = 1; cell <= grid->numCells; cell++) {
+            numReferences += grid->cellStarts[cell];
+            checkError(numReferences > UINT32_MAX, "Error: Too many objects for the grid!\n");
+            grid->cellStarts[cell] = numReferences;
+        }
+
+        grid->numReferences = numReferences;
+        grid->objectIndices = malloc(numReferences * sizeof(uint32_t));
+        checkError(numReferences > 0 && !grid->objectIndices,
+                   "Error: Could not allocate memory for the grid!\n");
+
+        // Objects are added in index order, so every cell's list ends up sorted. Each start
+        //   offset is used as the cell's write cursor, leaving it at the start of the next cell.
+        for (size_t bounded = 0; bounded < numBounded; bounded++) {
+            uint32_t index = boundedIndices[bounded];
+
+            for (int axis = 0; axis < 3; axis++) {
+                firstCell[axis] = cellCoordinate(grid, primMin[index][axis], axis);
+                lastCell[axis] = cellCoordinate(grid, primMax[index][axis], axis);
+            }
+
+            for (int z = firstCell[2]; z <= lastCell[2]; z++) {
+                for (int y = firstCell[1]; y <= lastCell[1]; y++) {
+                    for (int x = firstCell[0]; x <= lastCell[0]; x++) {
+                        size_t cell = z * resolutionXY + (size_t) y * resolutionX + x;
+                        grid->objectIndices[grid->cellStarts[cell]++] = index;
+                    }
+                }
+            }
+        }
+
+        memmove(grid->cellStarts + 1, grid->cellStarts, grid->numCells * sizeof(uint32_t));
+        grid->cellStarts[0] = 0;
+    }
+
+    free(primMin);
+    free(primMax);
+    free(boundedIndices);
+}
+
+void freeGrid(Grid *grid) {
+    free(grid->cellStarts);
+    free(grid->objectIndices);
+    free(grid->unboundedIndices);
+    memset(grid, 0, sizeof(Grid));
+}
+
+size_t gridMemory(const Grid *grid) {
+    size_t cellStarts = grid->numCells > 0 ? grid->numCells + 1 : 0;
+
+    return (cellStarts + grid->numReferences + grid->numUnbounded) * sizeof(uint32_t);
+}
+
+// Find where the ray enters the grid and the cell it enters, returning false if it misses
+static inline bool startWalk(const Grid *grid, const float *R0, const float *Rd, GridWalk *walk) {
+    // Same padding per unit of origin magnitude as the BVH, since the object bounds the grid is
+    //   made of are only padded for rounding relative to the objects themselves
+    float rayPad = BVH_RAY_EPSILON * f_max(f_max(fabsf(R0[0]), fabsf(R0[1])), fabsf(R0[2]));
+    float tEnter = 0, tExit = INFINITY;
+
+    for (int axis = 0; axis < 3; axis++) {
+        // Axis-parallel rays get a huge but finite inverse so the slab test never produces NaNs
+        walk->invRd[axis] = 1 / (fabsf(Rd[axis]) > 1e-20f ? Rd[axis]
+                                                          : copysignf(1e-20f, Rd[axis]));
+        walk->step[axis] = walk->invRd[axis] < 0 ? -1 : 1;
+
+        float t0 = (grid->boundsMin[axis] - rayPad - R0[axis]) * walk->invRd[axis];
+        float t1 = (grid->boundsMax[axis] + rayPad - R0[axis]) * walk->invRd[axis];
+        tEnter = f_max(tEnter, f_min(t0, t1));
+        tExit = f_min(tExit, f_max(t0, t1));
+    }
+
+    if (tExit < tEnter)
+        return false;
+
+    walk->tEnd = tExit;
+
+    for (int axis = 0; axis < 3; axis++)
+        walk->cell[axis] = cellCoordinate(grid, R0[axis] + Rd[axis] * tEnter, axis);
+
+    return true;
+}
+
+// Ray t at which the walk leaves its current cell, computed from scratch every step so rounding
+//   error does not build up along the ray
+static inline float cellExit(const Grid *grid, const GridWalk *walk, const float *R0,
+                             int *exitAxis) {
+    float tExit[3];
+
+    for (int axis = 0; axis < 3; axis++) {
+        int boundary = walk->cell[axis] + (walk->step[axis] > 0);
+        tExit[axis] = (grid->boundsMin[axis] + boundary * grid->cellSize[axis] - R0[axis])
+                      * walk->invRd[axis];
+    }
+
+    *exitAxis = tExit[0] <= tExit[1] ? (tExit[0] <= tExit[2] ? 0 : 2)
+                                     : (tExit[1] <= tExit[2] ? 1 : 2);
+
+    return tExit[*exitAxis];
+}
+
+// Step the walk into the next cell along exitAxis, returning false once it leaves the grid
+static inline bool stepWalk(const Grid *grid, GridWalk *walk, int exitAxis) {
+    walk->cell[exitAxis] += walk->step[exitAxis];
+
+    return walk->cell[exitAxis] >= 0 && walk->cell[exitAxis] < grid->resolution[exitAxis];
+}
+
+static inline const uint32_t *cellObjects(const Grid *grid, const GridWalk *walk,
+                                          uint32_t *count) {
+    size_t cell = ((size_t) walk->cell[2] * grid->resolution[1] + walk->cell[1])
+                  * grid->resolution[0] + walk->cell[0];
+    *count = grid->cellStarts[cell + 1] - grid->cellStarts[cell];
+
+    return &grid->objectIndices[grid->cellStarts[cell]];
+}
+
+static inline void testObject(SceneData *sceneData, uint32_t index, float *R0, float *Rd,
+                              Object *ignoredObject, bool largestT, float *bestT,
+                              uint32_t *bestIndex) {
+    if (&sceneData->objects[index] == ignoredObject)
+        return;
+
+    float t = raycastGeometryObject(&sceneData->geometry, index, R0, Rd, largestT);
+
+    if (t > 0 && (t < *bestT || (t == *bestT && index < *bestIndex))) {
+        *bestT = t;
+        *bestIndex = index;
+    }
+}
+
+Object *raycastGrid(SceneData *sceneData, float *R0, float *Rd, Object *ignoredObject,
+                    bool largestT, float *nearestT) {
+    Grid *grid = &sceneData->grid;
+    float bestT = INFINITY;
+    uint32_t bestIndex = UINT32_MAX;
+
+    for (size_t index = 0; index < grid->numUnbounded; index++)
+        testObject(sceneData, grid->unboundedIndices[index], R0, Rd, ignoredObject, largestT,
+                   &bestT, &bestIndex);
+
+    GridWalk walk;
+    bool inGrid = grid->numCells > 0 && startWalk(grid, R0, Rd, &walk);
+
+    while (inGrid) {
+        uint32_t count;
+        const uint32_t *objects = cellObjects(grid, &walk, &count);
+
+        for (uint32_t index = 0; index < count; index++)
+            testObject(sceneData, objects[index], R0, Rd, ignoredObject, largestT, &bestT,
+                       &bestIndex);
+
+        // An object first reached in a later cell is hit no nearer than where this cell ends
+        //   (its padded bounds would reach into this cell otherwise), so a hit before that is
+        //   final, ties included
+        int exitAxis;
+        float tExit = cellExit(grid, &walk, R0, &exitAxis);
+
+        if (bestT <= tExit || tExit > walk.tEnd)
+            break;
+
+        inGrid = stepWalk(grid, &walk, exitAxis);
+    }
+
+    *nearestT = bestT;
+
+    return bestIndex == UINT32_MAX ? NULL : &sceneData->objects[bestIndex];
+}
+
+static inline bool occludedByObject(SceneData *sceneData, uint32_t index, float *R0, float *Rd,
+                                    float tMax, Object *ignoredObject) {
+    if (&sceneData->objects[index] == ignoredObject)
+        return false;
+
+    float t = raycastGeometryObject(&sceneData->geometry, index, R0, Rd, false);
+
+    return t > 0 && t < tMax;
+}
+
+bool raycastOccludedGrid(SceneData *sceneData, float *R0, float *Rd, float tMax,
+                         Object *ignoredObject) {
+    Grid *grid = &sceneData->grid;
+
+    for (size_t index = 0; index < grid->numUnbounded; index++) {
+        if (occludedByObject(sceneData, grid->unboundedIndices[index], R0, Rd, tMax,
+                             ignoredObject))
+            return true;
+    }
+
+    GridWalk walk;
+    bool inGrid = grid->numCells > 0 && startWalk(grid, R0, Rd, &walk);
+
+    while (inGrid) {
+        uint32_t count;
+        const uint32_t *objects = cellObjects(grid, &walk, &count);
+
+        for (uint32_t index = 0; index < count; index++) {
+            if (occludedByObject(sceneData, objects[index], R0, Rd, tMax, ignoredObject))
+                return true;
+        }
+
+        int exitAxis;
+        float tExit = cellExit(grid, &walk, R0, &exitAxis);
+
+        if (tExit >= tMax || tExit > walk.tEnd)
+            break;
+
+        inGrid = stepWalk(grid, &walk, exitAxis);
+    }
+
+    return false;
+}
+
+void raycastPacketGrid(SceneData *sceneData, float *R0, RayPacket *packet) {
+    clearRayPacket(packet);
+
+    for (size_t ray = 0; ray < packet->count; ray++) {
+        float Rd[3] = { packet->directionX[ray], packet->directionY[ray],
+                        packet->directionZ[ray] };
+        Object *object = raycastGrid(sceneData, R0, Rd, NULL, false, &packet->nearestT[ray]);
+
+        packet->nearestIndex[ray] = object ? object - sceneData->objects : GEOMETRY_NO_OBJECT;
+    }
+}
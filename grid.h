@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "geometry.h"
+
+// Target number of cells per bounded object
+#define GRID_CELLS_PER_OBJECT 2
+
+// Upper limit of cells along each axis
+#define GRID_MAX_RESOLUTION 1024
+
+struct SceneData;
+struct Object;
+
+/**
+ Uniform grid over the bounded objects of a scene, traversed cell by cell with a 3D-DDA. Cheaper
+ to build than the BVH and suited to dense clouds of similarly sized objects.
+ */
+typedef struct Grid {
+    float boundsMin[3], boundsMax[3];
+    int resolution[3];
+    float cellSize[3], invCellSize[3];
+
+    // Objects overlapping cell i (x fastest, then y, then z) are
+    //   objectIndices[cellStarts[i]] to objectIndices[cellStarts[i + 1] - 1], in ascending order
+    uint32_t *cellStarts;
+    uint32_t *objectIndices;
+    size_t numCells, numReferences;
+
+    // Planes and unbounded quadrics, tested for every ray
+    uint32_t *unboundedIndices;
+    size_t numUnbounded;
+} Grid;
+
+/**
+ Build a uniform grid over the bounded objects of sceneData, storing it in sceneData->grid. Any
+ previously built grid is freed first.
+ */
+void buildGrid(struct SceneData *sceneData);
+
+/**
+ Free the memory held by grid and reset it to an empty grid.
+ */
+void freeGrid(Grid *grid);
+
+/**
+ Bytes of memory held by grid
+ */
+size_t gridMemory(const Grid *grid);
+
+/**
+ Find the nearest object hit by the ray R0 + t * Rd (t > 0) using the grid of sceneData, skipping
+ ignoredObject. Produces the same result as the linear scan in raycast(), including choosing the
+ lowest object index when two hits are equally near.
+ */
+struct Object *raycastGrid(struct SceneData *sceneData, float *R0, float *Rd,
+                           struct Object *ignoredObject, bool largestT, float *nearestT);
+
+/**
+ Test whether any object other than ignoredObject is hit by the ray R0 + t * Rd with 0 < t < tMax
+ using the grid of sceneData, returning as soon as the first such hit is found.
+ */
+bool raycastOccludedGrid(struct SceneData *sceneData, float *R0, float *Rd, float tMax,
+                         struct Object *ignoredObject);
+
+/**
+ Find the nearest object hit by every ray of packet, all starting at R0, with raycastGrid().
+ */
+void raycastPacketGrid(struct SceneData *sceneData, float *R0, RayPacket *packet);
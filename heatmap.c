@@ -0,0 +1,78 @@
+#include "heatmap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ppmrw.h"
+#include "utils.h"
+
+#define HEATMAP_PERCENTILE 0.99
+
+static const char *metricUnits[] = { "cycles", "rays", "intersection tests" };
+
+// Blue, cyan, green, yellow, red
+static const PixelN colorStops[] = {
+    { 0, 0, 1 }, { 0, 1, 1 }, { 0, 1, 0 }, { 1, 1, 0 }, { 1, 0, 0 }
+};
+
+static int compareFloats(const void *a, const void *b) {
+    float first = *(const float *) a, second = *(const float *) b;
+
+    return (first > second) - (first < second);
+}
+
+static Pixel falseColor(float value) {
+    const int numSegments = sizeof(colorStops) / sizeof(colorStops[0]) - 1;
+
+    value = value < 0 ? 0 : value > 1 ? 1 : value;
+
+    float position = value * numSegments;
+    int segment = (int) position < numSegments ? (int) position : numSegments - 1;
+    float fraction = position - segment;
+
+    PixelN from = colorStops[segment], to = colorStops[segment + 1];
+    Pixel pixel = {
+        (PXCHANNEL) (255 * (from.r + (to.r - from.r) * fraction) + 0.5f),
+        (PXCHANNEL) (255 * (from.g + (to.g - from.g) * fraction) + 0.5f),
+        (PXCHANNEL) (255 * (from.b + (to.b - from.b) * fraction) + 0.5f)
+    };
+
+    return pixel;
+}
+
+void writeHeatmap(const float *costs, int width, int height, HeatmapMetric metric,
+                  const char *fileName) {
+    size_t numPixels = (size_t) width * height;
+    float *sorted = malloc(numPixels * sizeof(float));
+    Pixel *image = malloc(numPixels * sizeof(Pixel));
+    checkError(!sorted || !image, "Error: Could not allocate memory for the heatmap!\n");
+
+    memcpy(sorted, costs, numPixels * sizeof(float));
+    qsort(sorted, numPixels, sizeof(float), compareFloats);
+
+    float minCost = sorted[0];
+    float maxCost = sorted[(size_t) ((numPixels - 1) * HEATMAP_PERCENTILE)];
+    float scale = maxCost > minCost ? 1 / (maxCost - minCost) : 0;
+    double totalCost = 0;
+
+    for (size_t index = 0; index < numPixels; index++) {
+        image[index] = falseColor((costs[index] - minCost) * scale);
+        totalCost += costs[index];
+    }
+
+    PPM heatmapPpm;
+    heatmapPpm.format = 6;
+    heatmapPpm.maxColorVal = 255;
+    heatmapPpm.width = width;
+    heatmapPpm.height = height;
+    heatmapPpm.imageData = image;
+
+    writeImage(heatmapPpm, heatmapPpm.format, fileName);
+
+    printf("Heatmap: blue = %.0f to red = %.0f %s per pixel (max %.0f, mean %.1f)\n", minCost,
+           maxCost, metricUnits[metric], sorted[numPixels - 1], totalCost / numPixels);
+
+    free(image);
+    free(sorted);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include "utils.h"
+#endif
+
+typedef enum {
+    HEATMAP_CYCLES = 0,
+    HEATMAP_RAYS   = 1, // Needs a build with -D STATS
+    HEATMAP_TESTS  = 2  // Needs a build with -D STATS
+} HeatmapMetric;
+
+/**
+ Per-thread cycle counter for timing short stretches of work. Falls back to nanoseconds on CPUs
+ without a cheap user-space counter.
+ */
+static inline uint64_t readCycleCounter(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return (uint64_t) (nowMs() * 1e6);
+#endif
+}
+
+/**
+ Write costs, the width x height per-pixel cost of a render in the unit of metric, to fileName as
+ a false-color PPM (blue for the cheapest pixels through cyan, green, yellow to red for the most
+ expensive), and print the range of the scale. The top of the scale is the 99th percentile cost
+ so a few outliers do not wash out the rest of the image.
+ */
+void writeHeatmap(const float *costs, int width, int height, HeatmapMetric metric,
+                  const char *fileName);
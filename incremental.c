@@ -0,0 +1,412 @@
+#include "incremental.h"
+
+#include <ctype.h>
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "bvh.h"
+#include "parser.h"
+#include "utils.h"
+
+// Pixels added around the projection of an edited object, covering rounding, the half pixel
+//   offset of primary rays and the jittered samples of anti-aliasing
+#define PROJECTION_MARGIN 2
+
+_Thread_local TileDependencies *currentTileDependencies;
+
+void clearTileDependencies(TileDependencies *dependencies) {
+    memset(dependencies->objects, 0, sizeof(dependencies->objects));
+    memset(dependencies->lights, 0, sizeof(dependencies->lights));
+
+    for (int axis = 0; axis < 3; axis++) {
+        dependencies->hitMin[axis] = dependencies->rayMin[axis] = FLT_MAX;
+        dependencies->hitMax[axis] = dependencies->rayMax[axis] = -FLT_MAX;
+    }
+
+    dependencies->rayEscaped = false;
+}
+
+void beginIncrementalRender(IncrementalRender *render, const SceneData *sceneData) {
+    int width = sceneData->camera.imageWidth;
+    int height = sceneData->camera.imageHeight;
+    size_t numPixels = (size_t) width * height;
+
+    render->tileColumns = (width + TILE_SIZE - 1) / TILE_SIZE;
+    render->tileRows = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+    size_t numTiles = (size_t) render->tileColumns * render->tileRows;
+    render->image = calloc(numPixels, sizeof(Pixel));
+    render->dependencies = malloc(numTiles * sizeof(TileDependencies));
+    render->dirtyTiles = malloc(numTiles * sizeof(bool));
+    checkError(!render->image || !render->dependencies || !render->dirtyTiles,
+               "Error: Could not allocate memory for the image!\n");
+
+    render->renderTiles = render->dirtyTiles;
+    render->firstPass = NULL;
+    render->objectIds = NULL;
+    render->edges = NULL;
+
+    if (sceneData->maxSamples > 1) {
+        render->renderTiles = malloc(numTiles * sizeof(bool));
+        render->firstPass = malloc(numPixels * sizeof(Pixel));
+        render->objectIds = malloc(numPixels * sizeof(uint32_t));
+        render->edges = malloc(numPixels * sizeof(bool));
+        checkError(!render->renderTiles || !render->firstPass || !render->objectIds
+                   || !render->edges, "Error: Could not allocate memory for anti-aliasing!\n");
+    }
+
+    for (size_t tile = 0; tile < numTiles; tile++) {
+        clearTileDependencies(&render->dependencies[tile]);
+        render->dirtyTiles[tile] = true;
+    }
+}
+
+void endIncrementalRender(IncrementalRender *render) {
+    free(render->image);
+    free(render->dependencies);
+    if (render->renderTiles != render->dirtyTiles)
+        free(render->renderTiles);
+
+    free(render->dirtyTiles);
+    free(render->firstPass);
+    free(render->objectIds);
+    free(render->edges);
+    *render = (IncrementalRender) {};
+}
+
+static inline bool hasBit(const uint64_t *bits, size_t bit) {
+    return (bits[bit / 64] >> (bit % 64)) & 1;
+}
+
+static inline bool boundsOverlap(const float *aMin, const float *aMax, const float *bMin,
+                                 const float *bMax) {
+    return aMin[0] <= bMax[0] && bMin[0] <= aMax[0] && aMin[1] <= bMax[1] && bMin[1] <= aMax[1]
+           && aMin[2] <= bMax[2] && bMin[2] <= aMax[2];
+}
+
+static inline bool hasHits(const TileDependencies *dependencies) {
+    return dependencies->hitMin[0] <= dependencies->hitMax[0];
+}
+
+// Whether geometry inside the box could block a reflection or shadow ray of the tile
+static bool isBoxCrossed(const TileDependencies *dependencies, const SceneData *sceneData,
+                         const float *boxMin, const float *boxMax) {
+    if (!hasHits(dependencies))
+        return false;
+
+    if (dependencies->rayEscaped
+        || boundsOverlap(dependencies->rayMin, dependencies->rayMax, boxMin, boxMax))
+        return true;
+
+    // Shadow rays run from the shaded points to every light
+    for (size_t index = 0; index < sceneData->numLights; index++) {
+        float shadowMin[3], shadowMax[3];
+
+        for (int axis = 0; axis < 3; axis++) {
+            shadowMin[axis] = dependencies->hitMin[axis];
+            shadowMax[axis] = dependencies->hitMax[axis];
+        }
+
+        growDependencyBounds(shadowMin, shadowMax, sceneData->lights[index].position);
+
+        if (boundsOverlap(shadowMin, shadowMax, boxMin, boxMax))
+            return true;
+    }
+
+    return false;
+}
+
+static void markAllTiles(IncrementalRender *render) {
+    memset(render->dirtyTiles, true, (size_t) render->tileColumns * render->tileRows);
+}
+
+// Mark the tiles whose primary rays could see the box
+static void markProjectedTiles(IncrementalRender *render, const Camera *camera,
+                               const float *boxMin, const float *boxMax) {
+    float pixelMin[2] = { FLT_MAX, FLT_MAX }, pixelMax[2] = { -FLT_MAX, -FLT_MAX };
+
+    // The projection of the box lies within that of its corners, unless it reaches behind the
+    //   camera
+    for (int corner = 0; corner < 8; corner++) {
+        float offset[3];
+
+        for (int axis = 0; axis < 3; axis++) {
+            float coordinate = (corner >> axis) & 1 ? boxMax[axis] : boxMin[axis];
+            offset[axis] = coordinate - camera->origin[axis];
+        }
+
+        float depth = f3_dot(offset, (float *) camera->forward);
+
+        if (!(depth > 0)) {
+            markAllTiles(render);
+            return;
+        }
+
+        float Px = f3_dot(offset, (float *) camera->right) * camera->vpDistance / depth;
+        float Py = f3_dot(offset, (float *) camera->up) * camera->vpDistance / depth;
+        float pixel[2] = { (Px + camera->vpWidth * .5f) / camera->vpWidth * camera->imageWidth,
+                           (camera->vpHeight * .5f - Py) / camera->vpHeight
+                           * camera->imageHeight };
+
+        for (int axis = 0; axis < 2; axis++) {
+            pixelMin[axis] = f_min(pixelMin[axis], pixel[axis]);
+            pixelMax[axis] = f_max(pixelMax[axis], pixel[axis]);
+        }
+    }
+
+    int tileMin[2], tileMax[2];
+    const int numTiles[2] = { render->tileColumns, render->tileRows };
+
+    for (int axis = 0; axis < 2; axis++) {
+        float first = (pixelMin[axis] - PROJECTION_MARGIN) / TILE_SIZE;
+        float last = (pixelMax[axis] + PROJECTION_MARGIN) / TILE_SIZE;
+
+        if (!(last >= 0) || !(first < numTiles[axis]))
+            return;
+
+        tileMin[axis] = first > 0 ? (int) first : 0;
+        tileMax[axis] = last < numTiles[axis] - 1 ? (int) last : numTiles[axis] - 1;
+    }
+
+    for (int row = tileMin[1]; row <= tileMax[1]; row++) {
+        for (int column = tileMin[0]; column <= tileMax[0]; column++)
+            render->dirtyTiles[(size_t) row * render->tileColumns + column] = true;
+    }
+}
+
+static bool isGeometryEqual(const Object *a, const Object *b) {
+    if (a->type != b->type)
+        return false;
+
+    switch (a->type) {
+        case PLANE:
+            return memcmp(a->pn, b->pn, sizeof(a->pn)) == 0 && a->d == b->d;
+        case SPHERE:
+            return memcmp(a->center, b->center, sizeof(a->center)) == 0 && a->radius == b->radius;
+        case QUADRIC:
+            return memcmp(&a->quadricVars, &b->quadricVars, sizeof(QuadricVariables)) == 0;
+    }
+
+    return false;
+}
+
+static bool isLightMoved(const Light *a, const Light *b) {
+    return a->type != b->type || a->theta != b->theta
+           || memcmp(a->position, b->position, sizeof(a->position)) != 0
+           || memcmp(a->direction, b->direction, sizeof(a->direction)) != 0;
+}
+
+static void markObjectEdit(IncrementalRender *render, const SceneData *sceneData,
+                           const SceneEdit *edit) {
+    size_t numTiles = (size_t) render->tileColumns * render->tileRows;
+    size_t bit = edit->index % DEPENDENCY_OBJECT_BITS;
+
+    // Tiles that saw the object change with its material
+    for (size_t tile = 0; tile < numTiles; tile++)
+        render->dirtyTiles[tile] |= hasBit(render->dependencies[tile].objects, bit);
+
+    Object before = sceneData->objects[edit->index], after = edit->object;
+
+    if (isGeometryEqual(&before, &after))
+        return;
+
+    // Moved geometry can also block rays where it was and where it goes
+    float beforeMin[3], beforeMax[3], afterMin[3], afterMax[3];
+
+    if (!calculateObjectBounds(&before, beforeMin, beforeMax)
+        || !calculateObjectBounds(&after, afterMin, afterMax)) {
+        markAllTiles(render);
+        return;
+    }
+
+    for (size_t tile = 0; tile < numTiles; tile++) {
+        const TileDependencies *dependencies = &render->dependencies[tile];
+
+        render->dirtyTiles[tile] |= isBoxCrossed(dependencies, sceneData, beforeMin, beforeMax)
+                                    || isBoxCrossed(dependencies, sceneData, afterMin, afterMax);
+    }
+
+    markProjectedTiles(render, &sceneData->camera, afterMin, afterMax);
+}
+
+static void markLightEdit(IncrementalRender *render, const SceneData *sceneData,
+                          const SceneEdit *edit) {
+    size_t numTiles = (size_t) render->tileColumns * render->tileRows;
+    size_t bit = edit->index % DEPENDENCY_LIGHT_BITS;
+
+    // Every shaded point casts a shadow ray to the light, so moving it can light or shadow any of
+    //   them; otherwise only points it reached change
+    bool moved = isLightMoved(&sceneData->lights[edit->index], &edit->light);
+
+    for (size_t tile = 0; tile < numTiles; tile++) {
+        const TileDependencies *dependencies = &render->dependencies[tile];
+
+        render->dirtyTiles[tile] |= moved ? hasHits(dependencies)
+                                          : hasBit(dependencies->lights, bit);
+    }
+}
+
+void markDeltaTiles(IncrementalRender *render, const SceneData *sceneData,
+                    const SceneDelta *delta) {
+    for (size_t index = 0; index < delta->numEdits; index++) {
+        const SceneEdit *edit = &delta->edits[index];
+
+        switch (edit->kind) {
+            case EDIT_CAMERA:
+                markAllTiles(render);
+                break;
+            case EDIT_OBJECT:
+                markObjectEdit(render, sceneData, edit);
+                break;
+            case EDIT_LIGHT:
+                markLightEdit(render, sceneData, edit);
+                break;
+        }
+    }
+}
+
+void applySceneDelta(SceneData *sceneData, const SceneDelta *delta) {
+    for (size_t index = 0; index < delta->numEdits; index++) {
+        const SceneEdit *edit = &delta->edits[index];
+
+        switch (edit->kind) {
+            case EDIT_CAMERA:
+                sceneData->camera = edit->camera;
+                break;
+            case EDIT_OBJECT:
+                sceneData->objects[edit->index] = edit->object;
+                break;
+            case EDIT_LIGHT:
+                sceneData->lights[edit->index] = edit->light;
+                break;
+        }
+    }
+
+    compileScene(sceneData);
+}
+
+size_t renderDirtyTiles(IncrementalRender *render, SceneData *sceneData,
+                        TileScheduler *scheduler) {
+    int columns = render->tileColumns, rows = render->tileRows;
+    size_t numTiles = (size_t) columns * rows;
+    bool *tiles = render->renderTiles;
+
+    // The edges of a tile depend on the pixels around it, so its neighbors are rendered again too
+    if (tiles != render->dirtyTiles)
+        dilateTiles(render->dirtyTiles, columns, rows, tiles);
+
+    size_t numDirty = 0;
+
+    for (size_t tile = 0; tile < numTiles; tile++)
+        numDirty += tiles[tile];
+
+    if (numDirty > 0) {
+        renderSceneTiles(sceneData, render->image, render->firstPass, render->objectIds,
+                         render->edges, tiles, render->dependencies, scheduler);
+    }
+
+    memset(render->dirtyTiles, false, numTiles);
+
+    return numDirty;
+}
+
+// Render the dirty tiles and replace the output with the updated frame
+static void updateOutput(IncrementalRender *render, SceneData *sceneData,
+                         TileScheduler *scheduler, PPM ppm, const char *outputFilename) {
+    double start = nowMs();
+    size_t numRendered = renderDirtyTiles(render, sceneData, scheduler);
+    double renderMs = nowMs() - start;
+
+    // Viewers of the output must never see a half-written file
+    writeImageAtomically(ppm, ppm.format, outputFilename);
+
+    printf("Rendered %zu of %zu tiles in %.3f ms\n", numRendered,
+           (size_t) render->tileColumns * render->tileRows, renderMs);
+    fflush(stdout);
+}
+
+// Parse delta from text and update the render and output with it. An error is printed and ends the
+//   update: one in parsing drops the delta before sceneData changes, and tiles a later one leaves
+//   unfinished stay dirty for the next update.
+static void updateFromDelta(IncrementalRender *render, SceneData *sceneData,
+                            TileScheduler *scheduler, PPM ppm, const char *outputFilename,
+                            const char *text, size_t textLength, SceneDelta *delta) {
+    jmp_buf jump;
+    jmp_buf *previousJump = errorJump;
+
+    if (setjmp(jump) != 0) {
+        errorJump = previousJump;
+        fputs(errorMessage, stderr);
+        return;
+    }
+
+    errorJump = &jump;
+
+    parseSceneDelta(text, textLength, "stdin", sceneData, delta);
+    markDeltaTiles(render, sceneData, delta);
+    applySceneDelta(sceneData, delta);
+    updateOutput(render, sceneData, scheduler, ppm, outputFilename);
+
+    errorJump = previousJump;
+}
+
+static bool isBlankLine(const char *line, size_t length) {
+    for (size_t index = 0; index < length; index++) {
+        if (!isspace((unsigned char) line[index]))
+            return false;
+    }
+
+    return true;
+}
+
+void runInteractive(SceneData *sceneData, TileScheduler *scheduler, int format,
+                    const char *outputFilename, FILE *input) {
+    IncrementalRender render;
+    beginIncrementalRender(&render, sceneData);
+
+    PPM ppm;
+    ppm.format = format;
+    ppm.maxColorVal = 255;
+    ppm.width = sceneData->camera.imageWidth;
+    ppm.height = sceneData->camera.imageHeight;
+    ppm.imageData = render.image;
+
+    updateOutput(&render, sceneData, scheduler, ppm, outputFilename);
+
+    SceneDelta delta = {};
+    char *text = NULL, *line = NULL;
+    size_t textLength = 0, textCapacity = 0, lineCapacity = 0;
+    ssize_t lineLength;
+
+    do {
+        lineLength = getline(&line, &lineCapacity, input);
+
+        // Lines are collected until a blank line or the end of the input ends the delta
+        if (lineLength > 0 && !isBlankLine(line, lineLength)) {
+            if (textLength + lineLength > textCapacity) {
+                textCapacity = 2 * (textLength + lineLength);
+                text = realloc(text, textCapacity);
+                checkError(text == NULL, "Error: Could not allocate memory for a scene delta!\n");
+            }
+
+            memcpy(text + textLength, line, lineLength);
+            textLength += lineLength;
+            continue;
+        }
+
+        if (textLength == 0)
+            continue;
+
+        updateFromDelta(&render, sceneData, scheduler, ppm, outputFilename, text, textLength,
+                        &delta);
+
+        textLength = 0;
+    } while (lineLength >= 0);
+
+    free(line);
+    free(text);
+    free(delta.edits);
+    endIncrementalRender(&render);
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "raytrace.h"
+
+// Bits per tile recording the objects and lights its rays touched. Indices are folded onto the
+//   bits, so in scenes with more objects or lights than bits a tile may depend on a few extra ones.
+#define DEPENDENCY_OBJECT_BITS 1024
+#define DEPENDENCY_LIGHT_BITS 256
+
+// Edits allocated before the first one is parsed, doubled whenever they run out
+#define DELTA_INITIAL_CAPACITY 16
+
+/**
+ What the rays of one tile touched during its last render. An edit can only change the tile if
+ it changes one of these objects or lights, or puts geometry where one of its rays went.
+ */
+typedef struct TileDependencies {
+    // Objects hit by any ray, and lights that reached a hit unoccluded
+    uint64_t objects[DEPENDENCY_OBJECT_BITS / 64];
+    uint64_t lights[DEPENDENCY_LIGHT_BITS / 64];
+
+    // Bounds of every shaded point, whose shadow rays run from there to each light
+    float hitMin[3], hitMax[3];
+
+    // Bounds of every reflection ray up to its hit, and whether any missed everything, so it
+    //   cannot be bounded
+    float rayMin[3], rayMax[3];
+    bool rayEscaped;
+} TileDependencies;
+
+/**
+ Dependencies of the tile the calling thread is rendering, or NULL when they are not recorded
+ */
+extern _Thread_local TileDependencies *currentTileDependencies;
+
+static inline void growDependencyBounds(float *boundsMin, float *boundsMax, const float *point) {
+    for (int axis = 0; axis < 3; axis++) {
+        boundsMin[axis] = point[axis] < boundsMin[axis] ? point[axis] : boundsMin[axis];
+        boundsMax[axis] = point[axis] > boundsMax[axis] ? point[axis] : boundsMax[axis];
+    }
+}
+
+/**
+ Record that a ray of the current tile hit the object at objectIndex at point, which is then
+ shaded
+ */
+static inline void recordHit(size_t objectIndex, const float *point) {
+    TileDependencies *dependencies = currentTileDependencies;
+
+    if (dependencies) {
+        size_t bit = objectIndex % DEPENDENCY_OBJECT_BITS;
+        dependencies->objects[bit / 64] |= (uint64_t) 1 << (bit % 64);
+        growDependencyBounds(dependencies->hitMin, dependencies->hitMax, point);
+    }
+}
+
+/**
+ Record a reflection ray of the current tile from start to its hit at end, or one that hit
+ nothing when end is NULL
+ */
+static inline void recordReflection(const float *start, const float *end) {
+    TileDependencies *dependencies = currentTileDependencies;
+
+    if (dependencies) {
+        if (end == NULL) {
+            dependencies->rayEscaped = true;
+            return;
+        }
+
+        growDependencyBounds(dependencies->rayMin, dependencies->rayMax, start);
+        growDependencyBounds(dependencies->rayMin, dependencies->rayMax, end);
+    }
+}
+
+/**
+ Record that the light at lightIndex reached a point shaded by the current tile
+ */
+static inline void recordLight(size_t lightIndex) {
+    TileDependencies *dependencies = currentTileDependencies;
+
+    if (dependencies) {
+        size_t bit = lightIndex % DEPENDENCY_LIGHT_BITS;
+        dependencies->lights[bit / 64] |= (uint64_t) 1 << (bit % 64);
+    }
+}
+
+/**
+ Forget everything recorded for a tile, before it is rendered again
+ */
+void clearTileDependencies(TileDependencies *dependencies);
+
+typedef enum {
+    EDIT_CAMERA,
+    EDIT_OBJECT,
+    EDIT_LIGHT
+} EditKind;
+
+/**
+ New value of the camera, or of the object or light at index
+ */
+typedef struct SceneEdit {
+    EditKind kind;
+    size_t index;
+    Object object;
+    Light light;
+    Camera camera;
+} SceneEdit;
+
+typedef struct SceneDelta {
+    SceneEdit *edits;
+    size_t numEdits, editCapacity;
+} SceneDelta;
+
+/**
+ Frame kept between edits, with what each of its tiles depended on
+ */
+typedef struct IncrementalRender {
+    Pixel *image;
+    int tileColumns, tileRows;
+    TileDependencies *dependencies;
+
+    // Tiles to render next, and when anti-aliasing, those with their neighbors added
+    bool *dirtyTiles;
+    bool *renderTiles;
+
+    // Kept for the edge pass of later renders when anti-aliasing, NULL otherwise
+    Pixel *firstPass;
+    uint32_t *objectIds;
+    bool *edges;
+} IncrementalRender;
+
+/**
+ Allocate an incremental render of the frame of sceneData with every tile dirty.
+ */
+void beginIncrementalRender(IncrementalRender *render, const SceneData *sceneData);
+
+/**
+ Mark the tiles that delta can change as dirty. Must be called before delta is applied to
+ sceneData.
+ */
+void markDeltaTiles(IncrementalRender *render, const SceneData *sceneData,
+                    const SceneDelta *delta);
+
+/**
+ Copy the edits of delta into sceneData and compile it again.
+ */
+void applySceneDelta(SceneData *sceneData, const SceneDelta *delta);
+
+/**
+ Render the dirty tiles of render with the threads of scheduler, returning how many there were.
+ */
+size_t renderDirtyTiles(IncrementalRender *render, SceneData *sceneData,
+                        TileScheduler *scheduler);
+
+/**
+ Free everything render holds.
+ */
+void endIncrementalRender(IncrementalRender *render);
+
+/**
+ Render sceneData to outputFilename, then read scene deltas from input and re-render only the
+ tiles each can change, replacing the output after every delta. A delta is a run of lines ended
+ by an empty line or the end of input, in the syntax of parseSceneDelta(). A line with the
+ number of tiles rendered and the time taken is printed for every render. An error in a delta is
+ printed to stderr and the delta dropped, and reading goes on with the next one.
+ */
+void runInteractive(SceneData *sceneData, TileScheduler *scheduler, int format,
+                    const char *outputFilename, FILE *input);
@@ -0,0 +1,343 @@
+#include "kernels.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+
+static void sphereKernelScalar(const SphereArrays *spheres, size_t first, size_t count,
+                               const float *R0, const float *Rd, bool largestT, float *tOut) {
+    for (size_t index = 0; index < count; index++)
+        tOut[index] = sphereIntersection(spheres, first + index, R0, Rd, largestT);
+}
+
+static void planeKernelScalar(const PlaneArrays *planes, size_t first, size_t count,
+                              const float *R0, const float *Rd, float *tOut) {
+    for (size_t index = 0; index < count; index++)
+        tOut[index] = planeIntersection(planes, first + index, R0, Rd);
+}
+
+#ifdef KERNELS_X86
+
+// The vector kernels below compute whole vectors past count, reading the zeroed padding of the
+//   arrays. Every batch starts at a multiple of GEOMETRY_BATCH_SIZE, so all loads and stores are
+//   aligned. Negation flips the sign bit like the scalar unary minus (0 - x would turn -0 into +0),
+//   and max(a, b) returns b unless a > b, exactly like f_max().
+
+__attribute__((target("sse4.2")))
+static void sphereKernelSSE(const SphereArrays *spheres, size_t first, size_t count,
+                            const float *R0, const float *Rd, bool largestT, float *tOut) {
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1);
+
+    __m128 R00 = _mm_set1_ps(R0[0]), R01 = _mm_set1_ps(R0[1]), R02 = _mm_set1_ps(R0[2]);
+    __m128 Rd0 = _mm_set1_ps(Rd[0]), Rd1 = _mm_set1_ps(Rd[1]), Rd2 = _mm_set1_ps(Rd[2]);
+
+    for (size_t index = 0; index < count; index += 4) {
+        size_t slot = first + index;
+
+        __m128 R0mC0 = _mm_sub_ps(R00, _mm_load_ps(&spheres->centerX[slot]));
+        __m128 R0mC1 = _mm_sub_ps(R01, _mm_load_ps(&spheres->centerY[slot]));
+        __m128 R0mC2 = _mm_sub_ps(R02, _mm_load_ps(&spheres->centerZ[slot]));
+
+        __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(Rd0, R0mC0), _mm_mul_ps(Rd1, R0mC1)),
+                                _mm_mul_ps(Rd2, R0mC2));
+        __m128 b = _mm_xor_ps(dot, signMask);
+
+        __m128 l0 = _mm_add_ps(R0mC0, _mm_mul_ps(b, Rd0));
+        __m128 l1 = _mm_add_ps(R0mC1, _mm_mul_ps(b, Rd1));
+        __m128 l2 = _mm_add_ps(R0mC2, _mm_mul_ps(b, Rd2));
+        __m128 radius2 = _mm_load_ps(&spheres->radius2[slot]);
+        __m128 discriminant = _mm_sub_ps(radius2, _mm_add_ps(_mm_add_ps(_mm_mul_ps(l0, l0),
+                                                                        _mm_mul_ps(l1, l1)),
+                                                             _mm_mul_ps(l2, l2)));
+
+        __m128 C = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(R0mC0, R0mC0),
+                                                    _mm_mul_ps(R0mC1, R0mC1)),
+                                         _mm_mul_ps(R0mC2, R0mC2)),
+                              radius2);
+        __m128 root = _mm_sqrt_ps(_mm_max_ps(discriminant, zero));
+        __m128 bPositive = _mm_cmpge_ps(b, zero);
+        __m128 q = _mm_blendv_ps(_mm_sub_ps(b, root), _mm_add_ps(b, root), bPositive);
+        __m128 qZero = _mm_cmpeq_ps(q, zero);
+        __m128 other = _mm_div_ps(C, _mm_blendv_ps(q, one, qZero));
+
+        __m128 t0 = _mm_blendv_ps(q, other, bPositive);
+        __m128 t1 = _mm_blendv_ps(other, q, bPositive);
+        __m128 t = largestT ? _mm_max_ps(t0, t1)
+                            : _mm_blendv_ps(t1, t0, _mm_cmpge_ps(t0, zero));
+
+        __m128 miss = _mm_or_ps(_mm_cmplt_ps(discriminant, zero), qZero);
+        _mm_store_ps(&tOut[index], _mm_blendv_ps(t, zero, miss));
+    }
+}
+
+__attribute__((target("sse4.2")))
+static void planeKernelSSE(const PlaneArrays *planes, size_t first, size_t count,
+                           const float *R0, const float *Rd, float *tOut) {
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1);
+
+    __m128 R00 = _mm_set1_ps(R0[0]), R01 = _mm_set1_ps(R0[1]), R02 = _mm_set1_ps(R0[2]);
+    __m128 Rd0 = _mm_set1_ps(Rd[0]), Rd1 = _mm_set1_ps(Rd[1]), Rd2 = _mm_set1_ps(Rd[2]);
+
+    for (size_t index = 0; index < count; index += 4) {
+        size_t slot = first + index;
+
+        __m128 nX = _mm_load_ps(&planes->normalX[slot]);
+        __m128 nY = _mm_load_ps(&planes->normalY[slot]);
+        __m128 nZ = _mm_load_ps(&planes->normalZ[slot]);
+
+        __m128 vD = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nX, Rd0), _mm_mul_ps(nY, Rd1)),
+                               _mm_mul_ps(nZ, Rd2));
+        __m128 pnDotR0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nX, R00), _mm_mul_ps(nY, R01)),
+                                    _mm_mul_ps(nZ, R02));
+
+        __m128 parallel = _mm_cmpeq_ps(vD, zero);
+        __m128 numerator = _mm_xor_ps(_mm_add_ps(pnDotR0, _mm_load_ps(&planes->d[slot])),
+                                      signMask);
+        __m128 t = _mm_div_ps(numerator, _mm_blendv_ps(vD, one, parallel));
+
+        _mm_store_ps(&tOut[index], _mm_blendv_ps(t, zero, parallel));
+    }
+}
+
+__attribute__((target("avx2")))
+static void sphereKernelAVX2(const SphereArrays *spheres, size_t first, size_t count,
+                             const float *R0, const float *Rd, bool largestT, float *tOut) {
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1);
+
+    __m256 R00 = _mm256_set1_ps(R0[0]), R01 = _mm256_set1_ps(R0[1]), R02 = _mm256_set1_ps(R0[2]);
+    __m256 Rd0 = _mm256_set1_ps(Rd[0]), Rd1 = _mm256_set1_ps(Rd[1]), Rd2 = _mm256_set1_ps(Rd[2]);
+
+    for (size_t index = 0; index < count; index += 8) {
+        size_t slot = first + index;
+
+        __m256 R0mC0 = _mm256_sub_ps(R00, _mm256_load_ps(&spheres->centerX[slot]));
+        __m256 R0mC1 = _mm256_sub_ps(R01, _mm256_load_ps(&spheres->centerY[slot]));
+        __m256 R0mC2 = _mm256_sub_ps(R02, _mm256_load_ps(&spheres->centerZ[slot]));
+
+        __m256 dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(Rd0, R0mC0),
+                                                 _mm256_mul_ps(Rd1, R0mC1)),
+                                   _mm256_mul_ps(Rd2, R0mC2));
+        __m256 b = _mm256_xor_ps(dot, signMask);
+
+        __m256 l0 = _mm256_add_ps(R0mC0, _mm256_mul_ps(b, Rd0));
+        __m256 l1 = _mm256_add_ps(R0mC1, _mm256_mul_ps(b, Rd1));
+        __m256 l2 = _mm256_add_ps(R0mC2, _mm256_mul_ps(b, Rd2));
+        __m256 radius2 = _mm256_load_ps(&spheres->radius2[slot]);
+        __m256 lDotL = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(l0, l0), _mm256_mul_ps(l1, l1)),
+                                     _mm256_mul_ps(l2, l2));
+        __m256 discriminant = _mm256_sub_ps(radius2, lDotL);
+
+        __m256 R0mCDot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(R0mC0, R0mC0),
+                                                     _mm256_mul_ps(R0mC1, R0mC1)),
+                                       _mm256_mul_ps(R0mC2, R0mC2));
+        __m256 C = _mm256_sub_ps(R0mCDot, radius2);
+        __m256 root = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+        __m256 bPositive = _mm256_cmp_ps(b, zero, _CMP_GE_OQ);
+        __m256 q = _mm256_blendv_ps(_mm256_sub_ps(b, root), _mm256_add_ps(b, root), bPositive);
+        __m256 qZero = _mm256_cmp_ps(q, zero, _CMP_EQ_OQ);
+        __m256 other = _mm256_div_ps(C, _mm256_blendv_ps(q, one, qZero));
+
+        __m256 t0 = _mm256_blendv_ps(q, other, bPositive);
+        __m256 t1 = _mm256_blendv_ps(other, q, bPositive);
+        __m256 t = largestT ? _mm256_max_ps(t0, t1)
+                            : _mm256_blendv_ps(t1, t0, _mm256_cmp_ps(t0, zero, _CMP_GE_OQ));
+
+        __m256 miss = _mm256_or_ps(_mm256_cmp_ps(discriminant, zero, _CMP_LT_OQ), qZero);
+        _mm256_store_ps(&tOut[index], _mm256_blendv_ps(t, zero, miss));
+    }
+}
+
+__attribute__((target("avx2")))
+static void planeKernelAVX2(const PlaneArrays *planes, size_t first, size_t count,
+                            const float *R0, const float *Rd, float *tOut) {
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1);
+
+    __m256 R00 = _mm256_set1_ps(R0[0]), R01 = _mm256_set1_ps(R0[1]), R02 = _mm256_set1_ps(R0[2]);
+    __m256 Rd0 = _mm256_set1_ps(Rd[0]), Rd1 = _mm256_set1_ps(Rd[1]), Rd2 = _mm256_set1_ps(Rd[2]);
+
+    for (size_t index = 0; index < count; index += 8) {
+        size_t slot = first + index;
+
+        __m256 nX = _mm256_load_ps(&planes->normalX[slot]);
+        __m256 nY = _mm256_load_ps(&planes->normalY[slot]);
+        __m256 nZ = _mm256_load_ps(&planes->normalZ[slot]);
+
+        __m256 vD = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nX, Rd0), _mm256_mul_ps(nY, Rd1)),
+                                  _mm256_mul_ps(nZ, Rd2));
+        __m256 pnDotR0 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nX, R00),
+                                                     _mm256_mul_ps(nY, R01)),
+                                       _mm256_mul_ps(nZ, R02));
+
+        __m256 parallel = _mm256_cmp_ps(vD, zero, _CMP_EQ_OQ);
+        __m256 numerator = _mm256_xor_ps(_mm256_add_ps(pnDotR0,
+                                                       _mm256_load_ps(&planes->d[slot])),
+                                         signMask);
+        __m256 t = _mm256_div_ps(numerator, _mm256_blendv_ps(vD, one, parallel));
+
+        _mm256_store_ps(&tOut[index], _mm256_blendv_ps(t, zero, parallel));
+    }
+}
+
+// AVX-512F has no floating point XOR (that needs AVX-512DQ), so the sign is flipped as integers
+__attribute__((target("avx512f")))
+static inline __m512 negate512(__m512 value) {
+    return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(value),
+                                                _mm512_set1_epi32((int) 0x80000000u)));
+}
+
+__attribute__((target("avx512f")))
+static void sphereKernelAVX512(const SphereArrays *spheres, size_t first, size_t count,
+                               const float *R0, const float *Rd, bool largestT, float *tOut) {
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 one = _mm512_set1_ps(1);
+
+    __m512 R00 = _mm512_set1_ps(R0[0]), R01 = _mm512_set1_ps(R0[1]), R02 = _mm512_set1_ps(R0[2]);
+    __m512 Rd0 = _mm512_set1_ps(Rd[0]), Rd1 = _mm512_set1_ps(Rd[1]), Rd2 = _mm512_set1_ps(Rd[2]);
+
+    for (size_t index = 0; index < count; index += 16) {
+        size_t slot = first + index;
+
+        __m512 R0mC0 = _mm512_sub_ps(R00, _mm512_load_ps(&spheres->centerX[slot]));
+        __m512 R0mC1 = _mm512_sub_ps(R01, _mm512_load_ps(&spheres->centerY[slot]));
+        __m512 R0mC2 = _mm512_sub_ps(R02, _mm512_load_ps(&spheres->centerZ[slot]));
+
+        __m512 dot = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(Rd0, R0mC0),
+                                                 _mm512_mul_ps(Rd1, R0mC1)),
+                                   _mm512_mul_ps(Rd2, R0mC2));
+        __m512 b = negate512(dot);
+
+        __m512 l0 = _mm512_add_ps(R0mC0, _mm512_mul_ps(b, Rd0));
+        __m512 l1 = _mm512_add_ps(R0mC1, _mm512_mul_ps(b, Rd1));
+        __m512 l2 = _mm512_add_ps(R0mC2, _mm512_mul_ps(b, Rd2));
+        __m512 radius2 = _mm512_load_ps(&spheres->radius2[slot]);
+        __m512 lDotL = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(l0, l0), _mm512_mul_ps(l1, l1)),
+                                     _mm512_mul_ps(l2, l2));
+        __m512 discriminant = _mm512_sub_ps(radius2, lDotL);
+
+        __m512 R0mCDot = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(R0mC0, R0mC0),
+                                                     _mm512_mul_ps(R0mC1, R0mC1)),
+                                       _mm512_mul_ps(R0mC2, R0mC2));
+        __m512 C = _mm512_sub_ps(R0mCDot, radius2);
+        __m512 root = _mm512_sqrt_ps(_mm512_max_ps(discriminant, zero));
+        __mmask16 bPositive = _mm512_cmp_ps_mask(b, zero, _CMP_GE_OQ);
+        __m512 q = _mm512_mask_blend_ps(bPositive, _mm512_sub_ps(b, root),
+                                        _mm512_add_ps(b, root));
+        __mmask16 qZero = _mm512_cmp_ps_mask(q, zero, _CMP_EQ_OQ);
+        __m512 other = _mm512_div_ps(C, _mm512_mask_blend_ps(qZero, q, one));
+
+        __m512 t0 = _mm512_mask_blend_ps(bPositive, q, other);
+        __m512 t1 = _mm512_mask_blend_ps(bPositive, other, q);
+        __m512 t = largestT ? _mm512_max_ps(t0, t1)
+                            : _mm512_mask_blend_ps(_mm512_cmp_ps_mask(t0, zero, _CMP_GE_OQ), t1,
+                                                   t0);
+
+        __mmask16 miss = _mm512_cmp_ps_mask(discriminant, zero, _CMP_LT_OQ) | qZero;
+        _mm512_store_ps(&tOut[index], _mm512_mask_blend_ps(miss, t, zero));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void planeKernelAVX512(const PlaneArrays *planes, size_t first, size_t count,
+                              const float *R0, const float *Rd, float *tOut) {
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 one = _mm512_set1_ps(1);
+
+    __m512 R00 = _mm512_set1_ps(R0[0]), R01 = _mm512_set1_ps(R0[1]), R02 = _mm512_set1_ps(R0[2]);
+    __m512 Rd0 = _mm512_set1_ps(Rd[0]), Rd1 = _mm512_set1_ps(Rd[1]), Rd2 = _mm512_set1_ps(Rd[2]);
+
+    for (size_t index = 0; index < count; index += 16) {
+        size_t slot = first + index;
+
+        __m512 nX = _mm512_load_ps(&planes->normalX[slot]);
+        __m512 nY = _mm512_load_ps(&planes->normalY[slot]);
+        __m512 nZ = _mm512_load_ps(&planes->normalZ[slot]);
+
+        __m512 vD = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(nX, Rd0), _mm512_mul_ps(nY, Rd1)),
+                                  _mm512_mul_ps(nZ, Rd2));
+        __m512 pnDotR0 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(nX, R00),
+                                                     _mm512_mul_ps(nY, R01)),
+                                       _mm512_mul_ps(nZ, R02));
+
+        __mmask16 parallel = _mm512_cmp_ps_mask(vD, zero, _CMP_EQ_OQ);
+        __m512 numerator = negate512(_mm512_add_ps(pnDotR0, _mm512_load_ps(&planes->d[slot])));
+        __m512 t = _mm512_div_ps(numerator, _mm512_mask_blend_ps(parallel, vD, one));
+
+        _mm512_store_ps(&tOut[index], _mm512_mask_blend_ps(parallel, t, zero));
+    }
+}
+
+#endif
+
+static const IntersectionKernels kernelsScalar = {
+    "scalar", 1, sphereKernelScalar, planeKernelScalar
+};
+
+#ifdef KERNELS_X86
+static const IntersectionKernels kernelsSSE = { "sse4.2", 4, sphereKernelSSE, planeKernelSSE };
+static const IntersectionKernels kernelsAVX2 = { "avx2", 8, sphereKernelAVX2, planeKernelAVX2 };
+static const IntersectionKernels kernelsAVX512 = {
+    "avx512", 16, sphereKernelAVX512, planeKernelAVX512
+};
+#endif
+
+IntersectionKernels intersectionKernels = {
+    "scalar", 1, sphereKernelScalar, planeKernelScalar
+};
+
+void selectIntersectionKernels(void) {
+    const IntersectionKernels *candidates[4];
+    size_t numCandidates = 0;
+
+    // Widest first
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f"))
+        candidates[numCandidates++] = &kernelsAVX512;
+
+    if (__builtin_cpu_supports("avx2"))
+        candidates[numCandidates++] = &kernelsAVX2;
+
+    if (__builtin_cpu_supports("sse4.2"))
+        candidates[numCandidates++] = &kernelsSSE;
+#endif
+
+    candidates[numCandidates++] = &kernelsScalar;
+
+    const IntersectionKernels *selected = candidates[0];
+    const char *requested = getenv("RAYTRACE_KERNELS");
+
+    if (requested && *requested) {
+        selected = NULL;
+
+        for (size_t index = 0; index < numCandidates; index++) {
+            if (strcmp(requested, candidates[index]->name) == 0)
+                selected = candidates[index];
+        }
+
+        checkError(!selected, "Error: RAYTRACE_KERNELS=%s is not supported on this CPU!\n",
+                   requested);
+    }
+
+    intersectionKernels = *selected;
+
+#ifndef NDEBUG
+    printf("Intersection kernels: %s (%i-wide)\n", intersectionKernels.name,
+           intersectionKernels.width);
+#endif
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "geometry.h"
+#include "v3math.h"
+
+/**
+ Compute the intersection t of one ray with count spheres starting at index first, storing the
+ results in tOut. Kernels may compute up to GEOMETRY_PADDING - 1 extra entries past count, which
+ the padding of SphereArrays and tOut must have room for.
+ */
+typedef void (*SphereKernel)(const SphereArrays *spheres, size_t first, size_t count,
+                             const float *R0, const float *Rd, bool largestT, float *tOut);
+
+/**
+ Compute the intersection t of one ray with count planes starting at index first, storing the
+ results in tOut. The same padding rules as SphereKernel apply.
+ */
+typedef void (*PlaneKernel)(const PlaneArrays *planes, size_t first, size_t count,
+                            const float *R0, const float *Rd, float *tOut);
+
+typedef struct IntersectionKernels {
+    const char *name;
+    int width; // Primitives tested per instruction
+    SphereKernel spheres;
+    PlaneKernel planes;
+} IntersectionKernels;
+
+// Kernels in use by the linear scans of geometry.c, chosen by selectIntersectionKernels(). The BVH
+//   and grid test the few objects of a leaf or cell with the per-primitive functions below, which
+//   measured faster than a kernel call per leaf.
+extern IntersectionKernels intersectionKernels;
+
+/**
+ Pick the widest kernels the CPU supports (AVX-512, AVX2, SSE4.2, or scalar) using CPUID. The
+ RAYTRACE_KERNELS environment variable can name another supported set ("avx512", "avx2", "sse4.2"
+ or "scalar") to force it instead. Safe to call more than once.
+ */
+void selectIntersectionKernels(void);
+
+// The per-primitive functions below repeat the arithmetic of raycastSphere(), raycastPlane() and
+//   raycastQuadric() operation for operation, but select results instead of returning early so
+//   the batch loops can be vectorized. The SIMD kernels in kernels.c do the same per lane. Keep
+//   them all in sync to keep images bit-identical.
+
+static inline float sphereIntersection(const SphereArrays *spheres, size_t index,
+                                       const float *R0, const float *Rd, bool largestT) {
+    float R0mC0 = R0[0] - spheres->centerX[index];
+    float R0mC1 = R0[1] - spheres->centerY[index];
+    float R0mC2 = R0[2] - spheres->centerZ[index];
+
+    float b = -(((Rd[0] * R0mC0) + (Rd[1] * R0mC1)) + (Rd[2] * R0mC2));
+
+    float l0 = R0mC0 + b * Rd[0];
+    float l1 = R0mC1 + b * Rd[1];
+    float l2 = R0mC2 + b * Rd[2];
+    float radius2 = spheres->radius2[index];
+    float discriminant = radius2 - (((l0 * l0) + (l1 * l1)) + (l2 * l2));
+
+    float C = (((R0mC0 * R0mC0) + (R0mC1 * R0mC1)) + (R0mC2 * R0mC2)) - radius2;
+    float root = sqrtf(f_max(discriminant, 0));
+    float q = b >= 0 ? b + root : b - root;
+    float other = C / (q == 0 ? 1 : q);
+
+    float t0 = b >= 0 ? other : q;
+    float t1 = b >= 0 ? q : other;
+    float t = largestT ? f_max(t0, t1) : (t0 >= 0 ? t0 : t1);
+
+    return discriminant < 0 || q == 0 ? 0 : t;
+}
+
+static inline float planeIntersection(const PlaneArrays *planes, size_t index, const float *R0,
+                                      const float *Rd) {
+    float nX = planes->normalX[index];
+    float nY = planes->normalY[index];
+    float nZ = planes->normalZ[index];
+
+    float vD = ((nX * Rd[0]) + (nY * Rd[1])) + (nZ * Rd[2]);
+    float pnDotR0 = ((nX * R0[0]) + (nY * R0[1])) + (nZ * R0[2]);
+
+    // Parallel rays (vD == 0) never hit the plane
+    float t = -(pnDotR0 + planes->d[index]) / (vD == 0 ? 1 : vD);
+
+    return vD == 0 ? 0 : t;
+}
+
+static inline float quadricIntersection(const QuadricArrays *quadrics, size_t index,
+                                        const float *R0, const float *Rd, bool largestT) {
+    float x0 = R0[0];
+    float y0 = R0[1];
+    float z0 = R0[2];
+
+    float xd = Rd[0];
+    float yd = Rd[1];
+    float zd = Rd[2];
+
+    float A = quadrics->a[index];
+    float B = quadrics->b[index];
+    float C = quadrics->c[index];
+    float D = quadrics->d[index];
+    float E = quadrics->e[index];
+    float F = quadrics->f[index];
+    float G = quadrics->g[index];
+    float H = quadrics->h[index];
+    float I = quadrics->i[index];
+    float J = quadrics->j[index];
+
+    float Aq = (A * (xd * xd)) + (B * (yd * yd)) + (C * (zd * zd)) + (D * (xd * yd))
+             + (E * (xd * zd)) + (F * (yd * zd));
+
+    float Bq = (2 * A * x0 * xd) + (2 * B * y0 * yd) + (2 * C * z0 * zd)
+             + (D * (x0 * yd + y0 * xd)) + (E * (x0 * zd + z0 * xd)) + (F * (y0 * zd + yd * z0))
+             + (G * xd) + (H * yd) + (I * zd);
+
+    float Cq = (A * (x0 * x0)) + (B * (y0 * y0)) + (C * (z0 * z0)) + (D * x0 * y0) + (E * x0 * z0)
+             + (F * y0 * z0) + (G * z0) + (H * y0) + (I * z0) + J;
+
+    float discriminant = (Bq * Bq) - (4 * Aq * Cq);
+    float root = sqrtf(f_max(discriminant, 0));
+
+    float t0 = (-Bq - root) / (2 * Aq);
+    float t1 = (-Bq + root) / (2 * Aq);
+    float t = largestT ? f_max(t0, t1) : (t0 > 0 ? t0 : t1);
+    t = discriminant < 0 ? 0 : t;
+
+    return Aq == 0 ? -Cq / Bq : t;
+}
@@ -0,0 +1,357 @@
+#include "options.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "checkpoint.h"
+#include "partial.h"
+#include "raytrace.h"
+#include "utils.h"
+
+#define NUM_POSITIONAL_ARGS 4
+
+static const char *usage =
+    "Usage: raytrace [options] <width> <height> <input.scene> <output.ppm>\n"
+    "       raytrace --bench [options]\n"
+    "       raytrace --convert <input.scene> <output.rtscene>\n"
+    "       raytrace --daemon <socket> [options]\n"
+    "       raytrace --merge [--format p3|p6] <output.ppm> <part.ppm>...\n"
+    "Options:\n"
+    "  --threads N               Render with N threads (default: one per CPU)\n"
+    "  --min-contribution W      Skip reflection bounces weighted below W (default: 0, exact)\n"
+    "  --aa N                    Supersample edge pixels with up to N samples, a square number\n"
+    "                            up to 64 (default: 1, no anti-aliasing)\n"
+    "  --progressive             Render every 8th, 4th, 2nd, then every pixel, rewriting the\n"
+    "                            output after each pass\n"
+    "  --format p3|p6            Write a text (P3) or binary (P6, default) PPM\n"
+    "  --frames PATH             Render every frame of the camera path in PATH, numbering the\n"
+    "                            output files at the last run of # or before the extension\n"
+    "  --interactive             After the first render, read scene edits from stdin (ended by an\n"
+    "                            empty line) and re-render only the tiles each one can change\n"
+    "  --stream N                Render and write N rows at a time so memory does not grow with\n"
+    "                            the image height (not with --progressive or --heatmap)\n"
+    "  --region X,Y,W,H          Only render the W x H rectangle at X,Y of the frame, written\n"
+    "                            as a partial image for --merge\n"
+    "  --tiles LIST              Only render the 32x32 tiles in LIST (numbered row by row from 0,\n"
+    "                            e.g. 0-15,20), written as a partial image for --merge\n"
+    "  --checkpoint-interval S   Record the finished tiles next to the output every S seconds\n"
+    "                            (P6 only)\n"
+    "  --resume                  Keep the finished tiles of a checkpointed render of the same\n"
+    "                            output instead of rendering them again\n"
+    "  --specular MODE           Specular highlights: exact (powf, default), table (lookup\n"
+    "                            tables) or approx (polynomial exp2/log2), both within 1e-4\n"
+    "  --accel bvh|grid|linear   Find ray hits with a BVH (default), a uniform grid, or by\n"
+    "                            testing every object\n"
+    "  --heatmap PATH            Also write the cost of every pixel as a false-color PPM\n"
+    "  --heatmap-metric M        Cost measured: cycles (default), or rays or tests (intersection\n"
+    "                            tests) in builds made with make stats\n"
+    "  --stats                   Print ray counts and phase times (needs make stats)\n"
+    "  --bench                   Time the benchmark suite on 1, 2, 4, ... up to --threads threads\n"
+    "  --bench-runs N            Repeat every benchmark N times (default: 3)\n"
+    "  --bench-format csv|json   Format of the benchmark results (default: csv)\n"
+    "  --bench-scenes DIR        Directory of the bundled benchmark scenes (default: the one\n"
+    "                            holding the raytrace executable)\n"
+    "  --bench-skip-missing      Skip bundled benchmark scenes that are missing instead of\n"
+    "                            failing\n"
+    "  --convert                 Convert a text scene to a binary scene, which loads without\n"
+    "                            parsing wherever a scene is expected\n"
+    "  --daemon SOCKET           Serve render jobs on a Unix domain socket, keeping the threads\n"
+    "                            and recently used scenes between jobs\n"
+    "  --merge                   Assemble partial images from --region or --tiles into the\n"
+    "                            whole frame\n";
+
+static int parseInt(const char *text, const char *name, int min) {
+    char *end;
+    long value = strtol(text, &end, 10);
+
+    checkError(*text == '\0' || *end != '\0' || value < min || value > INT_MAX,
+               "Error: Invalid %s \"%s\"!\n%s", name, text, usage);
+
+    return (int) value;
+}
+
+static float parseFloat(const char *text, const char *name, float min) {
+    char *end;
+    float value = strtof(text, &end);
+
+    checkError(*text == '\0' || *end != '\0' || !(value >= min),
+               "Error: Invalid %s \"%s\"!\n%s", name, text, usage);
+
+    return value;
+}
+
+static void parseRegion(const char *text, Tile *region) {
+    int values[4];
+    const char *field = text;
+
+    for (int index = 0; index < 4; index++) {
+        char *end;
+        long value = strtol(field, &end, 10);
+
+        checkError(end == field || value < (index < 2 ? 0 : 1) || value > INT_MAX
+                   || *end != (index < 3 ? ',' : '\0'),
+                   "Error: Invalid region \"%s\", expected X,Y,WIDTH,HEIGHT!\n%s", text, usage);
+
+        values[index] = (int) value;
+        field = end + 1;
+    }
+
+    *region = (Tile) { values[0], values[1], values[2], values[3] };
+}
+
+// Value following the option at *index, advancing *index past it
+static const char *optionValue(int argc, const char *argv[], int *index) {
+    checkError(*index + 1 >= argc, "Error: Missing value for %s!\n%s", argv[*index], usage);
+
+    return argv[++*index];
+}
+
+void parseOptions(int argc, const char *argv[], RenderOptions *options) {
+    const char *positional[argc];
+    int numPositional = 0;
+
+    *options = (RenderOptions) {};
+    options->maxSamples = 1;
+    options->outputFormat = 6;
+    options->benchRuns = BENCH_DEFAULT_RUNS;
+
+    for (int index = 1; index < argc; index++) {
+        const char *arg = argv[index];
+
+        if (strncmp(arg, "--", 2) != 0) {
+            positional[numPositional++] = arg;
+        }
+        else if (strcmp(arg, "--threads") == 0) {
+            options->numThreads = parseInt(optionValue(argc, argv, &index), "thread count", 1);
+        }
+        else if (strcmp(arg, "--min-contribution") == 0) {
+            options->minContribution = parseFloat(optionValue(argc, argv, &index),
+                                                  "minimum contribution", 0);
+        }
+        else if (strcmp(arg, "--aa") == 0) {
+            int samples = parseInt(optionValue(argc, argv, &index), "sample count", 1);
+            int side = 1;
+
+            while ((side + 1) * (side + 1) <= samples)
+                side++;
+
+            checkError(side * side != samples || samples > MAX_SAMPLES,
+                       "Error: The sample count must be a square number up to %i!\n%s",
+                       MAX_SAMPLES, usage);
+            options->maxSamples = samples;
+        }
+        else if (strcmp(arg, "--progressive") == 0) {
+            options->progressive = true;
+        }
+        else if (strcmp(arg, "--format") == 0) {
+            const char *format = optionValue(argc, argv, &index);
+
+            if (strcmp(format, "p3") == 0)
+                options->outputFormat = 3;
+            else if (strcmp(format, "p6") == 0)
+                options->outputFormat = 6;
+            else
+                checkError(true, "Error: Unknown output format \"%s\"!\n%s", format, usage);
+        }
+        else if (strcmp(arg, "--frames") == 0) {
+            options->cameraPathFileName = optionValue(argc, argv, &index);
+        }
+        else if (strcmp(arg, "--interactive") == 0) {
+            options->interactive = true;
+        }
+        else if (strcmp(arg, "--stream") == 0) {
+            options->streamRows = parseInt(optionValue(argc, argv, &index), "row count", 1);
+        }
+        else if (strcmp(arg, "--checkpoint-interval") == 0) {
+            options->checkpointInterval = parseInt(optionValue(argc, argv, &index), "interval",
+                                                   1);
+        }
+        else if (strcmp(arg, "--resume") == 0) {
+            options->resume = true;
+        }
+        else if (strcmp(arg, "--region") == 0) {
+            parseRegion(optionValue(argc, argv, &index), &options->region);
+            options->hasRegion = true;
+        }
+        else if (strcmp(arg, "--tiles") == 0) {
+            options->tileList = optionValue(argc, argv, &index);
+        }
+        else if (strcmp(arg, "--specular") == 0) {
+            const char *mode = optionValue(argc, argv, &index);
+
+            if (strcmp(mode, "exact") == 0)
+                options->specularMode = SPECULAR_EXACT;
+            else if (strcmp(mode, "table") == 0)
+                options->specularMode = SPECULAR_TABLE;
+            else if (strcmp(mode, "approx") == 0)
+                options->specularMode = SPECULAR_APPROX;
+            else
+                checkError(true, "Error: Unknown specular mode \"%s\"!\n%s", mode, usage);
+        }
+        else if (strcmp(arg, "--accel") == 0) {
+            const char *accelerator = optionValue(argc, argv, &index);
+
+            if (strcmp(accelerator, "bvh") == 0)
+                options->accelerator = ACCEL_BVH;
+            else if (strcmp(accelerator, "grid") == 0)
+                options->accelerator = ACCEL_GRID;
+            else if (strcmp(accelerator, "linear") == 0)
+                options->accelerator = ACCEL_LINEAR;
+            else
+                checkError(true, "Error: Unknown accelerator \"%s\"!\n%s", accelerator, usage);
+        }
+        else if (strcmp(arg, "--heatmap") == 0) {
+            options->heatmapFileName = optionValue(argc, argv, &index);
+        }
+        else if (strcmp(arg, "--heatmap-metric") == 0) {
+            const char *metric = optionValue(argc, argv, &index);
+
+            if (strcmp(metric, "cycles") == 0)
+                options->heatmapMetric = HEATMAP_CYCLES;
+            else if (strcmp(metric, "rays") == 0)
+                options->heatmapMetric = HEATMAP_RAYS;
+            else if (strcmp(metric, "tests") == 0)
+                options->heatmapMetric = HEATMAP_TESTS;
+            else
+                checkError(true, "Error: Unknown heatmap metric \"%s\"!\n%s", metric, usage);
+
+#ifndef STATS
+            checkError(options->heatmapMetric != HEATMAP_CYCLES,
+                       "Error: Heatmaps of %s need a build with statistics (make stats)!\n",
+                       metric);
+#endif
+        }
+        else if (strcmp(arg, "--stats") == 0) {
+#ifdef STATS
+            options->stats = true;
+#else
+            checkError(true, "Error: --stats needs a build with statistics (make stats)!\n");
+#endif
+        }
+        else if (strcmp(arg, "--bench") == 0) {
+            options->bench = true;
+        }
+        else if (strcmp(arg, "--convert") == 0) {
+            options->convert = true;
+        }
+        else if (strcmp(arg, "--daemon") == 0) {
+            options->daemonSocketName = optionValue(argc, argv, &index);
+        }
+        else if (strcmp(arg, "--merge") == 0) {
+            options->merge = true;
+        }
+        else if (strcmp(arg, "--bench-runs") == 0) {
+            options->benchRuns = parseInt(optionValue(argc, argv, &index), "run count", 1);
+        }
+        else if (strcmp(arg, "--bench-format") == 0) {
+            const char *format = optionValue(argc, argv, &index);
+
+            if (strcmp(format, "csv") == 0)
+                options->benchFormat = BENCH_CSV;
+            else if (strcmp(format, "json") == 0)
+                options->benchFormat = BENCH_JSON;
+            else
+                checkError(true, "Error: Unknown benchmark format \"%s\"!\n%s", format, usage);
+        }
+        else if (strcmp(arg, "--bench-scenes") == 0) {
+            options->benchScenesDir = optionValue(argc, argv, &index);
+        }
+        else if (strcmp(arg, "--bench-skip-missing") == 0) {
+            options->benchSkipMissing = true;
+        }
+        else {
+            checkError(true, "Error: Unknown option \"%s\"!\n%s", arg, usage);
+        }
+    }
+
+    if (options->resume && options->checkpointInterval == 0)
+        options->checkpointInterval = DEFAULT_CHECKPOINT_INTERVAL;
+
+    checkError(options->checkpointInterval > 0
+               && (options->progressive || options->streamRows > 0 || options->heatmapFileName
+                   || options->cameraPathFileName || options->interactive || options->hasRegion
+                   || options->tileList || options->daemonSocketName || options->bench
+                   || options->outputFormat != 6),
+               "Error: --checkpoint-interval and --resume cannot be combined with --progressive, "
+               "--stream, --heatmap, --frames, --interactive, --region, --tiles, --daemon, --bench "
+               "or --format p3!\n%s", usage);
+
+    if (options->bench) {
+        checkError(numPositional != 0, "Error: --bench takes no positional arguments!\n%s", usage);
+        return;
+    }
+
+    if (options->daemonSocketName) {
+        checkError(numPositional != 0, "Error: --daemon takes no positional arguments!\n%s",
+                   usage);
+        checkError(options->progressive || options->streamRows > 0 || options->heatmapFileName
+                   || options->cameraPathFileName || options->interactive,
+                   "Error: --daemon cannot be combined with --progressive, --stream, --heatmap, "
+                   "--frames or --interactive!\n%s", usage);
+        return;
+    }
+
+    if (options->merge) {
+        checkError(numPositional < 2,
+                   "Error: --merge takes an output path and at least one partial image!\n%s",
+                   usage);
+
+        options->outputFileName = positional[0];
+        options->numPartFileNames = numPositional - 1;
+        options->partFileNames = malloc(options->numPartFileNames * sizeof(const char *));
+        checkError(options->partFileNames == NULL, "Error: Could not allocate memory!\n");
+        memcpy(options->partFileNames, &positional[1],
+               options->numPartFileNames * sizeof(const char *));
+        return;
+    }
+
+    if (options->convert) {
+        checkError(numPositional != 2, "Error: --convert takes an input and an output path!\n%s",
+                   usage);
+        options->inputFileName = positional[0];
+        options->outputFileName = positional[1];
+        return;
+    }
+
+    checkError(options->streamRows > 0 && (options->progressive || options->heatmapFileName),
+               "Error: --stream cannot be combined with --progressive or --heatmap!\n%s", usage);
+    checkError(options->cameraPathFileName
+               && (options->streamRows > 0 || options->progressive || options->heatmapFileName),
+               "Error: --frames cannot be combined with --stream, --progressive or --heatmap!\n%s",
+               usage);
+    checkError(options->interactive
+               && (options->cameraPathFileName || options->streamRows > 0
+                   || options->progressive || options->heatmapFileName),
+               "Error: --interactive cannot be combined with --frames, --stream, --progressive "
+               "or --heatmap!\n%s", usage);
+
+    checkError((options->hasRegion || options->tileList)
+               && (options->progressive || options->heatmapFileName
+                   || options->cameraPathFileName || options->interactive),
+               "Error: --region and --tiles cannot be combined with --progressive, --heatmap, "
+               "--frames or --interactive!\n%s", usage);
+    checkError(options->hasRegion && options->tileList,
+               "Error: --region and --tiles cannot be combined!\n%s", usage);
+    checkError(options->tileList && options->streamRows > 0,
+               "Error: --tiles cannot be combined with --stream!\n%s", usage);
+
+    checkError(numPositional != NUM_POSITIONAL_ARGS, "Error: Wrong number of arguments!\n%s",
+               usage);
+
+    options->width = parseInt(positional[0], "width", 1);
+    options->height = parseInt(positional[1], "height", 1);
+    options->inputFileName = positional[2];
+    options->outputFileName = positional[3];
+
+    const Tile *region = &options->region;
+    checkError(options->hasRegion && (region->width > options->width - region->x
+                                      || region->height > options->height - region->y),
+               "Error: The region does not fit in the %ix%i frame!\n%s", options->width,
+               options->height, usage);
+
+    if (options->tileList)
+        options->tiles = parseTileList(options->tileList, options->width, options->height);
+}
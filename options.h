@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "geometry.h"
+#include "heatmap.h"
+#include "scheduler.h"
+#include "specular.h"
+
+typedef enum {
+    BENCH_CSV  = 0,
+    BENCH_JSON = 1
+} BenchFormat;
+
+/**
+ Settings given on the command line. The four positional arguments (width, height, input scene
+ path and output PPM path) may be mixed freely with the --options. They are omitted in benchmark
+ mode, which renders its own scenes, and are just the input and output paths in convert mode.
+ */
+typedef struct RenderOptions {
+    int width, height;
+    const char *inputFileName;
+    const char *outputFileName;
+
+    // Number of render threads, 0 for one per online CPU
+    int numThreads;
+
+    // Reflection weight below which bounces are skipped, 0 for exact output
+    float minContribution;
+
+    // Maximum samples per pixel (a square number), 1 to disable anti-aliasing
+    int maxSamples;
+
+    // Render coarse passes first, rewriting the output after each
+    bool progressive;
+
+    // PPM format of the output image, 3 (text) or 6 (binary, the default)
+    int outputFormat;
+
+    // Render every frame of this camera path instead of a single image when not NULL, numbering
+    //   the output files
+    const char *cameraPathFileName;
+
+    // Read scene edits from stdin after the first render, re-rendering only the tiles each one
+    //   can change and rewriting the output
+    bool interactive;
+
+    // Render and write this many rows at a time instead of the whole frame at once, 0 to disable
+    int streamRows;
+
+    // Only render this rectangle of the frame when hasRegion is set, or the tiles marked in tiles
+    //   (parsed from tileList) when it is not NULL, writing a partial image
+    Tile region;
+    bool hasRegion;
+    const char *tileList;
+    bool *tiles;
+
+    // Seconds between checkpoints of the finished tiles, 0 to disable, and whether to keep the
+    //   tiles of an earlier checkpoint of the output
+    int checkpointInterval;
+    bool resume;
+
+    // How specular highlights are evaluated (powf() by default)
+    SpecularMode specularMode;
+
+    // Structure used to find ray hits (the BVH by default)
+    Accelerator accelerator;
+
+    // Also write the per-pixel cost of the render as a false-color image when not NULL
+    const char *heatmapFileName;
+    HeatmapMetric heatmapMetric;
+
+    // Print ray and timing statistics after rendering (needs a build with -D STATS)
+    bool stats;
+
+    // Run the benchmark suite instead of rendering a scene, repeating every measurement benchRuns
+    //   times
+    bool bench;
+    int benchRuns;
+    BenchFormat benchFormat;
+
+    // Directory of the bundled benchmark scenes (next to the executable when NULL), and whether a
+    //   missing one is skipped rather than an error
+    const char *benchScenesDir;
+    bool benchSkipMissing;
+
+    // Serve render jobs on a Unix domain socket at this path instead of rendering when not NULL
+    const char *daemonSocketName;
+
+    // Assemble the partial images in partFileNames into outputFileName instead of rendering
+    bool merge;
+    const char **partFileNames;
+    int numPartFileNames;
+
+    // Convert the text scene inputFileName to a binary scene at outputFileName instead of
+    //   rendering
+    bool convert;
+} RenderOptions;
+
+/**
+ Parse the command line into options, exiting with a usage message on errors.
+ */
+void parseOptions(int argc, const char *argv[], RenderOptions *options);
@@ -0,0 +1,732 @@
+#include "parser.h"
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "animation.h"
+#include "incremental.h"
+#include "raytrace.h"
+#include "utils.h"
+#include "v3math.h"
+
+// Longest number handed to strtof() when the exact fast path does not apply
+#define MAX_NUMBER_LENGTH 64
+
+// Significant digits that fit a uint64_t without overflow
+#define MAX_MANTISSA_DIGITS 19
+
+typedef struct Scanner {
+    const char *text, *cursor, *end;
+    const char *fileName;
+} Scanner;
+
+typedef enum {
+    VALUE_FLOAT,
+    VALUE_ANGLE,     // Degrees, stored in radians
+    VALUE_VECTOR,    // [x, y, z]
+    VALUE_DIRECTION, // [x, y, z], making the light a spot light
+    VALUE_CONSTANTS  // [a, b, c, d, e, f, g, h, i, j]
+} ValueKind;
+
+// Everything an entry can set, filled in before it is added to the scene
+typedef struct SceneEntry {
+    Object object;
+    Light light;
+    Camera camera;
+    Keyframe keyframe;
+    float planePosition[3];
+    bool hasDirection;
+} SceneEntry;
+
+typedef struct Property {
+    const char *name;
+    ValueKind kind;
+    size_t offset; // Into SceneEntry
+} Property;
+
+typedef enum {
+    ENTRY_CAMERA,
+    ENTRY_PLANE,
+    ENTRY_SPHERE,
+    ENTRY_QUADRIC,
+    ENTRY_LIGHT,
+    ENTRY_KEYFRAME
+} EntryKind;
+
+typedef struct EntryType {
+    const char *name;
+    EntryKind kind;
+    const Property *properties;
+    size_t numProperties;
+} EntryType;
+
+#define NUM_PROPERTIES(properties) (sizeof(properties) / sizeof(properties[0]))
+#define OBJECT_PROPERTY(name, kind, member) { name, kind, offsetof(SceneEntry, object.member) }
+#define LIGHT_PROPERTY(name, kind, member) { name, kind, offsetof(SceneEntry, light.member) }
+#define KEYFRAME_PROPERTY(name, kind, member) \
+    { name, kind, offsetof(SceneEntry, keyframe.member) }
+
+static const Property cameraProperties[] = {
+    { "width", VALUE_FLOAT, offsetof(SceneEntry, camera.vpWidth) },
+    { "height", VALUE_FLOAT, offsetof(SceneEntry, camera.vpHeight) }
+};
+
+// Planes have no specular highlight, so their specular_color is accepted but not used
+static const Property planeProperties[] = {
+    OBJECT_PROPERTY("normal", VALUE_VECTOR, pn),
+    { "position", VALUE_VECTOR, offsetof(SceneEntry, planePosition) },
+    OBJECT_PROPERTY("diffuse_color", VALUE_VECTOR, diffuseColor),
+    OBJECT_PROPERTY("specular_color", VALUE_VECTOR, specularColor),
+    OBJECT_PROPERTY("reflectivity", VALUE_FLOAT, reflectivity),
+    OBJECT_PROPERTY("refractivity", VALUE_FLOAT, refractivity),
+    OBJECT_PROPERTY("ior", VALUE_FLOAT, ior),
+    OBJECT_PROPERTY("ns", VALUE_FLOAT, ns)
+};
+
+static const Property sphereProperties[] = {
+    OBJECT_PROPERTY("radius", VALUE_FLOAT, radius),
+    OBJECT_PROPERTY("position", VALUE_VECTOR, center),
+    OBJECT_PROPERTY("diffuse_color", VALUE_VECTOR, diffuseColor),
+    OBJECT_PROPERTY("specular_color", VALUE_VECTOR, specularColor),
+    OBJECT_PROPERTY("reflectivity", VALUE_FLOAT, reflectivity),
+    OBJECT_PROPERTY("refractivity", VALUE_FLOAT, refractivity),
+    OBJECT_PROPERTY("ior", VALUE_FLOAT, ior),
+    OBJECT_PROPERTY("ns", VALUE_FLOAT, ns)
+};
+
+static const Property quadricProperties[] = {
+    OBJECT_PROPERTY("constants", VALUE_CONSTANTS, quadricVars),
+    OBJECT_PROPERTY("diffuse_color", VALUE_VECTOR, diffuseColor),
+    OBJECT_PROPERTY("specular_color", VALUE_VECTOR, specularColor),
+    OBJECT_PROPERTY("reflectivity", VALUE_FLOAT, reflectivity),
+    OBJECT_PROPERTY("refractivity", VALUE_FLOAT, refractivity),
+    OBJECT_PROPERTY("ior", VALUE_FLOAT, ior),
+    OBJECT_PROPERTY("ns", VALUE_FLOAT, ns)
+};
+
+static const Property lightProperties[] = {
+    LIGHT_PROPERTY("position", VALUE_VECTOR, position),
+    LIGHT_PROPERTY("color", VALUE_VECTOR, color),
+    LIGHT_PROPERTY("direction", VALUE_DIRECTION, direction),
+    LIGHT_PROPERTY("theta", VALUE_ANGLE, theta),
+    LIGHT_PROPERTY("radial-a0", VALUE_FLOAT, radialA0),
+    LIGHT_PROPERTY("radial-a1", VALUE_FLOAT, radialA1),
+    LIGHT_PROPERTY("radial-a2", VALUE_FLOAT, radialA2),
+    LIGHT_PROPERTY("angular-a0", VALUE_FLOAT, angularA0)
+};
+
+static const Property keyframeProperties[] = {
+    KEYFRAME_PROPERTY("frame", VALUE_FLOAT, frame),
+    KEYFRAME_PROPERTY("position", VALUE_VECTOR, position),
+    KEYFRAME_PROPERTY("target", VALUE_VECTOR, target),
+    KEYFRAME_PROPERTY("up", VALUE_VECTOR, up)
+};
+
+static const EntryType entryTypes[] = {
+    { "camera", ENTRY_CAMERA, cameraProperties, NUM_PROPERTIES(cameraProperties) },
+    { "plane", ENTRY_PLANE, planeProperties, NUM_PROPERTIES(planeProperties) },
+    { "sphere", ENTRY_SPHERE, sphereProperties, NUM_PROPERTIES(sphereProperties) },
+    { "quadric", ENTRY_QUADRIC, quadricProperties, NUM_PROPERTIES(quadricProperties) },
+    { "light", ENTRY_LIGHT, lightProperties, NUM_PROPERTIES(lightProperties) }
+};
+
+// Camera path files hold keyframes alone
+static const EntryType pathEntryTypes[] = {
+    { "keyframe", ENTRY_KEYFRAME, keyframeProperties, NUM_PROPERTIES(keyframeProperties) }
+};
+
+#define NUM_ENTRY_TYPES(types) (sizeof(types) / sizeof(types[0]))
+
+// Powers of ten that are exact in a float (5^10 < 2^24)
+static const float exactPowersOf10[] = {
+    1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+};
+
+static inline bool isNameCharacter(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_'
+           || c == '-';
+}
+
+static inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Exit with the line and column of position and the word found there
+static void parseError(const Scanner *scanner, const char *position, const char *format, ...) {
+    size_t line = 1, column = 1;
+
+    // Only counted once something goes wrong, so scanning never tracks lines
+    for (const char *c = scanner->text; c < position; c++) {
+        if (*c == '\n') {
+            line++;
+            column = 1;
+        }
+        else {
+            column++;
+        }
+    }
+
+    const char *wordEnd = position;
+
+    while (wordEnd < scanner->end && wordEnd - position < 32 && *wordEnd != '\n'
+           && *wordEnd != ',')
+        wordEnd++;
+
+    char message[128];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    if (position < scanner->end) {
+        checkError(true, "Error: %s:%zu:%zu: %s at \"%.*s\"!\n", scanner->fileName, line, column,
+                   message, (int) (wordEnd - position), position);
+    }
+    else {
+        checkError(true, "Error: %s:%zu:%zu: %s at the end of the file!\n", scanner->fileName,
+                   line, column, message);
+    }
+}
+
+// Skip whitespace and comments
+static inline void skipSpace(Scanner *scanner) {
+    const char *cursor = scanner->cursor, *end = scanner->end;
+
+    while (cursor < end) {
+        if (*cursor == ' ' || *cursor == '\t' || *cursor == '\n' || *cursor == '\r') {
+            cursor++;
+        }
+        else if (*cursor == '#') {
+            while (cursor < end && *cursor != '\n')
+                cursor++;
+        }
+        else {
+            break;
+        }
+    }
+
+    scanner->cursor = cursor;
+}
+
+static inline bool acceptCharacter(Scanner *scanner, char c) {
+    skipSpace(scanner);
+
+    if (scanner->cursor < scanner->end && *scanner->cursor == c) {
+        scanner->cursor++;
+        return true;
+    }
+
+    return false;
+}
+
+static inline void expectCharacter(Scanner *scanner, char c) {
+    if (!acceptCharacter(scanner, c))
+        parseError(scanner, scanner->cursor, "Expected '%c'", c);
+}
+
+// Length of the name at the cursor, which is left after it
+static inline size_t scanName(Scanner *scanner) {
+    const char *start = scanner->cursor;
+
+    while (scanner->cursor < scanner->end && isNameCharacter(*scanner->cursor))
+        scanner->cursor++;
+
+    return scanner->cursor - start;
+}
+
+static inline bool nameEquals(const char *name, size_t length, const char *literal) {
+    for (size_t index = 0; index < length; index++) {
+        if (literal[index] != name[index])
+            return false;
+    }
+
+    return literal[length] == '\0';
+}
+
+/**
+ Parse a decimal number at the cursor, giving exactly what strtof() would. Numbers with at most
+ 2^24 significant value and a decimal exponent within +-10 are one correctly rounded float
+ multiplication or division of exact operands; anything else is passed to strtof(). Numbers run
+ into by letters, digits or another point, and numbers too large for a float, are errors.
+ */
+static float scanFloat(Scanner *scanner) {
+    skipSpace(scanner);
+
+    const char *start = scanner->cursor, *end = scanner->end, *cursor = start;
+    bool negative = false, hasDigits = false, fitsMantissa = true;
+    uint64_t mantissa = 0;
+    int numDigits = 0, exponent = 0;
+
+    if (cursor < end && (*cursor == '-' || *cursor == '+'))
+        negative = *cursor++ == '-';
+
+    for (; cursor < end && isDigit(*cursor); cursor++) {
+        hasDigits = true;
+
+        if (numDigits < MAX_MANTISSA_DIGITS) {
+            mantissa = mantissa * 10 + (*cursor - '0');
+            numDigits += mantissa > 0;
+        }
+        else {
+            fitsMantissa = false;
+        }
+    }
+
+    if (cursor < end && *cursor == '.') {
+        for (cursor++; cursor < end && isDigit(*cursor); cursor++) {
+            hasDigits = true;
+
+            if (numDigits < MAX_MANTISSA_DIGITS) {
+                mantissa = mantissa * 10 + (*cursor - '0');
+                numDigits += mantissa > 0;
+                exponent--;
+            }
+            else {
+                fitsMantissa = false;
+            }
+        }
+    }
+
+    if (!hasDigits)
+        parseError(scanner, start, "Expected a number");
+
+    if (cursor < end && (*cursor == 'e' || *cursor == 'E')) {
+        const char *exponentStart = cursor++;
+        bool negativeExponent = false;
+        int written = 0;
+
+        if (cursor < end && (*cursor == '-' || *cursor == '+'))
+            negativeExponent = *cursor++ == '-';
+
+        if (cursor < end && isDigit(*cursor)) {
+            for (; cursor < end && isDigit(*cursor); cursor++)
+                written = written < 10000 ? written * 10 + (*cursor - '0') : written;
+
+            exponent += negativeExponent ? -written : written;
+        }
+        else {
+            // Not an exponent after all, as strtof() would see it
+            cursor = exponentStart;
+        }
+    }
+
+    // Caught here, as "0x10" or "1.5.5" would otherwise stop after the 0 or 1.5 and the rest
+    //   be reported as the next entry
+    if (cursor < end && (isNameCharacter(*cursor) || *cursor == '.'))
+        parseError(scanner, start, "Invalid number");
+
+    scanner->cursor = cursor;
+
+    float value;
+
+    if (fitsMantissa && mantissa <= (1 << 24) && exponent >= -10 && exponent <= 10) {
+        value = exponent < 0 ? (float) mantissa / exactPowersOf10[-exponent]
+                             : (float) mantissa * exactPowersOf10[exponent];
+
+        return negative ? -value : value;
+    }
+
+    char number[MAX_NUMBER_LENGTH + 1];
+    size_t length = cursor - start;
+
+    if (length > MAX_NUMBER_LENGTH)
+        parseError(scanner, start, "Number is too long");
+
+    for (size_t index = 0; index < length; index++)
+        number[index] = start[index];
+
+    number[length] = '\0';
+    value = strtof(number, NULL);
+
+    if (!isfinite(value))
+        parseError(scanner, start, "Number is out of range");
+
+    return value;
+}
+
+// Parse a bracketed list of count numbers into values
+static void scanVector(Scanner *scanner, float *values, int count) {
+    expectCharacter(scanner, '[');
+
+    for (int index = 0; index < count; index++) {
+        if (index > 0)
+            expectCharacter(scanner, ',');
+
+        values[index] = scanFloat(scanner);
+    }
+
+    expectCharacter(scanner, ']');
+}
+
+// Parse a whole number at the cursor
+static size_t scanIndex(Scanner *scanner) {
+    skipSpace(scanner);
+
+    const char *start = scanner->cursor;
+    size_t value = 0;
+
+    if (start == scanner->end || !isDigit(*start))
+        parseError(scanner, start, "Expected an index");
+
+    for (; scanner->cursor < scanner->end && isDigit(*scanner->cursor); scanner->cursor++) {
+        if (value > (SIZE_MAX - 9) / 10)
+            parseError(scanner, start, "Index is too large");
+
+        value = value * 10 + (*scanner->cursor - '0');
+    }
+
+    return value;
+}
+
+static void scanProperty(Scanner *scanner, const EntryType *type, SceneEntry *entry) {
+    skipSpace(scanner);
+
+    const char *name = scanner->cursor;
+    size_t length = scanName(scanner);
+
+    if (length == 0)
+        parseError(scanner, name, "Expected a property name");
+
+    const Property *property = NULL;
+
+    for (size_t index = 0; index < type->numProperties; index++) {
+        if (nameEquals(name, length, type->properties[index].name)) {
+            property = &type->properties[index];
+            break;
+        }
+    }
+
+    if (property == NULL)
+        parseError(scanner, name, "Unknown %s property", type->name);
+
+    expectCharacter(scanner, ':');
+
+    float *value = (float *) ((char *) entry + property->offset);
+
+    switch (property->kind) {
+        case VALUE_FLOAT:
+            *value = scanFloat(scanner);
+            break;
+        case VALUE_ANGLE:
+            *value = f_to_radians(scanFloat(scanner));
+            break;
+        case VALUE_VECTOR:
+            scanVector(scanner, value, 3);
+            break;
+        case VALUE_DIRECTION:
+            scanVector(scanner, value, 3);
+            entry->hasDirection = true;
+            break;
+        case VALUE_CONSTANTS:
+            scanVector(scanner, value, 10);
+            break;
+    }
+}
+
+// Scan the name of the entry at the cursor, which must be one of types
+static const EntryType *scanEntryType(Scanner *scanner, const EntryType *types, size_t numTypes,
+                                      const char *expected) {
+    const char *name = scanner->cursor;
+    size_t length = scanName(scanner);
+
+    for (size_t index = 0; index < numTypes; index++) {
+        if (nameEquals(name, length, types[index].name))
+            return &types[index];
+    }
+
+    parseError(scanner, name, "Expected %s", expected);
+    return NULL;
+}
+
+static void scanProperties(Scanner *scanner, const EntryType *type, SceneEntry *entry) {
+    // The properties end where no comma follows a value
+    expectCharacter(scanner, ',');
+
+    do {
+        scanProperty(scanner, type, entry);
+    } while (acceptCharacter(scanner, ','));
+}
+
+// Add a zeroed object or light to sceneData, doubling the storage when it is full
+static Object *appendObject(SceneData *sceneData) {
+    if (sceneData->numObjects == sceneData->objectCapacity) {
+        size_t capacity = sceneData->objectCapacity;
+        reserveSceneStorage(sceneData, capacity > 0 ? 2 * capacity : SCENE_INITIAL_CAPACITY,
+                            sceneData->lightCapacity);
+    }
+
+    return &sceneData->objects[sceneData->numObjects++];
+}
+
+static Light *appendLight(SceneData *sceneData) {
+    if (sceneData->numLights == sceneData->lightCapacity) {
+        size_t capacity = sceneData->lightCapacity;
+        reserveSceneStorage(sceneData, sceneData->objectCapacity,
+                            capacity > 0 ? 2 * capacity : SCENE_INITIAL_CAPACITY);
+    }
+
+    return &sceneData->lights[sceneData->numLights++];
+}
+
+// Fill in what the properties of an entry imply
+static void finishEntry(const EntryType *type, SceneEntry *entry) {
+    switch (type->kind) {
+        case ENTRY_PLANE:
+            entry->object.type = PLANE;
+            entry->object.d = -f3_dot(entry->planePosition, entry->object.pn);
+            entry->object.specularColor = (PixelN) { 0, 0, 0 };
+            break;
+        case ENTRY_SPHERE:
+            entry->object.type = SPHERE;
+            break;
+        case ENTRY_QUADRIC:
+            entry->object.type = QUADRIC;
+            break;
+        case ENTRY_LIGHT:
+            entry->light.type = entry->hasDirection ? SPOT : POINT;
+            entry->light.cosTheta = cosf(entry->light.theta);
+            break;
+        case ENTRY_CAMERA:
+        case ENTRY_KEYFRAME:
+            break;
+    }
+}
+
+// Reject an entry, starting at start, that is missing a property it cannot do without or holds
+//   one that cannot be rendered
+static void checkEntry(const Scanner *scanner, const char *start, const EntryType *type,
+                       SceneEntry *entry) {
+    switch (type->kind) {
+        case ENTRY_CAMERA:
+            if (!(entry->camera.vpWidth > 0 && entry->camera.vpHeight > 0))
+                parseError(scanner, start, "Camera width and height must be positive");
+            break;
+        case ENTRY_PLANE:
+            if (f3_dot(entry->object.pn, entry->object.pn) == 0)
+                parseError(scanner, start, "Plane normal must be given and nonzero");
+            break;
+        case ENTRY_SPHERE:
+            if (!(entry->object.radius > 0))
+                parseError(scanner, start, "Sphere radius must be given and positive");
+            break;
+        case ENTRY_QUADRIC: {
+            const float *constants = &entry->object.quadricVars.a;
+            bool given = false;
+
+            for (int index = 0; index < 10; index++)
+                given |= constants[index] != 0;
+
+            if (!given)
+                parseError(scanner, start, "Quadric constants must be given and not all zero");
+            break;
+        }
+        case ENTRY_LIGHT:
+        case ENTRY_KEYFRAME:
+            break;
+    }
+}
+
+static void addEntry(SceneData *sceneData, const EntryType *type, SceneEntry *entry) {
+    finishEntry(type, entry);
+
+    switch (type->kind) {
+        case ENTRY_CAMERA:
+            sceneData->camera.vpWidth = entry->camera.vpWidth;
+            sceneData->camera.vpHeight = entry->camera.vpHeight;
+            break;
+        case ENTRY_PLANE:
+        case ENTRY_SPHERE:
+        case ENTRY_QUADRIC:
+            *appendObject(sceneData) = entry->object;
+            break;
+        case ENTRY_LIGHT:
+            *appendLight(sceneData) = entry->light;
+            break;
+        case ENTRY_KEYFRAME:
+            break;
+    }
+}
+
+void parseSceneInput(const char *text, size_t length, const char *fileName,
+                     SceneData *sceneData) {
+    Scanner scanner = { text, text, text + length, fileName };
+
+    sceneData->numObjects = 0;
+    sceneData->numLights = 0;
+
+    for (skipSpace(&scanner); scanner.cursor < scanner.end; skipSpace(&scanner)) {
+        const char *start = scanner.cursor;
+        const EntryType *type = scanEntryType(&scanner, entryTypes, NUM_ENTRY_TYPES(entryTypes),
+                                              "camera, plane, sphere, quadric or light");
+
+        SceneEntry entry = {};
+        entry.object.ns = DEFAULT_NS;
+        entry.camera = sceneData->camera;
+
+        scanProperties(&scanner, type, &entry);
+        checkEntry(&scanner, start, type, &entry);
+        addEntry(sceneData, type, &entry);
+    }
+
+    checkError(!(sceneData->camera.vpWidth > 0 && sceneData->camera.vpHeight > 0),
+               "Error: %s: The scene has no camera!\n", fileName);
+
+    resetCameraView(&sceneData->camera);
+
+    compileScene(sceneData);
+}
+
+void parseCameraPath(const char *text, size_t length, const char *fileName, CameraPath *path) {
+    Scanner scanner = { text, text, text + length, fileName };
+    float nextFrame = 0;
+
+    path->numKeyframes = 0;
+
+    for (skipSpace(&scanner); scanner.cursor < scanner.end; skipSpace(&scanner)) {
+        const char *start = scanner.cursor;
+        const EntryType *type = scanEntryType(&scanner, pathEntryTypes,
+                                              NUM_ENTRY_TYPES(pathEntryTypes), "keyframe");
+
+        // Keyframes without a frame follow the previous one, and keep its view
+        SceneEntry entry = {};
+
+        if (path->numKeyframes > 0) {
+            entry.keyframe = path->keyframes[path->numKeyframes - 1];
+        }
+        else {
+            entry.keyframe.target[2] = -1;
+            entry.keyframe.up[1] = 1;
+        }
+
+        entry.keyframe.frame = nextFrame;
+        scanProperties(&scanner, type, &entry);
+
+        float frame = entry.keyframe.frame;
+
+        if (frame != floorf(frame) || frame < nextFrame || frame > MAX_FRAME)
+            parseError(&scanner, start, "Keyframe frames must be increasing whole numbers");
+
+        if (path->numKeyframes == path->keyframeCapacity) {
+            size_t capacity = path->keyframeCapacity > 0 ? 2 * path->keyframeCapacity
+                                                         : PATH_INITIAL_CAPACITY;
+            Keyframe *keyframes = realloc(path->keyframes, capacity * sizeof(Keyframe));
+            checkError(keyframes == NULL, "Error: Could not allocate memory for %zu keyframes!\n",
+                       capacity);
+
+            path->keyframes = keyframes;
+            path->keyframeCapacity = capacity;
+        }
+
+        path->keyframes[path->numKeyframes++] = entry.keyframe;
+        nextFrame = frame + 1;
+    }
+
+    checkError(path->numKeyframes == 0, "Error: Camera path \"%s\" has no keyframes!\n",
+               fileName);
+}
+
+// Last edit of the camera, or of the object or light at index, earlier in delta, NULL if none
+static const SceneEdit *previousEdit(const SceneDelta *delta, EditKind kind, size_t index) {
+    for (size_t edit = delta->numEdits; edit > 0; edit--) {
+        const SceneEdit *previous = &delta->edits[edit - 1];
+
+        if (previous->kind == kind && (kind == EDIT_CAMERA || previous->index == index))
+            return previous;
+    }
+
+    return NULL;
+}
+
+void parseSceneDelta(const char *text, size_t length, const char *fileName,
+                     const SceneData *sceneData, SceneDelta *delta) {
+    Scanner scanner = { text, text, text + length, fileName };
+
+    delta->numEdits = 0;
+
+    for (skipSpace(&scanner); scanner.cursor < scanner.end; skipSpace(&scanner)) {
+        const char *start = scanner.cursor;
+        const EntryType *type = scanEntryType(&scanner, entryTypes, NUM_ENTRY_TYPES(entryTypes),
+                                              "camera, plane, sphere, quadric or light");
+
+        // Edits start from the current values, including those of earlier edits of the same
+        //   thing in the delta, so they only need the properties that change
+        SceneEntry entry = {};
+        SceneEdit edit = {};
+        const SceneEdit *previous = NULL;
+        entry.camera = sceneData->camera;
+
+        if (type->kind == ENTRY_LIGHT) {
+            edit.kind = EDIT_LIGHT;
+            edit.index = scanIndex(&scanner);
+
+            if (edit.index >= sceneData->numLights)
+                parseError(&scanner, start, "There is no light %zu", edit.index);
+
+            previous = previousEdit(delta, EDIT_LIGHT, edit.index);
+            entry.light = previous ? previous->light : sceneData->lights[edit.index];
+            entry.hasDirection = entry.light.type == SPOT;
+        }
+        else if (type->kind != ENTRY_CAMERA) {
+            edit.kind = EDIT_OBJECT;
+            edit.index = scanIndex(&scanner);
+
+            if (edit.index >= sceneData->numObjects)
+                parseError(&scanner, start, "There is no object %zu", edit.index);
+
+            previous = previousEdit(delta, EDIT_OBJECT, edit.index);
+            entry.object = previous ? previous->object : sceneData->objects[edit.index];
+
+            // Any point on the plane keeps it in place when only its normal changes
+            if (entry.object.type == PLANE) {
+                float *normal = entry.object.pn;
+                float offset = -entry.object.d / f3_dot(normal, normal);
+
+                for (int axis = 0; axis < 3; axis++)
+                    entry.planePosition[axis] = normal[axis] * offset;
+            }
+        }
+        else {
+            previous = previousEdit(delta, EDIT_CAMERA, 0);
+            entry.camera = previous ? previous->camera : sceneData->camera;
+        }
+
+        SceneEntry current = entry;
+        scanProperties(&scanner, type, &entry);
+        checkEntry(&scanner, start, type, &entry);
+        finishEntry(type, &entry);
+
+        if (edit.kind == EDIT_OBJECT) {
+            const Object *object = previous ? &previous->object : &sceneData->objects[edit.index];
+
+            if (entry.object.type != object->type)
+                parseError(&scanner, start, "Object %zu is not a %s", edit.index, type->name);
+
+            // Recomputing the offset of an unmoved plane could round it differently
+            if (object->type == PLANE && f3_equals(entry.object.pn, current.object.pn, 0)
+                && f3_equals(entry.planePosition, current.planePosition, 0))
+                entry.object.d = object->d;
+        }
+
+        edit.object = entry.object;
+        edit.light = entry.light;
+        edit.camera = entry.camera;
+
+        if (delta->numEdits == delta->editCapacity) {
+            size_t capacity = delta->editCapacity > 0 ? 2 * delta->editCapacity
+                                                      : DELTA_INITIAL_CAPACITY;
+            SceneEdit *edits = realloc(delta->edits, capacity * sizeof(SceneEdit));
+            checkError(edits == NULL, "Error: Could not allocate memory for %zu edits!\n",
+                       capacity);
+
+            delta->edits = edits;
+            delta->editCapacity = capacity;
+        }
+
+        delta->edits[delta->numEdits++] = edit;
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+
+struct CameraPath;
+struct SceneData;
+struct SceneDelta;
+
+/**
+ Parse the text scene in text (length bytes, not necessarily NUL-terminated) into sceneData, then
+ compile it with compileScene(). An entry is its type (camera, plane, sphere, quadric or light), a
+ comma, and comma-separated "name: value" properties in any order, where a value is a number or a
+ bracketed list of numbers; the entry ends at the first value not followed by a comma. Text from a
+ # to the end of the line is ignored. Exits with the line and column of the first error, using
+ fileName to name the file.
+ */
+void parseSceneInput(const char *text, size_t length, const char *fileName,
+                     struct SceneData *sceneData);
+
+/**
+ Parse the camera path in text into path, in the syntax of parseSceneInput(). Its only entry type
+ is keyframe, with the properties frame (a whole number, by default the previous keyframe's plus
+ one), position, target and up; properties left out keep the previous keyframe's values, which
+ start as the default view from the origin down -z. Frames must increase from one keyframe to the
+ next.
+ */
+void parseCameraPath(const char *text, size_t length, const char *fileName,
+                     struct CameraPath *path);
+
+/**
+ Parse the scene edits in text into delta, without changing sceneData. Edits use the syntax of
+ parseSceneInput(), except that the type of an object or light entry is followed by its index
+ (counting objects of every type together, from 0, in the order they were given), as in
+ "sphere 2, radius: 1.5". Properties left out keep their current values, including those set by
+ earlier entries of the same camera, object or light in text. A camera entry takes no index.
+ */
+void parseSceneDelta(const char *text, size_t length, const char *fileName,
+                     const struct SceneData *sceneData, struct SceneDelta *delta);
@@ -0,0 +1,423 @@
+#include "partial.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "raytrace.h"
+#include "utils.h"
+
+// Header of a partial image being merged
+typedef struct PartialHeader {
+    unsigned int format, width, height;
+    Tile region;
+    int frameWidth, frameHeight;
+
+    // Text of the tiles comment, NULL for a plain region
+    char *tileList;
+} PartialHeader;
+
+void formatRegionComment(char *comment, size_t size, const Tile *region, int frameWidth,
+                         int frameHeight) {
+    snprintf(comment, size, "# region %i %i %i %i of %i %i\n", region->x, region->y,
+             region->width, region->height, frameWidth, frameHeight);
+}
+
+// Tile number at *text, advancing it past the digits
+static long scanTileNumber(const char **text, const char *list, long numTiles) {
+    char *end;
+    long tile = strtol(*text, &end, 10);
+
+    checkError(!isdigit((unsigned char) **text) || tile >= numTiles,
+               "Error: Invalid tile list \"%s\" for a frame of %li tiles!\n", list, numTiles);
+    *text = end;
+
+    return tile;
+}
+
+bool *parseTileList(const char *list, int width, int height) {
+    long numTiles = (long) ((width + TILE_SIZE - 1) / TILE_SIZE) * ((height + TILE_SIZE - 1)
+                                                                    / TILE_SIZE);
+    bool *tiles = calloc(numTiles, sizeof(bool));
+    checkError(tiles == NULL, "Error: Could not allocate memory for %li tiles!\n", numTiles);
+
+    const char *text = list;
+
+    while (true) {
+        long first = scanTileNumber(&text, list, numTiles), last = first;
+
+        if (*text == '-') {
+            text++;
+            last = scanTileNumber(&text, list, numTiles);
+            checkError(last < first, "Error: Invalid tile range in \"%s\"!\n", list);
+        }
+
+        for (long tile = first; tile <= last; tile++)
+            tiles[tile] = true;
+
+        if (*text == '\0')
+            return tiles;
+
+        checkError(*text != ',', "Error: Invalid tile list \"%s\"!\n", list);
+        text++;
+    }
+}
+
+char *formatTileList(const bool *tiles, int width, int height) {
+    long numTiles = (long) ((width + TILE_SIZE - 1) / TILE_SIZE) * ((height + TILE_SIZE - 1)
+                                                                    / TILE_SIZE);
+    char *list = NULL;
+    size_t listSize = 0;
+    FILE *text = open_memstream(&list, &listSize);
+    checkError(text == NULL, "Error: Could not allocate memory for a tile list!\n");
+
+    const char *separator = "";
+
+    for (long first = 0; first < numTiles; first++) {
+        if (!tiles[first])
+            continue;
+
+        long last = first;
+
+        while (last + 1 < numTiles && tiles[last + 1])
+            last++;
+
+        fprintf(text, "%s%li", separator, first);
+        separator = ",";
+
+        if (last > first)
+            fprintf(text, "-%li", last);
+
+        first = last;
+    }
+
+    checkError(fclose(text) != 0, "Error: Could not allocate memory for a tile list!\n");
+
+    return list;
+}
+
+void beginRegionStream(RegionStream *stream, const Tile *region, int frameWidth, int frameHeight,
+                       const char *tileList, int bandRows, int format, const char *outputFilename,
+                       TileScheduler *scheduler) {
+    size_t commentSize = REGION_COMMENT_LENGTH + (tileList ? strlen(tileList) : 0)
+                         + sizeof("# tiles \n");
+    char *comment = malloc(commentSize);
+    checkError(comment == NULL, "Error: Could not allocate memory for the image header!\n");
+
+    formatRegionComment(comment, commentSize, region, frameWidth, frameHeight);
+
+    if (tileList) {
+        size_t regionLength = strlen(comment);
+        snprintf(comment + regionLength, commentSize - regionLength, "# tiles %s\n", tileList);
+    }
+
+    stream->region = *region;
+    stream->frameWidth = frameWidth;
+    stream->rows = malloc((size_t) region->width * bandRows * sizeof(Pixel));
+    checkError(stream->rows == NULL, "Error: Could not allocate memory for %i rows!\n", bandRows);
+
+    beginImageStream(&stream->stream, region->width, region->height, 255, format, comment,
+                     outputFilename, scheduler);
+    free(comment);
+}
+
+void writeRegionBand(void *context, const Pixel *rows, int firstRow, int numRows) {
+    RegionStream *stream = context;
+    int regionWidth = stream->region.width;
+
+    (void) firstRow;
+
+    for (int row = 0; row < numRows; row++) {
+        memcpy(&stream->rows[(size_t) row * regionWidth],
+               &rows[(size_t) row * stream->frameWidth + stream->region.x],
+               regionWidth * sizeof(Pixel));
+    }
+
+    writeImageRows(&stream->stream, stream->rows, numRows);
+}
+
+void endRegionStream(RegionStream *stream) {
+    endImageStream(&stream->stream);
+    free(stream->rows);
+    stream->rows = NULL;
+}
+
+void renderRegionImage(SceneData *sceneData, const Tile *region, int bandRows,
+                       TileScheduler *scheduler, int format, const char *outputFilename) {
+    RegionStream stream;
+    beginRegionStream(&stream, region, sceneData->camera.imageWidth,
+                      sceneData->camera.imageHeight, NULL, bandRows, format, outputFilename,
+                      scheduler);
+
+    renderSceneRegion(sceneData, region, bandRows, scheduler, writeRegionBand, &stream);
+
+    endRegionStream(&stream);
+}
+
+void renderTileImage(SceneData *sceneData, const bool *tiles, const char *tileList,
+                     TileScheduler *scheduler, int format, const char *outputFilename) {
+    int width = sceneData->camera.imageWidth;
+    int height = sceneData->camera.imageHeight;
+    int columns = (width + TILE_SIZE - 1) / TILE_SIZE, rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+    size_t numPixels = (size_t) width * height, numTiles = (size_t) columns * rows;
+
+    // Rectangle of tiles around the listed ones
+    int firstColumn = columns, endColumn = 0, firstRow = rows, endRow = 0;
+
+    for (int row = 0; row < rows; row++) {
+        for (int column = 0; column < columns; column++) {
+            if (tiles[(size_t) row * columns + column]) {
+                firstColumn = column < firstColumn ? column : firstColumn;
+                endColumn = column + 1 > endColumn ? column + 1 : endColumn;
+                firstRow = row < firstRow ? row : firstRow;
+                endRow = row + 1 > endRow ? row + 1 : endRow;
+            }
+        }
+    }
+
+    // Untouched pages of the frame are never committed, so only the rendered rows take memory
+    Pixel *image = calloc(numPixels, sizeof(Pixel));
+    const bool *renderedTiles = tiles;
+    bool *dilatedTiles = NULL;
+    uint32_t *objectIds = NULL;
+    bool *edges = NULL;
+    checkError(image == NULL, "Error: Could not allocate memory for the image!\n");
+
+    // Finding the edges of the listed tiles needs the first pass of the tiles around them
+    if (sceneData->maxSamples > 1) {
+        dilatedTiles = malloc(numTiles * sizeof(bool));
+        objectIds = calloc(numPixels, sizeof(uint32_t));
+        edges = calloc(numPixels, sizeof(bool));
+        checkError(!dilatedTiles || !objectIds || !edges,
+                   "Error: Could not allocate memory for anti-aliasing!\n");
+
+        dilateTiles(tiles, columns, rows, dilatedTiles);
+        renderedTiles = dilatedTiles;
+    }
+
+    renderSceneTiles(sceneData, image, NULL, objectIds, edges, renderedTiles, NULL, scheduler);
+
+    free(dilatedTiles);
+    free(objectIds);
+    free(edges);
+
+    Tile region = { firstColumn * TILE_SIZE, firstRow * TILE_SIZE, 0, 0 };
+    region.width = (endColumn * TILE_SIZE < width ? endColumn * TILE_SIZE : width) - region.x;
+    region.height = (endRow * TILE_SIZE < height ? endRow * TILE_SIZE : height) - region.y;
+
+    // Pixels of tiles left out of the list are written black
+    for (int row = firstRow; row < endRow; row++) {
+        for (int column = firstColumn; column < endColumn; column++) {
+            if (tiles[(size_t) row * columns + column])
+                continue;
+
+            int tileWidth = width - column * TILE_SIZE < TILE_SIZE ? width - column * TILE_SIZE
+                                                                   : TILE_SIZE;
+            int tileEnd = (row + 1) * TILE_SIZE < height ? (row + 1) * TILE_SIZE : height;
+
+            for (int y = row * TILE_SIZE; y < tileEnd; y++) {
+                memset(&image[(size_t) y * width + column * TILE_SIZE], 0,
+                       tileWidth * sizeof(Pixel));
+            }
+        }
+    }
+
+    RegionStream stream;
+    beginRegionStream(&stream, &region, width, height, tileList, TILE_SIZE, format,
+                      outputFilename, scheduler);
+
+    for (int y = region.y; y < region.y + region.height; y += TILE_SIZE) {
+        int numRows = region.y + region.height - y < TILE_SIZE ? region.y + region.height - y
+                                                               : TILE_SIZE;
+        writeRegionBand(&stream, &image[(size_t) y * width], y, numRows);
+    }
+
+    endRegionStream(&stream);
+    free(image);
+}
+
+// Read the header of the partial image in file up to its first pixel
+static void readPartialHeader(FILE *file, const char *fileName, PartialHeader *header) {
+    *header = (PartialHeader) {};
+    header->frameWidth = -1;
+
+    int magic = getc(file);
+    header->format = getc(file) - '0';
+    checkError(magic != 'P' || (header->format != 3 && header->format != 6),
+               "Error: \"%s\" is not a P3 or P6 image!\n", fileName);
+
+    unsigned int values[3];
+    char *line = NULL;
+    size_t lineCapacity = 0;
+
+    for (int value = 0; value < 3;) {
+        int character = getc(file);
+
+        if (isspace(character))
+            continue;
+
+        if (character == '#') {
+            checkError(getline(&line, &lineCapacity, file) < 0,
+                       "Error: The header of \"%s\" is truncated!\n", fileName);
+            line[strcspn(line, "\r\n")] = '\0';
+
+            Tile region;
+            int frameWidth, frameHeight;
+
+            if (sscanf(line, " region %d %d %d %d of %d %d", &region.x, &region.y, &region.width,
+                       &region.height, &frameWidth, &frameHeight) == 6) {
+                header->region = region;
+                header->frameWidth = frameWidth;
+                header->frameHeight = frameHeight;
+            }
+
+            if (strncmp(line, " tiles ", 7) == 0) {
+                free(header->tileList);
+                header->tileList = strdup(line + 7);
+                checkError(header->tileList == NULL,
+                           "Error: Could not allocate memory for a tile list!\n");
+            }
+
+            continue;
+        }
+
+        ungetc(character, file);
+        checkError(fscanf(file, "%u", &values[value++]) != 1,
+                   "Error: The header of \"%s\" is malformed!\n", fileName);
+    }
+
+    free(line);
+
+    // Exactly one whitespace character separates the header from the pixels
+    checkError(!isspace(getc(file)), "Error: The header of \"%s\" is malformed!\n", fileName);
+
+    header->width = values[0];
+    header->height = values[1];
+
+    const Tile *region = &header->region;
+    checkError(header->frameWidth < 0, "Error: \"%s\" has no region comment!\n", fileName);
+    checkError(values[2] != 255, "Error: Max color value of \"%s\" is not 255!\n", fileName);
+    checkError(region->x < 0 || region->y < 0 || region->width < 1 || region->height < 1
+               || region->width > header->frameWidth - region->x
+               || region->height > header->frameHeight - region->y
+               || header->width != (unsigned int) region->width
+               || header->height != (unsigned int) region->height,
+               "Error: The region of \"%s\" does not match its frame or size!\n", fileName);
+}
+
+// Read a row of the partial image into row
+static void readPartialRow(FILE *file, const char *fileName, const PartialHeader *header,
+                           Pixel *row) {
+    if (header->format == 6) {
+        checkError(fread(row, sizeof(Pixel), header->width, file) != header->width,
+                   "Error: \"%s\" is truncated!\n", fileName);
+        return;
+    }
+
+    for (unsigned int x = 0; x < header->width; x++) {
+        unsigned int channels[3];
+
+        checkError(fscanf(file, "%u %u %u", &channels[0], &channels[1], &channels[2]) != 3
+                   || channels[0] > 255 || channels[1] > 255 || channels[2] > 255,
+                   "Error: \"%s\" is truncated or corrupt!\n", fileName);
+
+        row[x] = (Pixel) { channels[0], channels[1], channels[2] };
+    }
+}
+
+void mergePartialImages(const char *const *partFileNames, int numParts, int format,
+                        const char *outputFilename) {
+    int width = 0, height = 0;
+    Pixel *image = NULL, *row = NULL;
+    bool *covered = NULL;
+    MappedPPM mappedPpm = {};
+
+    for (int part = 0; part < numParts; part++) {
+        const char *fileName = partFileNames[part];
+        FILE *file = fopen(fileName, "rb");
+        checkError(file == NULL, "Error: Could not open partial image \"%s\"!\n", fileName);
+
+        PartialHeader header;
+        readPartialHeader(file, fileName, &header);
+
+        // The first part gives the size of the frame
+        if (image == NULL) {
+            width = header.frameWidth;
+            height = header.frameHeight;
+
+            if (format == 6)
+                image = mapImage(&mappedPpm, width, height, 255, outputFilename);
+
+            // Text images, and outputs that cannot be mapped, are written once assembled
+            if (image == NULL) {
+                image = calloc((size_t) width * height, sizeof(Pixel));
+                checkError(image == NULL, "Error: Could not allocate memory for the image!\n");
+            }
+
+            covered = calloc((size_t) width * height, sizeof(bool));
+            checkError(covered == NULL, "Error: Could not allocate memory for the image!\n");
+        }
+
+        checkError(header.frameWidth != width || header.frameHeight != height,
+                   "Error: \"%s\" is part of a %ix%i frame, not %ix%i!\n", fileName,
+                   header.frameWidth, header.frameHeight, width, height);
+
+        bool *tiles = header.tileList ? parseTileList(header.tileList, width, height) : NULL;
+        int columns = (width + TILE_SIZE - 1) / TILE_SIZE;
+        const Tile *region = &header.region;
+
+        row = realloc(row, header.width * sizeof(Pixel));
+        checkError(row == NULL, "Error: Could not allocate memory for a row!\n");
+
+        for (int y = region->y; y < region->y + region->height; y++) {
+            readPartialRow(file, fileName, &header, row);
+
+            // Copied a tile wide segment at a time, leaving out tiles that are not in the list
+            for (int x = region->x; x < region->x + region->width;) {
+                int segmentEnd = (x / TILE_SIZE + 1) * TILE_SIZE;
+                segmentEnd = segmentEnd < region->x + region->width ? segmentEnd
+                                                                    : region->x + region->width;
+
+                if (!tiles || tiles[(size_t) (y / TILE_SIZE) * columns + x / TILE_SIZE]) {
+                    size_t index = (size_t) y * width + x;
+
+                    memcpy(&image[index], &row[x - region->x], (segmentEnd - x) * sizeof(Pixel));
+                    memset(&covered[index], true, segmentEnd - x);
+                }
+
+                x = segmentEnd;
+            }
+        }
+
+        free(tiles);
+        free(header.tileList);
+        fclose(file);
+    }
+
+    free(row);
+
+    size_t numMissing = 0;
+
+    for (size_t index = 0; index < (size_t) width * height; index++)
+        numMissing += !covered[index];
+
+    free(covered);
+    checkError(numMissing > 0, "Error: %zu pixels of the %ix%i frame are in no partial image!\n",
+               numMissing, width, height);
+
+    if (mappedPpm.mapping) {
+        unmapImage(&mappedPpm);
+    }
+    else {
+        PPM ppm;
+        ppm.format = format;
+        ppm.maxColorVal = 255;
+        ppm.width = width;
+        ppm.height = height;
+        ppm.imageData = image;
+
+        writeImage(ppm, format, outputFilename);
+        free(image);
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ppmrw.h"
+#include "scheduler.h"
+
+// Rows of a region rendered at a time unless --stream gives a band height
+#define PARTIAL_BAND_ROWS 256
+
+// Room for the region comment line of a partial image
+#define REGION_COMMENT_LENGTH 96
+
+struct SceneData;
+
+/*
+ Partial images are PPMs of part of a frame, assembled into the whole frame by
+ mergePartialImages(). Right after the magic number their header has the comment lines
+
+   # region X Y WIDTH HEIGHT of FRAME_WIDTH FRAME_HEIGHT
+   # tiles LIST
+
+ The first gives the rectangle of the frame the image covers. The second is only there when the
+ image holds a tile list (see parseTileList()), and names the tiles rendered inside that
+ rectangle; its other pixels are black.
+ */
+
+/**
+ Partial image of a region written a band of rows at a time, as renderSceneRegion() hands them over
+ */
+typedef struct RegionStream {
+    PPMStream stream;
+    Tile region;
+    int frameWidth;
+
+    // Columns of the region from the band being written
+    Pixel *rows;
+} RegionStream;
+
+/**
+ Write the region comment line of a partial image covering region of a frameWidth x frameHeight
+ frame into comment.
+ */
+void formatRegionComment(char *comment, size_t size, const Tile *region, int frameWidth,
+                         int frameHeight);
+
+/**
+ Parse a list of comma-separated tile numbers and ranges such as "0-15,20", numbering the
+ TILE_SIZE tiles of a width x height frame row by row from 0. Returns a mask with an entry per
+ tile, to be freed by the caller. Exits with an error if the list is malformed or names a tile
+ outside the frame.
+ */
+bool *parseTileList(const char *list, int width, int height);
+
+/**
+ Inverse of parseTileList(): the marked tiles of a width x height frame as a list of numbers and
+ ranges, empty when none are marked. The list is to be freed by the caller.
+ */
+char *formatTileList(const bool *tiles, int width, int height);
+
+/**
+ Create outputFilename as a partial image of region of a frameWidth x frameHeight frame, holding
+ the tiles in tileList unless it is NULL, ready for bands of at most bandRows rows from
+ renderSceneRegion() to be passed to writeRegionBand().
+ */
+void beginRegionStream(RegionStream *stream, const Tile *region, int frameWidth, int frameHeight,
+                       const char *tileList, int bandRows, int format,
+                       const char *outputFilename, TileScheduler *scheduler);
+
+/**
+ BandFunction appending the region columns of a band to the RegionStream in context
+ */
+void writeRegionBand(void *context, const Pixel *rows, int firstRow, int numRows);
+
+void endRegionStream(RegionStream *stream);
+
+/**
+ Render region of the frame of sceneData in bands of bandRows rows, writing them to
+ outputFilename as a partial image of the given format.
+ */
+void renderRegionImage(struct SceneData *sceneData, const Tile *region, int bandRows,
+                       TileScheduler *scheduler, int format, const char *outputFilename);
+
+/**
+ Render the tiles of the frame of sceneData marked in tiles, parsed from tileList, writing the
+ rectangle around them to outputFilename as a partial image of the given format.
+ */
+void renderTileImage(struct SceneData *sceneData, const bool *tiles, const char *tileList,
+                     TileScheduler *scheduler, int format, const char *outputFilename);
+
+/**
+ Assemble the numParts partial images in partFileNames into their whole frame, written to
+ outputFilename as a PPM of the given format. Later parts overwrite earlier ones where they
+ overlap. Exits with an error if a part is not a partial image, the parts belong to frames of
+ different sizes, or some pixel of the frame is in none of them.
+ */
+void mergePartialImages(const char *const *partFileNames, int numParts, int format,
+                        const char *outputFilename);
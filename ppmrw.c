@@ -1,14 +1,34 @@
 #include "ppmrw.h"
 
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "scheduler.h"
 #include "utils.h"
 
+// Longest P3 text of one pixel: three channels of up to three digits, each on its own line
+#define P3_PIXEL_CHARS 12
+
+// P3 text formatted before it is written, so the text of a whole image is never held in memory
+#define P3_BATCH_BYTES (64 << 20)
+
+// Rows of P3 text being formatted, TILE_SIZE rows per slot
+typedef struct P3Batch {
+    const Pixel *rows;
+    unsigned int width;
+    char *text;
+    size_t *lengths;
+} P3Batch;
+
 void skipWhitespace(FILE *file) {
     char curChar = getc(file);
 
@@ -136,30 +156,330 @@ PPM readImage(const char *inputFilename) {
     return ppm;
 }
 
-void writeImage(PPM ppm, int newFmt, const char *outputFilename) {
-    FILE *outputFile = fopen(outputFilename, "w");
+// Set up stream to write the image to file, starting with its header
+static void startImageStream(PPMStream *stream, FILE *file, unsigned int width,
+                             unsigned int height, unsigned int maxColorVal, int newFmt,
+                             const char *comment, TileScheduler *scheduler) {
+    stream->file = file;
+    stream->format = newFmt;
+    stream->width = width;
+    stream->height = height;
+    stream->rowsWritten = 0;
+    stream->scheduler = scheduler;
+    stream->outputFilename = NULL;
+    stream->temporaryFilename = NULL;
 
-    fprintf(outputFile,
+    fprintf(stream->file,
             "P%u\n"
+            "%s"
             "%u %u\n"
             "%u\n",
-            newFmt, ppm.width, ppm.height, ppm.maxColorVal);
+            newFmt, comment ? comment : "", width, height, maxColorVal);
+}
 
-    if (newFmt == 3) {
-        // Write ascii image data
-        for (unsigned int index = 0; index < ppm.width * ppm.height; index++) {
-            Pixel curPixel = ppm.imageData[index];
-            
-            fprintf(outputFile, "%u\n%u\n%u\n", curPixel.r, curPixel.g, curPixel.b);
+void beginImageStream(PPMStream *stream, unsigned int width, unsigned int height,
+                      unsigned int maxColorVal, int newFmt, const char *comment,
+                      const char *outputFilename, TileScheduler *scheduler) {
+    checkError(newFmt != 3 && newFmt != 6, "Error: Output PPM format is not 3 or 6!\n");
+
+    FILE *file = fopen(outputFilename, "w");
+    checkError(file == NULL, "Error: Could not open output file \"%s\"!\n", outputFilename);
+
+    startImageStream(stream, file, width, height, maxColorVal, newFmt, comment, scheduler);
+}
+
+// Write value and a newline to text, returning the end of what was written
+static inline char *formatChannel(char *text, unsigned int value) {
+    if (value >= 100) {
+        *text++ = '0' + value / 100;
+        *text++ = '0' + value / 10 % 10;
+    }
+    else if (value >= 10) {
+        *text++ = '0' + value / 10;
+    }
+
+    *text++ = '0' + value % 10;
+    *text++ = '\n';
+
+    return text;
+}
+
+static void formatTextTile(void *context, const Tile *tile) {
+    P3Batch *batch = context;
+    size_t slot = tile->y / TILE_SIZE;
+    size_t numPixels = (size_t) tile->height * batch->width;
+    const Pixel *pixels = batch->rows + (size_t) tile->y * batch->width;
+    char *start = batch->text + slot * TILE_SIZE * batch->width * P3_PIXEL_CHARS;
+    char *text = start;
+
+    for (size_t index = 0; index < numPixels; index++) {
+        text = formatChannel(text, pixels[index].r);
+        text = formatChannel(text, pixels[index].g);
+        text = formatChannel(text, pixels[index].b);
+    }
+
+    batch->lengths[slot] = text - start;
+}
+
+// Format rows as P3 text in slots of TILE_SIZE rows, in parallel when there is a scheduler, and
+//   write the slots out in order
+static void writeTextRows(PPMStream *stream, const Pixel *rows, unsigned int numRows) {
+    size_t slotBytes = (size_t) TILE_SIZE * stream->width * P3_PIXEL_CHARS;
+    size_t batchSlots = P3_BATCH_BYTES / slotBytes;
+    size_t neededSlots = (numRows + TILE_SIZE - 1) / TILE_SIZE;
+
+    if (batchSlots < 1)
+        batchSlots = 1;
+    if (batchSlots > neededSlots)
+        batchSlots = neededSlots;
+
+    P3Batch batch;
+    batch.width = stream->width;
+    batch.text = malloc(batchSlots * slotBytes);
+    batch.lengths = malloc(batchSlots * sizeof(size_t));
+    checkError(batch.text == NULL || batch.lengths == NULL,
+               "Error: Could not allocate memory to format the output PPM!\n");
+
+    unsigned int batchRows = batchSlots * TILE_SIZE;
+
+    for (unsigned int firstRow = 0; firstRow < numRows; firstRow += batchRows) {
+        unsigned int count = numRows - firstRow < batchRows ? numRows - firstRow : batchRows;
+        size_t numSlots = (count + TILE_SIZE - 1) / TILE_SIZE;
+        batch.rows = rows + (size_t) firstRow * stream->width;
+
+        if (stream->scheduler) {
+            runTiles(stream->scheduler, 1, count, formatTextTile, &batch);
+        }
+        else {
+            for (size_t slot = 0; slot < numSlots; slot++) {
+                int slotRow = slot * TILE_SIZE;
+                Tile tile = { 0, slotRow, 1, count - slotRow < TILE_SIZE ? count - slotRow
+                                                                         : TILE_SIZE };
+                formatTextTile(&batch, &tile);
+            }
         }
+
+        for (size_t slot = 0; slot < numSlots; slot++)
+            fwrite(batch.text + slot * slotBytes, 1, batch.lengths[slot], stream->file);
     }
-    else if (newFmt == 6) { // format = 6
-        // Write binary image data
-        fwrite(ppm.imageData, sizeof(Pixel), ppm.width * ppm.height, outputFile);
+
+    free(batch.text);
+    free(batch.lengths);
+}
+
+void writeImageRows(PPMStream *stream, const Pixel *rows, unsigned int numRows) {
+    size_t numPixels = (size_t) stream->width * numRows;
+
+    checkError(numRows > stream->height - stream->rowsWritten,
+               "Error: Too many rows written to a %ux%u PPM!\n", stream->width, stream->height);
+
+    if (stream->format == 3) {
+        // Write ascii image data
+        writeTextRows(stream, rows, numRows);
     }
     else {
-        checkError(false, "Error: Output PPM format is not 3 or 6!");
+        // Write binary image data
+        fwrite(rows, sizeof(Pixel), numPixels, stream->file);
+    }
+
+    stream->rowsWritten += numRows;
+}
+
+void endImageStream(PPMStream *stream) {
+    checkError(stream->rowsWritten != stream->height,
+               "Error: Only %u of %u rows were written to the PPM!\n", stream->rowsWritten,
+               stream->height);
+
+    // Closed even when that fails, so abortImageStream() only has the temporary file left
+    bool closed = fclose(stream->file) == 0;
+    stream->file = NULL;
+    checkError(!closed, "Error: Could not write the output PPM!\n");
+
+    if (stream->temporaryFilename != NULL) {
+        checkError(rename(stream->temporaryFilename, stream->outputFilename) != 0,
+                   "Error: Could not replace %s!\n", stream->outputFilename);
+        free(stream->temporaryFilename);
+        stream->temporaryFilename = NULL;
+    }
+}
+
+void abortImageStream(PPMStream *stream) {
+    if (stream->file != NULL)
+        fclose(stream->file);
+
+    if (stream->temporaryFilename != NULL) {
+        unlink(stream->temporaryFilename);
+        free(stream->temporaryFilename);
+    }
+
+    stream->file = NULL;
+    stream->temporaryFilename = NULL;
+}
+
+void writeImage(PPM ppm, int newFmt, const char *outputFilename) {
+    writeImageParallel(ppm, newFmt, outputFilename, NULL);
+}
+
+void writeImageParallel(PPM ppm, int newFmt, const char *outputFilename,
+                        TileScheduler *scheduler) {
+    PPMStream stream;
+
+    beginImageStream(&stream, ppm.width, ppm.height, ppm.maxColorVal, newFmt, NULL,
+                     outputFilename, scheduler);
+    writeImageRows(&stream, ppm.imageData, ppm.height);
+    endImageStream(&stream);
+}
+
+// File next to outputFilename that an image is written to before it replaces outputFilename
+static char *temporaryName(const char *outputFilename) {
+    size_t length = strlen(outputFilename);
+    char *temporaryFilename = malloc(length + sizeof(".tmp"));
+    checkError(!temporaryFilename, "Error: Could not allocate memory for a file name!\n");
+
+    memcpy(temporaryFilename, outputFilename, length);
+    memcpy(temporaryFilename + length, ".tmp", sizeof(".tmp"));
+
+    return temporaryFilename;
+}
+
+void beginImageStreamAtomically(PPMStream *stream, unsigned int width, unsigned int height,
+                                unsigned int maxColorVal, int newFmt, const char *comment,
+                                const char *outputFilename, TileScheduler *scheduler) {
+    checkError(newFmt != 3 && newFmt != 6, "Error: Output PPM format is not 3 or 6!\n");
+
+    // Renaming over a link such as /dev/stdout would replace the link rather than write where it
+    //   points, and over a pipe or device would replace the node
+    struct stat fileStat;
+
+    if (lstat(outputFilename, &fileStat) == 0 && !S_ISREG(fileStat.st_mode)) {
+        beginImageStream(stream, width, height, maxColorVal, newFmt, comment, outputFilename,
+                         scheduler);
+        return;
     }
 
-    fclose(outputFile);
+    char *temporaryFilename = temporaryName(outputFilename);
+    FILE *file = fopen(temporaryFilename, "w");
+
+    if (file == NULL) {
+        free(temporaryFilename);
+        checkError(true, "Error: Could not open output file \"%s\"!\n", outputFilename);
+    }
+
+    startImageStream(stream, file, width, height, maxColorVal, newFmt, comment, scheduler);
+    stream->outputFilename = outputFilename;
+    stream->temporaryFilename = temporaryFilename;
+}
+
+void writeImageAtomically(PPM ppm, int newFmt, const char *outputFilename) {
+    char *temporaryFilename = temporaryName(outputFilename);
+
+    writeImage(ppm, newFmt, temporaryFilename);
+    checkError(rename(temporaryFilename, outputFilename) != 0,
+               "Error: Could not replace %s!\n", outputFilename);
+
+    free(temporaryFilename);
+}
+
+// Header of a P6 image as written by mapImage(), returning its length
+static int formatMappedHeader(char *header, size_t size, unsigned int width, unsigned int height,
+                              unsigned int maxColorVal) {
+    return snprintf(header, size,
+                    "P6\n"
+                    "%u %u\n"
+                    "%u\n",
+                    width, height, maxColorVal);
+}
+
+Pixel *mapImage(MappedPPM *mapped, unsigned int width, unsigned int height,
+                unsigned int maxColorVal, const char *outputFilename) {
+    char header[64];
+    int headerLength = formatMappedHeader(header, sizeof(header), width, height, maxColorVal);
+
+    *mapped = (MappedPPM) {};
+    mapped->size = headerLength + (size_t) width * height * sizeof(Pixel);
+
+    // Pipes and devices cannot be mapped, and renaming over a link such as /dev/stdout would
+    //   replace the link rather than write where it points
+    struct stat fileStat;
+
+    if (lstat(outputFilename, &fileStat) == 0 && !S_ISREG(fileStat.st_mode))
+        return NULL;
+
+    char *temporaryFilename = temporaryName(outputFilename);
+    int fd = open(temporaryFilename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    void *mapping = MAP_FAILED;
+
+    // Allocating every block now finds a full disk here rather than as a SIGBUS mid-render
+    if (fd >= 0 && posix_fallocate(fd, 0, mapped->size) == 0)
+        mapping = mmap(NULL, mapped->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (fd >= 0)
+        close(fd);
+
+    if (mapping == MAP_FAILED) {
+        if (fd >= 0)
+            unlink(temporaryFilename);
+
+        free(temporaryFilename);
+        return NULL;
+    }
+
+    mapped->mapping = mapping;
+    mapped->outputFilename = outputFilename;
+    mapped->temporaryFilename = temporaryFilename;
+
+    memcpy(mapped->mapping, header, headerLength);
+    mapped->imageData = (Pixel *) ((char *) mapped->mapping + headerLength);
+
+    return mapped->imageData;
+}
+
+Pixel *reopenImage(MappedPPM *mapped, unsigned int width, unsigned int height,
+                   unsigned int maxColorVal, const char *outputFilename) {
+    char header[64];
+    int headerLength = formatMappedHeader(header, sizeof(header), width, height, maxColorVal);
+
+    *mapped = (MappedPPM) {};
+    mapped->size = headerLength + (size_t) width * height * sizeof(Pixel);
+
+    char *temporaryFilename = temporaryName(outputFilename);
+    int fd = open(temporaryFilename, O_RDWR);
+
+    if (fd < 0) {
+        checkError(errno != ENOENT, "Error: Could not open \"%s\"!\n", temporaryFilename);
+        free(temporaryFilename);
+        return NULL;
+    }
+
+    struct stat fileStat;
+    checkError(fstat(fd, &fileStat) != 0 || (size_t) fileStat.st_size != mapped->size,
+               "Error: \"%s\" is not a %ux%u P6 image!\n", temporaryFilename, width, height);
+
+    mapped->mapping = mmap(NULL, mapped->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    checkError(mapped->mapping == MAP_FAILED, "Error: Could not map \"%s\"!\n",
+               temporaryFilename);
+    close(fd);
+
+    checkError(memcmp(mapped->mapping, header, headerLength) != 0,
+               "Error: \"%s\" is not a %ux%u P6 image!\n", temporaryFilename, width, height);
+    mapped->outputFilename = outputFilename;
+    mapped->temporaryFilename = temporaryFilename;
+    mapped->imageData = (Pixel *) ((char *) mapped->mapping + headerLength);
+
+    return mapped->imageData;
+}
+
+void syncImage(MappedPPM *mapped) {
+    checkError(msync(mapped->mapping, mapped->size, MS_SYNC) != 0,
+               "Error: Could not write the output PPM!\n");
+}
+
+void unmapImage(MappedPPM *mapped) {
+    checkError(munmap(mapped->mapping, mapped->size) != 0,
+               "Error: Could not write the output PPM!\n");
+    checkError(rename(mapped->temporaryFilename, mapped->outputFilename) != 0,
+               "Error: Could not replace %s!\n", mapped->outputFilename);
+
+    free(mapped->temporaryFilename);
+    *mapped = (MappedPPM) {};
 }
@@ -1,7 +1,12 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdio.h>
+
 #include "utils.h"
 
+struct TileScheduler;
+
 typedef struct PPM {
     unsigned int format, maxColorVal, width, height;
     Pixel *imageData;
@@ -20,3 +25,107 @@ PPM readImage(const char *inputFilename);
  ppm.imageData must be freed by the caller.
  */
 void writeImage(PPM ppm, int newFmt, const char *outputFilename);
+
+/**
+ Like writeImage(), but P3 text is formatted by the threads of scheduler.
+ */
+void writeImageParallel(PPM ppm, int newFmt, const char *outputFilename,
+                        struct TileScheduler *scheduler);
+
+/**
+ PPM written a band of rows at a time, so the whole image never has to be in memory
+ */
+typedef struct PPMStream {
+    FILE *file;
+    unsigned int format, width, height, rowsWritten;
+
+    // Threads formatting P3 rows, or NULL to format them on the calling thread
+    struct TileScheduler *scheduler;
+
+    // File written instead of outputFilename until endImageStream(), or NULL when the image is
+    //   written in place
+    const char *outputFilename;
+    char *temporaryFilename;
+} PPMStream;
+
+/**
+ Create outputFilename and write the header of a width x height PPM of format newFmt (3 or 6) to
+ it, ready for writeImageRows(). The header has the comment lines in comment (each starting with
+ '#' and ending with a newline) after the magic number, unless it is NULL. P3 rows are formatted
+ by the threads of scheduler when it is not NULL.
+ */
+void beginImageStream(PPMStream *stream, unsigned int width, unsigned int height,
+                      unsigned int maxColorVal, int newFmt, const char *comment,
+                      const char *outputFilename, struct TileScheduler *scheduler);
+
+/**
+ Like beginImageStream(), but the image is written to outputFilename with ".tmp" added, which
+ replaces outputFilename in endImageStream(), so a stream that fails never leaves a partial image
+ there. Links, pipes and devices, which renaming would replace, are written in place.
+ */
+void beginImageStreamAtomically(PPMStream *stream, unsigned int width, unsigned int height,
+                                unsigned int maxColorVal, int newFmt, const char *comment,
+                                const char *outputFilename, struct TileScheduler *scheduler);
+
+/**
+ Append the numRows rows of pixels in rows to the image, below the rows written so far.
+ */
+void writeImageRows(PPMStream *stream, const Pixel *rows, unsigned int numRows);
+
+/**
+ Close the image, which must have had all of its rows written.
+ */
+void endImageStream(PPMStream *stream);
+
+/**
+ Close a stream that failed before endImageStream() finished, removing its temporary file.
+ */
+void abortImageStream(PPMStream *stream);
+
+/**
+ Like writeImage(), but the image is written to a temporary file next to outputFilename that then
+ replaces it, so other processes reading outputFilename always see a complete image.
+ */
+void writeImageAtomically(PPM ppm, int newFmt, const char *outputFilename);
+
+/**
+ P6 image whose pixels live in a shared mapping of a file next to the output, so rendering into
+ imageData writes the file without a separate copy. The file replaces the output once complete.
+ */
+typedef struct MappedPPM {
+    void *mapping;
+    size_t size;
+    Pixel *imageData;
+
+    const char *outputFilename;
+    char *temporaryFilename;
+} MappedPPM;
+
+/**
+ Create a width x height P6 image for outputFilename, preallocated at its final size, and map it
+ into mapped. Its pixels start out black and are written through mapped->imageData. The image is
+ kept in outputFilename with ".tmp" added, leaving outputFilename as it was until unmapImage().
+ Returns NULL if outputFilename exists and is not a regular file (a link, pipe or device), or the
+ image cannot be created and mapped, in which case it is to be written with the stream functions
+ instead.
+ */
+Pixel *mapImage(MappedPPM *mapped, unsigned int width, unsigned int height,
+                unsigned int maxColorVal, const char *outputFilename);
+
+/**
+ Map the width x height P6 image for outputFilename that an unfinished mapImage() left behind,
+ keeping its pixels. Returns NULL if there is none, and exits with an error if the file is not
+ such an image.
+ */
+Pixel *reopenImage(MappedPPM *mapped, unsigned int width, unsigned int height,
+                   unsigned int maxColorVal, const char *outputFilename);
+
+/**
+ Wait until the pixels written so far to a mapped image are stored in its file.
+ */
+void syncImage(MappedPPM *mapped);
+
+/**
+ Unmap an image from mapImage() or reopenImage(), replacing its output file with it.
+ */
+void unmapImage(MappedPPM *mapped);
@@ -4,7 +4,19 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "animation.h"
+#include "bench.h"
+#include "bvh.h"
+#include "checkpoint.h"
+#include "daemon.h"
+#include "geometry.h"
+#include "incremental.h"
+#include "options.h"
+#include "partial.h"
 #include "ppmrw.h"
+#include "scenefile.h"
+#include "scheduler.h"
+#include "stats.h"
 #include "v3math.h"
 
 inline float raycastQuadric(float *R0, float *Rd, QuadricVariables variables, bool largestT) {
@@ -88,19 +100,21 @@ inline float raycastPlane(float *R0, float *Rd, float *pn, float d) {
     return t;
 }
 
-inline float raycastSphere(float *R0, float *Rd, float *sphereCenter, float radius,
+inline float raycastSphere(float *R0, float *Rd, float *sphereCenter, float radius2,
                            bool largestT) {
     // Used in multiple calculations
     // R0 minus center
     float R0mC[3] = {};
     f3_subtract(R0mC, R0, sphereCenter);
     
-    float B = 2 * f3_dot(Rd, R0mC); // R0mC = (X0-Xc)
-    
-    float C = f3_dot(R0mC, R0mC); // (X0-Xc)^2
-    C -= radius * radius; // Sr^2
-    
-    float discriminant = (B * B) - (4 * C);
+    // b = -B / 2 (Rd is normalized, so the quadratic's A is 1)
+    float b = -f3_dot(Rd, R0mC);
+
+    // l is the vector from the center to the closest point on the ray. Using Sr^2 - |l|^2 as the
+    //   discriminant instead of B^2 - 4C avoids catastrophic cancellation for distant rays, which
+    //   otherwise report phantom hits (Ray Tracing Gems, ch. 7)
+    float l[3] = { R0mC[0] + b * Rd[0], R0mC[1] + b * Rd[1], R0mC[2] + b * Rd[2] };
+    float discriminant = radius2 - f3_dot(l, l);
     
     // If discriminant is negative, there is no intersection
     if (discriminant < 0)
@@ -108,25 +122,44 @@ inline float raycastSphere(float *R0, float *Rd, float *sphereCenter, float radi
     
     // 1 or 2 intersections (discriminant = 0 is 1 tangential intersection)
     
-    float t0 = (-B - sqrtf(discriminant)) / 2;
+    float C = f3_dot(R0mC, R0mC) - radius2; // (X0-Xc)^2 - Sr^2
+
+    // Compute the root of larger magnitude directly and the other one from t0 * t1 = C
+    float q = b >= 0 ? b + sqrtf(discriminant) : b - sqrtf(discriminant);
+
+    if (q == 0)
+        return 0;
+
+    float t0 = b >= 0 ? C / q : q;
+    float t1 = b >= 0 ? q : C / q;
 
     if (largestT) {
         // Get the farthest intersection t (for cases in which the intersection point is outside
         //   the sphere)
-        float t1 = (-B + sqrtf(discriminant)) / 2;
         return fmaxf(t0, t1);
     }
     else {
-        // Return t0 if positive, otherwise calculate and return t1
+        // Return t0 if positive, otherwise return t1
         if (t0 >= 0)
             return t0;
         
-        // TODO: This code never runs?
-        float t1 = (-B + sqrtf(discriminant)) / 2;
         return t1;
     }
 }
 
+inline float raycastObject(Object *object, float *R0, float *Rd, bool largestT) {
+    switch (object->type) {
+        case PLANE:
+            return raycastPlane(R0, Rd, object->pn, object->d);
+        case SPHERE:
+            return raycastSphere(R0, Rd, object->center, object->radius2, largestT);
+        case QUADRIC:
+            return raycastQuadric(R0, Rd, object->quadricVars, largestT);
+    }
+
+    return 0;
+}
+
 inline void getIntersectionPoint(float *R0, float *Rd, float t, float *intersectionPoint) {
     // Ri = [xi, yi, zi] = [x0 + xd * ti ,  y0 + yd * ti,  z0 + zd * ti]
     intersectionPoint[0] = R0[0] + Rd[0] * t;
@@ -146,11 +179,11 @@ inline void calculateNormalVector(Object *object, float *point, float *Rd, float
             f3_normalize(N, N);
             break;
         case QUADRIC:
-            N[0] = (2 * object->quadricVars.a * point[0]) + (object->quadricVars.d * point[1])
+            N[0] = (object->gradientA * point[0]) + (object->quadricVars.d * point[1])
                  + (object->quadricVars.e * point[2]) + object->quadricVars.g;
-            N[1] = (2 * object->quadricVars.b * point[1]) + (object->quadricVars.d * point[0])
+            N[1] = (object->gradientB * point[1]) + (object->quadricVars.d * point[0])
                  + (object->quadricVars.f * point[2]) + object->quadricVars.h;
-            N[2] = (2 * object->quadricVars.c * point[2]) + (object->quadricVars.e * point[0])
+            N[2] = (object->gradientC * point[2]) + (object->quadricVars.e * point[0])
                  + (object->quadricVars.f * point[1]) + object->quadricVars.i;
             f3_normalize(N, N);
 
@@ -162,66 +195,66 @@ inline void calculateNormalVector(Object *object, float *point, float *Rd, float
     }
 }
 
-inline float calculateIllumination(float radialAtt, float angularAtt, float diffuseColor,
-                                   float specularColor, float lightColor, float *L, float *N,
-                                   float *R, float *V, float ns) {
+inline PixelN calculateIllumination(float attenuation, PixelN diffuseColor, PixelN specularColor,
+                                    PixelN lightColor, float *L, float *N, float *R, float *V,
+                                    const SpecularPower *specularPower) {
     float NdotL = f3_dot(N, L);
     float VdotR = f3_dot(V, R);
 
     // f1,rad_atten * f1,ang_atten * (kd * Il * (N dot L) + ks * Il * (R * V)^n)
-    float illumination = radialAtt * angularAtt
-           * (diffuseColor * lightColor * NdotL);
-
-    if (VdotR > 0 && NdotL > 0)
-        illumination += specularColor * lightColor * powf(VdotR, ns);
+    PixelN illumination = {
+        attenuation * (diffuseColor.r * lightColor.r * NdotL),
+        attenuation * (diffuseColor.g * lightColor.g * NdotL),
+        attenuation * (diffuseColor.b * lightColor.b * NdotL)
+    };
+
+    if (VdotR > 0 && NdotL > 0) {
+        float highlight = evaluateSpecular(specularPower, VdotR);
+
+        illumination.r += specularColor.r * lightColor.r * highlight;
+        illumination.g += specularColor.g * lightColor.g * highlight;
+        illumination.b += specularColor.b * lightColor.b * highlight;
+    }
 
     return illumination;
 }
 
-inline PixelN illuminate(SceneData *sceneData, Object *object, float *point,
+inline PixelN illuminate(SceneData *sceneData, Object *object, float *point, float *N,
                          PixelN reflectionColor, PixelN refractionColor) {
     // point  - the point we are coloring
     // object - the object the point is on
-    // Rd     - the view vector to the point
+    // N      - the surface normal of object at point
     
     PixelN color = { 0, 0, 0 };
     // float reflectModifier = 1 - object->refractivity; // TODO: Pre-compute? TODO: Is this wrong?
     float reflectModifier = object->reflectivity;
     // float refractModifier = 1 - reflectModifier; // Is this wrong? I have no idea anymore
     float refractModifier = object->refractivity;
-    // printf("reflect/refract: %f vs. %f\n", object->reflectivity, object->refractivity);
     float illuminationModifier = 1 - reflectModifier - refractModifier; // TODO: Clamp?
+
+    // The view vector is the same for every light
+    float V[3] = {};
+    f3_from_points(V, point, sceneData->camera.origin);
+    f3_normalize(V, V);
     
     for (size_t index = 0; index < sceneData->numLights; index++) {
         Light *light = &sceneData->lights[index];
 
-        // Light position - point
-        float Rd[3] = {};
-        f3_subtract(Rd, light->position, point);
-        f3_normalize(Rd, Rd);
-
-        float nearestT;
-        raycast(sceneData, point, Rd, object, false, &nearestT);
-
-        // Length from point to light
+        // Point to light vector, which is also the direction of the shadow ray
         float pointLightVector[3] = { 0, 0, 0 };
         f3_from_points(pointLightVector, point, light->position);
         float distance = f3_length(pointLightVector);
-        
-        if (nearestT > 0 && nearestT < distance)
-            continue;
 
-        // Point to light vector
         float L[3] = {};
         f3_normalize(L, pointLightVector);
+        
+        STATS_ADD(shadowRays, 1);
 
-        // Surface normal vector
-        float N[3] = {};
-        calculateNormalVector(object, point, Rd, &N);
+        // Skip the light if anything lies between the point and the light
+        if (raycastOccluded(sceneData, point, L, distance, object))
+            continue;
 
-        float V[3] = {};
-        f3_from_points(V, point, sceneData->camera.origin);
-        f3_normalize(V, V);
+        recordLight(index);
 
         float VO[3] = { -L[0], -L[1], -L[2] };
 
@@ -230,17 +263,12 @@ inline PixelN illuminate(SceneData *sceneData, Object *object, float *point,
         //f3_reflect(R, L, N);
         f3_normalize(R, R);
 
-        float VL[3] = {};
-
         float radialAtt = 1 / (light->radialA0 + (light->radialA1 * distance)
                                 + (light->radialA2 * (distance * distance)));
 
         float angularAtt = 0;
         if (light->type == SPOT) {
-            f3_from_points(VL, light->position, light->direction);
-            f3_normalize(VL, VL);
-
-            float VOdotVL = f3_dot(VO, VL);
+            float VOdotVL = f3_dot(VO, light->spotAxis);
 
             // If theta is zero, bad things may happen
             if (light->theta == 0) {
@@ -264,29 +292,22 @@ inline PixelN illuminate(SceneData *sceneData, Object *object, float *point,
             }
         }
         else {
-            f3_from_points(VL, light->position, point);
-            f3_normalize(VL, VL);
             angularAtt = 1;
         }
 
-        color.r += f_clamp(illuminationModifier
-                           * calculateIllumination(radialAtt, angularAtt, object->diffuseColor.r,
-                                                   object->specularColor.r, light->color.r, L, N,
-                                                   R, V, object->ns)
+        PixelN illumination = calculateIllumination(radialAtt * angularAtt, object->diffuseColor,
+                                                    object->specularColor, light->color, L, N, R,
+                                                    V, &object->specularPower);
+
+        color.r += f_clamp(illuminationModifier * illumination.r
                            + reflectModifier * reflectionColor.r
                            + refractModifier * refractionColor.r,
                          0, 1);
-        color.g += f_clamp(illuminationModifier
-                           * calculateIllumination(radialAtt, angularAtt, object->diffuseColor.g,
-                                                   object->specularColor.g, light->color.g, L, N,
-                                                   R, V, object->ns)
+        color.g += f_clamp(illuminationModifier * illumination.g
                            + reflectModifier * reflectionColor.g
                            + refractModifier * refractionColor.g,
                          0, 1);
-        color.b += f_clamp(illuminationModifier
-                           * calculateIllumination(radialAtt, angularAtt, object->diffuseColor.b,
-                                                   object->specularColor.b, light->color.b, L, N,
-                                                   R, V, object->ns)
+        color.b += f_clamp(illuminationModifier * illumination.b
                            + reflectModifier * reflectionColor.b
                            + refractModifier * refractionColor.b,
                          0, 1);
@@ -294,70 +315,73 @@ inline PixelN illuminate(SceneData *sceneData, Object *object, float *point,
 
     //color += ambient;
 
-    // printf("illuminate(): color: (%f, %f, %f); ", color.r, color.g, color.b); // TODO: Remove
-
     return color;
 }
 
-#ifndef NDEBUG
-int highestIteration = 0;
-#endif
+inline size_t traceReflections(SceneData *sceneData, Object *object, float *R0, float *Rd,
+                               float nearestT, ReflectionHit *hits) {
+    hits[0].object = object;
+    getIntersectionPoint(R0, Rd, nearestT, hits[0].point);
+    calculateNormalVector(object, hits[0].point, Rd, hits[0].normal);
+    recordHit(object - sceneData->objects, hits[0].point);
 
-// Returns reflection color
-inline void raytrace(SceneData *sceneData, Object *object, float *point, float *Rd,
-                     int iterationNum, int x, int y, PixelN *reflectionColorOut,
-                     PixelN *refractionColorOut) {
-    PixelN reflectionColor = { 0, 0, 0 };
-    PixelN refractionColor = { 0, 0, 0 };
+    size_t numHits = 1;
 
-#ifndef NDEBUG
-    if (highestIteration < iterationNum)
-        highestIteration = iterationNum;
-#endif
+    // The reflection is discarded unless the primary object is reflective
+    if (!(object->reflectivity > 0))
+        return numHits;
 
-    if (iterationNum > RECURSION_DEPTH) {
-        // Black
-        // printf("raytrace(): # of iterations exceeded maximum depth (%d vs. %d); returning black", iterationNum, RECURSION_DEPTH); // TODO: Remove
-        *reflectionColorOut = reflectionColor;
-        *refractionColorOut = refractionColor;
-        return;
-    }
-    
-    float pointNormal[3] = { 0, 0, 0 };
-    calculateNormalVector(object, point, Rd, pointNormal);
-
-    // Get reflected ray direction from intersected point
-    float reflectedRay[3] = { 0, 0, 0 };
-    f3_reflect(reflectedRay, Rd, pointNormal);
-    f3_normalize(reflectedRay, reflectedRay);
-
-    // Get the new object and new nearest t from reflected ray
-    float newNearestT;
-    Object *newObject = raycast(sceneData, point, reflectedRay, object, false, &newNearestT);
-
-    // If null, then there are no other objects to raytrace
-    if (newObject == NULL) {
-        // Black
-        // printf("raytrace(): no more objects to raytrace; returning black"); // TODO: Remove
-        *reflectionColorOut = reflectionColor;
-        *refractionColorOut = refractionColor;
-        return;
-    }
+    // Weight with which the color of the next hit reaches the pixel. Each reflective hit scales
+    //   the color behind it by its reflectivity twice (once before and once inside illuminate()).
+    float weight = 1;
+    float incidentRd[3] = { Rd[0], Rd[1], Rd[2] };
 
-    // Calculate intersection point at new object
-    float newPoint[3] = { 0, 0, 0 };
-    getIntersectionPoint(point, reflectedRay, newNearestT, &newPoint); // TODO: Remove?
+    // Hit i is found on iteration i of the chain, which is capped at RECURSION_DEPTH
+    while (numHits <= RECURSION_DEPTH) {
+        ReflectionHit *hit = &hits[numHits - 1];
+        float reflectivity = hit->object->reflectivity;
 
-    // Recursion
-    PixelN newReflectionColor, newRefractionColor;
-    raytrace(sceneData, newObject, newPoint, reflectedRay, iterationNum + 1, x, y,
-             &newReflectionColor, &newRefractionColor);
-    
-    newReflectionColor.r *= object->reflectivity;
-    newReflectionColor.g *= object->reflectivity;
-    newReflectionColor.b *= object->reflectivity;
+        // Behind a non-reflective hit the color is multiplied by zero, so stopping is exact.
+        //   Below minContribution the chain is cut short at the cost of a tiny change.
+        weight *= reflectivity * reflectivity;
+
+        if (reflectivity == 0 || fabsf(weight) < sceneData->minContribution)
+            break;
+
+        // Get reflected ray direction from intersected point
+        float reflectedRay[3] = { 0, 0, 0 };
+        f3_reflect(reflectedRay, incidentRd, hit->normal);
+        f3_normalize(reflectedRay, reflectedRay);
+
+        // Get the new object and new nearest t from reflected ray
+        STATS_ADD(reflectionRays, 1);
 
-    *reflectionColorOut = illuminate(sceneData, newObject, newPoint, newReflectionColor, newRefractionColor);
+        float newNearestT;
+        Object *newObject = raycast(sceneData, hit->point, reflectedRay, hit->object, false,
+                                    &newNearestT);
+
+        // If null, then there are no other objects to raytrace
+        if (newObject == NULL) {
+            recordReflection(hit->point, NULL);
+            break;
+        }
+
+        ReflectionHit *newHit = &hits[numHits++];
+        newHit->object = newObject;
+        getIntersectionPoint(hit->point, reflectedRay, newNearestT, newHit->point);
+        calculateNormalVector(newObject, newHit->point, reflectedRay, newHit->normal);
+        recordHit(newObject - sceneData->objects, newHit->point);
+        recordReflection(hit->point, newHit->point);
+
+        incidentRd[0] = reflectedRay[0];
+        incidentRd[1] = reflectedRay[1];
+        incidentRd[2] = reflectedRay[2];
+    }
+
+    STATS_ADD(bounces[numHits - 1], 1);
+
+    for (size_t index = 0; index < numHits; index++)
+        STATS_OBJECT_HIT(hits[index].object - sceneData->objects);
 
     // // Snell's Law
     // // puts("Snell's law!");
@@ -430,458 +454,956 @@ inline void raytrace(SceneData *sceneData, Object *object, float *point, float *
     //     float Rp = ((etai * cosi) - (etat * cost)) / ((etai * cosi) + (etat * cost));
     //     kr = (Rs * Rs + Rp * Rp) / 2;
     // }
+
+    return numHits;
 }
 
 inline Object *raycast(SceneData *sceneData, float *R0, float *Rd,
                        Object *ignoredObject, bool largestT, float *nearestT) {
-    Object *curNearestObject = NULL;
-    float curNearestT = INFINITY;
-    
-    for (size_t index = 0; index < sceneData->numObjects; index++) {
-        Object *object = &sceneData->objects[index];
-        float t = 0;
+    // Scenes with bounded objects go through the BVH or grid when one is built, which gives the
+    //   same result as the scan
+    if (sceneData->bvh.numNodes > 0)
+        return raycastBVH(sceneData, R0, Rd, ignoredObject, largestT, nearestT);
 
-        if (object == ignoredObject)
-            continue;
-        
-        switch (object->type) {
-            case PLANE:
-                t = raycastPlane(R0, Rd, object->pn, object->d);
-                break;
-            case SPHERE:
-                t = raycastSphere(R0, Rd, object->center, object->radius, largestT);
-                break;
-            case QUADRIC:
-                t = raycastQuadric(R0, Rd, object->quadricVars, largestT);
-                break;
-        }
-        
-        // If intersection exists (not 0) and is positive (in front of camera), set it to nearest
-        if (t > 0 && t < curNearestT) {
-            curNearestObject = object;
-            curNearestT = t;
-        }
+    if (sceneData->grid.numCells > 0)
+        return raycastGrid(sceneData, R0, Rd, ignoredObject, largestT, nearestT);
+
+    // Material data is only fetched for the winning object
+    uint32_t ignoredIndex = ignoredObject ? ignoredObject - sceneData->objects : GEOMETRY_NO_OBJECT;
+    uint32_t nearestIndex = raycastGeometryNearest(&sceneData->geometry, R0, Rd, ignoredIndex,
+                                                   largestT, nearestT);
+
+    return nearestIndex == GEOMETRY_NO_OBJECT ? NULL : &sceneData->objects[nearestIndex];
+}
+
+inline bool raycastOccluded(SceneData *sceneData, float *R0, float *Rd, float tMax,
+                            Object *ignoredObject) {
+    if (sceneData->bvh.numNodes > 0)
+        return raycastOccludedBVH(sceneData, R0, Rd, tMax, ignoredObject);
+
+    if (sceneData->grid.numCells > 0)
+        return raycastOccludedGrid(sceneData, R0, Rd, tMax, ignoredObject);
+
+    uint32_t ignoredIndex = ignoredObject ? ignoredObject - sceneData->objects : GEOMETRY_NO_OBJECT;
+
+    return raycastGeometryOccluded(&sceneData->geometry, R0, Rd, tMax, ignoredIndex);
+}
+
+inline void raycastPacket(SceneData *sceneData, float *R0, RayPacket *packet) {
+    if (sceneData->bvh.numNodes > 0) {
+        raycastPacketBVH(sceneData, R0, packet);
+        return;
     }
-    
-    *nearestT = curNearestT;
-    return curNearestObject;
-}
-
-inline void renderScene(SceneData *sceneData, Pixel *image) {
-    Camera camera = sceneData->camera;
-    float *R0 = camera.origin;
-    float dX = camera.vpWidth / camera.imageWidth;
-    float dY = camera.vpHeight / camera.imageHeight;
-    float PxInitial = (camera.vpWidth * -.5) + (dX * .5);
-    float PyInitial = (camera.vpHeight * .5) + (dY * .5);
-    float Pz = -camera.vpDistance;
-
-// TODO: Is this ifdef needed anymore?
-#ifdef OPENMP
-#pragma omp parallel for firstprivate(sceneData, R0, dX, dY, PxInitial, PyInitial, Pz) \
-                         private(camera)
-#endif
-    for (int y = 0; y < sceneData->camera.imageHeight; y++) {
-        camera = sceneData->camera;
 
-        //float Px = PxInitial + (dX * x);
-        float Py = PyInitial - (dY * y);
-        int rowIndex = y * camera.imageWidth;
-        
-        for (int x = 0; x < camera.imageWidth; x++) {
-            // Construct R0 and Rd vectors
-            
-            //float Py = PyInitial - (dY * y);
-            float Px = PxInitial + (dX * x);
-            float P[3] = { Px, Py, Pz };
-            
-            // P - R0
-            float Rd[3] = {};
-            f3_subtract(Rd, P, R0);
-            f3_normalize(Rd, Rd);
-            
-            float nearestT;
-            Object *nearestObject = raycast(sceneData, R0, Rd, NULL, false, &nearestT);
-
-            // printf("raycast nearestT: %f; ", nearestT); // TODO: Remove
-
-            float intersectionPoint[3] = {};
-            getIntersectionPoint(R0, Rd, nearestT, &intersectionPoint);
-
-            // printf("intersectionPoint: (%f, %f, %f); ", intersectionPoint[0], intersectionPoint[1], intersectionPoint[2]); // TODO: Remove
-            
-            // If nearestObject is not null, there is at least one intersection.
-            if (nearestObject != NULL) {
-                PixelN pixelColorN = {}, pixelColorNRefracted = {}, finalPixelColorN = {};
-
-                if (nearestObject->reflectivity > 0 || nearestObject->refractivity > 0) {
-                    raytrace(sceneData, nearestObject, intersectionPoint, Rd, 1, x, y,
-                             &pixelColorN, &pixelColorNRefracted);
-                }
+    if (sceneData->grid.numCells > 0) {
+        raycastPacketGrid(sceneData, R0, packet);
+        return;
+    }
 
-                // Only raytrace if object is reflective
-                if (nearestObject->reflectivity > 0) {
-                    pixelColorN.r *= nearestObject->reflectivity;
-                    pixelColorN.g *= nearestObject->reflectivity;
-                    pixelColorN.b *= nearestObject->reflectivity;
-                }
-                else {
-                    pixelColorN.r = 0;
-                    pixelColorN.g = 0;
-                    pixelColorN.b = 0;
-                }
+    raycastGeometryPacket(&sceneData->geometry, R0, packet);
+}
 
-                // TODO: Refraction
-                if (nearestObject->refractivity > 0) { // TODO: > 1?
-                    // pixelColorN.r *= nearestObject->refractivity;
-                }
-                else {
-                    pixelColorNRefracted.r = 0;
-                    pixelColorNRefracted.g = 0;
-                    pixelColorNRefracted.b = 0;
-                }
+inline PixelN shadePixel(SceneData *sceneData, Object *nearestObject, float *R0, float *Rd,
+                         float nearestT) {
+    ReflectionHit hits[RECURSION_DEPTH + 1];
+    size_t numHits = traceReflections(sceneData, nearestObject, R0, Rd, nearestT, hits);
 
-                // Repeat last step in raytrace function here since no more recursion (TODO)
-                finalPixelColorN = illuminate(sceneData, nearestObject, intersectionPoint,
-                                              pixelColorN, pixelColorNRefracted);
+    // TODO: Refraction
+    PixelN reflectionColor = { 0, 0, 0 }, refractionColor = { 0, 0, 0 };
 
-                // Convert from PixelN to Pixel for PPM output
-                Pixel pixelColor;
-                pixelColor.r = finalPixelColorN.r * 255;
-                pixelColor.g = finalPixelColorN.g * 255;
-                pixelColor.b = finalPixelColorN.b * 255;
+    // Shade the chain from its far end back towards the camera, each hit exactly once
+    for (size_t index = numHits - 1; index > 0; index--) {
+        float reflectivity = hits[index - 1].object->reflectivity;
 
-                image[rowIndex + x] = pixelColor;
-            }
-        }
+        reflectionColor.r *= reflectivity;
+        reflectionColor.g *= reflectivity;
+        reflectionColor.b *= reflectivity;
+
+        reflectionColor = illuminate(sceneData, hits[index].object, hits[index].point,
+                                     hits[index].normal, reflectionColor, refractionColor);
+    }
+
+    // Only reflect if the primary object is reflective
+    if (nearestObject->reflectivity > 0) {
+        reflectionColor.r *= nearestObject->reflectivity;
+        reflectionColor.g *= nearestObject->reflectivity;
+        reflectionColor.b *= nearestObject->reflectivity;
     }
+    else {
+        reflectionColor.r = 0;
+        reflectionColor.g = 0;
+        reflectionColor.b = 0;
+    }
+
+    return illuminate(sceneData, nearestObject, hits[0].point, hits[0].normal, reflectionColor,
+                      refractionColor);
 }
 
-inline void parseSceneInput(FILE *inputFile, SceneData *sceneData) {
-    Object *curObject;
-    Light *curLight;
-    size_t objIndex = 0, lightIndex = 0;
-    char inputBuf[INPUT_BUFFER_SIZE];
+inline Pixel toPixel(PixelN color) {
+    // Convert from PixelN to Pixel for PPM output
+    Pixel pixelColor;
+    pixelColor.r = color.r * 255;
+    pixelColor.g = color.g * 255;
+    pixelColor.b = color.b * 255;
+
+    return pixelColor;
+}
+
+// Normalized direction of the primary ray through the viewport position (Px, Py)
+static inline void viewportRayDirection(Camera *camera, float Px, float Py, float *Rd) {
+    float Pz = camera->vpDistance;
+
+    Rd[0] = camera->right[0] * Px + camera->up[0] * Py + camera->forward[0] * Pz;
+    Rd[1] = camera->right[1] * Px + camera->up[1] * Py + camera->forward[1] * Pz;
+    Rd[2] = camera->right[2] * Px + camera->up[2] * Py + camera->forward[2] * Pz;
+    f3_normalize(Rd, Rd);
+}
 
-    // objIndex should equal the length after this loop
-    // TODO: Check for OBJECT_LIMIT (array max length)
-    while (fscanf(inputFile, "%s", inputBuf) == 1) {
-        curObject = &sceneData->objects[objIndex];
-        curLight = &sceneData->lights[lightIndex];
+inline void primaryRayDirection(Camera *camera, float x, float y, float *Rd) {
+    float dX = camera->vpWidth / camera->imageWidth;
+    float dY = camera->vpHeight / camera->imageHeight;
+    float PxInitial = (camera->vpWidth * -.5) + (dX * .5);
+    float PyInitial = (camera->vpHeight * .5) + (dY * .5);
+
+    // Offset from the pixel center, where renderTile() shoots its single sample
+    viewportRayDirection(camera, PxInitial + (dX * (x - .5f)), PyInitial - (dY * (y - .5f)), Rd);
+}
+
+inline void resetCameraView(Camera *camera) {
+    for (int axis = 0; axis < 3; axis++) {
+        camera->origin[axis] = 0;
+        camera->right[axis] = axis == 0;
+        camera->up[axis] = axis == 1;
+        camera->forward[axis] = axis == 2 ? -1 : 0;
+    }
+}
+
+inline void setCameraView(Camera *camera, const float *position, const float *target,
+                          const float *up) {
+    float forward[3] = { target[0] - position[0], target[1] - position[1],
+                         target[2] - position[2] };
+    float upHint[3] = { up[0], up[1], up[2] };
+    float right[3];
+
+    f3_cross(right, forward, upHint);
+    checkError(!(f3_length(forward) > 0) || !(f3_length(right) > 0),
+               "Error: The camera view direction is zero or parallel to its up vector!\n");
+
+    f3_normalize(camera->forward, forward);
+    f3_normalize(camera->right, right);
+    f3_cross(camera->up, camera->right, camera->forward);
+
+    for (int axis = 0; axis < 3; axis++)
+        camera->origin[axis] = position[axis];
+}
 
-        curObject->refractivity = 0;
-        curObject->ior = 0;
+// Running total of the heatmap metric on this thread, read before and after the work for a pixel
+static inline uint64_t heatmapCounter(HeatmapMetric metric) {
+#ifdef STATS
+    if (metric == HEATMAP_RAYS)
+        return threadStats.primaryRays + threadStats.reflectionRays + threadStats.shadowRays;
 
-#ifndef NDEBUG
-        printf("parseSceneInput: \"%s\"\n", inputBuf);
+    if (metric == HEATMAP_TESTS) {
+        return threadStats.intersectionTests[PLANE] + threadStats.intersectionTests[SPHERE]
+               + threadStats.intersectionTests[QUADRIC];
+    }
 #endif
-        
-        if (strcmp(inputBuf, "camera,") == 0) {
-            const int numProperties = 2;
-            for (int i = 0; i < numProperties; i++) {
-                fscanf(inputFile, "%s", inputBuf);
-                
-                if (strcmp(inputBuf, "width:")) {
-                    fscanf(inputFile, " %f", &sceneData->camera.vpWidth);
-                }
-                else if (strcmp(inputBuf, "height:")) {
-                    // TODO: Why does this leak 3 times with ASAN?
-                    fscanf(inputFile, " %f", &sceneData->camera.vpHeight);
+
+    return readCycleCounter();
+}
+
+inline void renderTile(SceneData *sceneData, Pixel *image, int firstRow, uint32_t *objectIds,
+                       const Tile *tile, int stride, int coarserStride) {
+    Camera *camera = &sceneData->camera;
+    float *R0 = camera->origin;
+    float dX = camera->vpWidth / camera->imageWidth;
+    float dY = camera->vpHeight / camera->imageHeight;
+    float PxInitial = (camera->vpWidth * -.5) + (dX * .5);
+    float PyInitial = (camera->vpHeight * .5) + (dY * .5);
+    int tileRight = tile->x + tile->width;
+    int tileBottom = tile->y + tile->height;
+
+    // Primary rays are cast in RAY_PACKET_WIDTH x RAY_PACKET_WIDTH blocks, which share the camera
+    //   origin and nearly the same direction. Reflection and shadow rays diverge, so they are
+    //   traced one at a time.
+    RayPacket packet;
+    int pixelX[RAY_PACKET_SIZE], pixelY[RAY_PACKET_SIZE];
+
+    for (int blockY = tile->y; blockY < tileBottom; blockY += RAY_PACKET_WIDTH) {
+        int blockBottom = blockY + RAY_PACKET_WIDTH < tileBottom ? blockY + RAY_PACKET_WIDTH
+                                                                 : tileBottom;
+
+        for (int blockX = tile->x; blockX < tileRight; blockX += RAY_PACKET_WIDTH) {
+            int blockRight = blockX + RAY_PACKET_WIDTH < tileRight ? blockX + RAY_PACKET_WIDTH
+                                                                   : tileRight;
+
+            packet.count = 0;
+
+            for (int y = blockY; y < blockBottom; y++) {
+                if (y % stride != 0)
+                    continue;
+
+                float Py = PyInitial - (dY * y);
+
+                for (int x = blockX; x < blockRight; x++) {
+                    // Pixels of a coarser pass are already done
+                    if (x % stride != 0
+                        || (coarserStride > 0 && x % coarserStride == 0
+                            && y % coarserStride == 0))
+                        continue;
+
+                    float Rd[3];
+                    viewportRayDirection(camera, PxInitial + (dX * x), Py, Rd);
+
+                    pixelX[packet.count] = x;
+                    pixelY[packet.count] = y;
+                    packet.directionX[packet.count] = Rd[0];
+                    packet.directionY[packet.count] = Rd[1];
+                    packet.directionZ[packet.count] = Rd[2];
+                    packet.count++;
                 }
-                
-                // Skip comma
-                // TODO: Macro this?
-                if (i != numProperties - 1)
-                    fscanf(inputFile, "%s", inputBuf);
             }
-        }
-        else if (strcmp(inputBuf, "plane,") == 0) {
-            float position[3];
-            bool hasNs = false;
-            
-            const int numProperties = 5;
-            for (int i = 0; i < 5; i++) {
-                fscanf(inputFile, "%s", inputBuf);
-
-                if (strcmp(inputBuf, "normal:") == 0) {
-                    fscanf(inputFile, " [%f, %f, %f]", &curObject->pn[0],
-                           &curObject->pn[1], &curObject->pn[2]);
-                }
-                else if (strcmp(inputBuf, "position:") == 0) {
-                    fscanf(inputFile, " [%f, %f, %f]", &position[0], &position[1], &position[2]);
-                }
-                else if (strcmp(inputBuf, "diffuse_color:") == 0) {
-                    fscanf(inputFile, " [%f, %f, %f]", &curObject->diffuseColor.r,
-                           &curObject->diffuseColor.g, &curObject->diffuseColor.b);
-                }
-                else if (strcmp(inputBuf, "specular_color:") == 0) {
-                    fscanf(inputFile, " [%f, %f, %f]", &curObject->specularColor.r,
-                           &curObject->specularColor.g, &curObject->specularColor.b);
+
+            if (packet.count == 0)
+                continue;
+
+            // Every pixel is charged an equal share of casting the packet plus its own shading
+            float *pixelCosts = sceneData->pixelCosts;
+            uint64_t costStart = pixelCosts ? heatmapCounter(sceneData->heatmapMetric) : 0;
+            float packetShare = 0;
+
+            STATS_ADD(primaryRays, packet.count);
+            raycastPacket(sceneData, R0, &packet);
+
+            if (pixelCosts) {
+                uint64_t packetEnd = heatmapCounter(sceneData->heatmapMetric);
+                packetShare = (float) (packetEnd - costStart) / packet.count;
+                costStart = packetEnd;
+            }
+
+            for (size_t ray = 0; ray < packet.count; ray++) {
+                int x = pixelX[ray], y = pixelY[ray];
+                size_t pixelIndex = (size_t) (y - firstRow) * camera->imageWidth + x;
+                Pixel color = { 0, 0, 0 };
+
+                if (objectIds)
+                    objectIds[pixelIndex] = packet.nearestIndex[ray];
+
+                // If there is no nearest object, the ray hits nothing and the pixel stays black
+                if (packet.nearestIndex[ray] != GEOMETRY_NO_OBJECT) {
+                    Object *nearestObject = &sceneData->objects[packet.nearestIndex[ray]];
+                    float Rd[3] = { packet.directionX[ray], packet.directionY[ray],
+                                    packet.directionZ[ray] };
+
+                    color = toPixel(shadePixel(sceneData, nearestObject, R0, Rd,
+                                               packet.nearestT[ray]));
                 }
-                else if (strcmp(inputBuf, "reflectivity:") == 0) {
-                    fscanf(inputFile, " %f", &curObject->reflectivity);
+
+                // Cover the stride x stride block until finer passes fill in its other pixels
+                int fillRight = x + stride < tileRight ? x + stride : tileRight;
+                int fillBottom = y + stride < tileBottom ? y + stride : tileBottom;
+
+                for (int fillY = y; fillY < fillBottom; fillY++) {
+                    for (int fillX = x; fillX < fillRight; fillX++)
+                        image[(size_t) (fillY - firstRow) * camera->imageWidth + fillX] = color;
                 }
-                
-                // Check for existence of comma before optional specular and ns properties
-                if (i == numProperties - 3 || i == numProperties - 2) {
-                    char curChar = fgetc(inputFile);
-
-                    // If there is no comma, there are only 4 (no ns)
-                    if (curChar != ',') {
-                        ungetc(curChar, inputFile);
-                        break;
-                    }
+
+                if (pixelCosts) {
+                    uint64_t pixelEnd = heatmapCounter(sceneData->heatmapMetric);
+                    pixelCosts[pixelIndex] = packetShare + (pixelEnd - costStart);
+                    costStart = pixelEnd;
                 }
-                // Skip comma
-                else if (i != numProperties - 1)
-                    fscanf(inputFile, "%s", inputBuf);
             }
+        }
+    }
+}
 
-            if (!hasNs)
-                curObject->ns = DEFAULT_NS;
-            hasNs = false;
+static bool pixelsDiffer(Pixel *image, uint32_t *objectIds, size_t index, size_t otherIndex) {
+    Pixel a = image[index], b = image[otherIndex];
 
-            PixelN specularColor = { 0, 0, 0 };
-            
-            curObject->type = PLANE;
-            curObject->d = -f3_dot(position, curObject->pn);
-            curObject->specularColor = specularColor;
-            objIndex++;
+    return objectIds[index] != objectIds[otherIndex]
+           || abs(a.r - b.r) > AA_CONTRAST_THRESHOLD || abs(a.g - b.g) > AA_CONTRAST_THRESHOLD
+           || abs(a.b - b.b) > AA_CONTRAST_THRESHOLD;
+}
+
+inline void findEdgeTile(SceneData *sceneData, Pixel *image, int firstRow, uint32_t *objectIds,
+                         bool *edges, const Tile *tile) {
+    int width = sceneData->camera.imageWidth;
+    int height = sceneData->camera.imageHeight;
+
+    for (int y = tile->y; y < tile->y + tile->height; y++) {
+        for (int x = tile->x; x < tile->x + tile->width; x++) {
+            size_t index = (size_t) (y - firstRow) * width + x;
+
+            edges[index] = (x > 0 && pixelsDiffer(image, objectIds, index, index - 1))
+                           || (x < width - 1 && pixelsDiffer(image, objectIds, index, index + 1))
+                           || (y > 0 && pixelsDiffer(image, objectIds, index, index - width))
+                           || (y < height - 1
+                               && pixelsDiffer(image, objectIds, index, index + width));
         }
-        else if (strcmp(inputBuf, "sphere,") == 0) {
-            bool hasNs = false;
+    }
+}
 
-            const int numProperties = 8;
-            for (int i = 0; i < numProperties; i++) {
-                fscanf(inputFile, "%s", inputBuf);
+// Deterministic pseudo-random value in [0, 1) for a sample, so images do not depend on which
+//   thread renders which tile
+static inline float sampleJitter(uint32_t x, uint32_t y, uint32_t sample) {
+    uint32_t hash = (x * 0x8DA6B343u) ^ (y * 0xD8163841u) ^ (sample * 0xCB1AB31Fu);
+    hash ^= hash >> 16;
+    hash *= 0x7FEB352Du;
+    hash ^= hash >> 15;
+    hash *= 0x846CA68Bu;
+    hash ^= hash >> 16;
+
+    return (hash >> 8) * (1.0f / (1 << 24));
+}
 
-                if (strcmp(inputBuf, "radius:") == 0) {
-                    fscanf(inputFile, " %f", &curObject->radius);
-                }
-                else if (strcmp(inputBuf, "position:") == 0) {
-                    fscanf(inputFile, " [%f, %f, %f]", &curObject->center[0],
-                           &curObject->center[1], &curObject->center[2]);
-                }
-                else if (strcmp(inputBuf, "diffuse_color:") == 0) {
-                    fscanf(inputFile, " [%f, %f, %f]", &curObject->diffuseColor.r,
-                           &curObject->diffuseColor.g, &curObject->diffuseColor.b);
-                }
-                else if (strcmp(inputBuf, "specular_color:") == 0) {
-                    fscanf(inputFile, " [%f, %f, %f]", &curObject->specularColor.r,
-                    &curObject->specularColor.g, &curObject->specularColor.b);
-                }
-                else if (strcmp(inputBuf, "ns:") == 0) {
-                    fscanf(inputFile, " %f", &curObject->ns);
-                    hasNs = true;
-                }
-                else if (strcmp(inputBuf, "reflectivity:") == 0) {
-                    fscanf(inputFile, " %f", &curObject->reflectivity);
-                }
-                else if (strcmp(inputBuf, "refractivity:") == 0) {
-                    fscanf(inputFile, " %f", &curObject->refractivity);
-                }
-                else if (strcmp(inputBuf, "ior:") == 0) {
-                    fscanf(inputFile, " %f", &curObject->ior);
-                }
+inline void supersampleTile(SceneData *sceneData, Pixel *image, int firstRow, bool *edges,
+                            const Tile *tile) {
+    Camera *camera = &sceneData->camera;
+    int side = 1;
+    while ((side + 1) * (side + 1) <= sceneData->maxSamples)
+        side++;
 
-                // Check for existence of comma before optional refractivity, ior, and ns
-                //   properties
-                if (i == numProperties - 4 || i == numProperties - 3 || i == numProperties - 2) {
-                    char curChar = fgetc(inputFile);
+    RayPacket packet;
 
-                    // If there is no comma, there are only 4 (no ns)
-                    if (curChar != ',') {
-                        ungetc(curChar, inputFile);
-                        break;
-                    }
+    for (int y = tile->y; y < tile->y + tile->height; y++) {
+        for (int x = tile->x; x < tile->x + tile->width; x++) {
+            size_t index = (size_t) (y - firstRow) * camera->imageWidth + x;
+
+            if (!edges[index])
+                continue;
+
+            // Supersampling adds to the cost of the pixel's first sample
+            uint64_t costStart = sceneData->pixelCosts ? heatmapCounter(sceneData->heatmapMetric)
+                                                       : 0;
+
+            // One jittered sample in each cell of a side x side grid over the pixel
+            packet.count = 0;
+
+            for (int cellY = 0; cellY < side; cellY++) {
+                for (int cellX = 0; cellX < side; cellX++) {
+                    uint32_t sample = packet.count;
+                    float Rd[3];
+
+                    primaryRayDirection(camera, x + (cellX + sampleJitter(x, y, 2 * sample))
+                                                    / side,
+                                        y + (cellY + sampleJitter(x, y, 2 * sample + 1)) / side,
+                                        Rd);
+
+                    packet.directionX[packet.count] = Rd[0];
+                    packet.directionY[packet.count] = Rd[1];
+                    packet.directionZ[packet.count] = Rd[2];
+                    packet.count++;
                 }
-                // Skip comma
-                else if (i != numProperties - 1)
-                    fscanf(inputFile, "%s", inputBuf);
             }
 
-            if (!hasNs)
-                curObject->ns = DEFAULT_NS;
-            hasNs = false;
-            
-            curObject->type = SPHERE;
-            // TODO: Increment & set new pointer with 1 statemnent (macro/function?)
-            objIndex++;
-        }
-        else if (strcmp(inputBuf, "quadric,") == 0) {
-            bool hasNs = false;
+            STATS_ADD(primaryRays, packet.count);
+            raycastPacket(sceneData, camera->origin, &packet);
 
-            const int numProperties = 7;
-            for (int i = 0; i < numProperties; i++) {
-                fscanf(inputFile, "%s", inputBuf);
+            PixelN sum = { 0, 0, 0 };
 
-                if (strcmp(inputBuf, "diffuse_color:") == 0) {
-                    fscanf(inputFile, " [%f, %f, %f]", &curObject->diffuseColor.r,
-                           &curObject->diffuseColor.g, &curObject->diffuseColor.b);
-                }
-                else if (strcmp(inputBuf, "specular_color:") == 0) {
-                    fscanf(inputFile, " [%f, %f, %f]", &curObject->specularColor.r,
-                    &curObject->specularColor.g, &curObject->specularColor.b);
-                }
-                else if (strcmp(inputBuf, "constants:") == 0) {
-                    fscanf(inputFile, " [%f, %f, %f, %f, %f, %f, %f, %f, %f, %f]",
-                           &curObject->quadricVars.a, &curObject->quadricVars.b,
-                           &curObject->quadricVars.c, &curObject->quadricVars.d,
-                           &curObject->quadricVars.e, &curObject->quadricVars.f,
-                           &curObject->quadricVars.g, &curObject->quadricVars.h,
-                           &curObject->quadricVars.i, &curObject->quadricVars.j);
-                }
-                else if (strcmp(inputBuf, "reflectivity:") == 0) {
-                    fscanf(inputFile, " %f", &curObject->reflectivity);
-                }
-                else if (strcmp(inputBuf, "ns:") == 0) {
-                    fscanf(inputFile, " %f", &curObject->ns);
-                    hasNs = true;
-                }
-                else if (strcmp(inputBuf, "refractivity:") == 0) {
-                    fscanf(inputFile, " %f", &curObject->refractivity);
-                }
-                else if (strcmp(inputBuf, "ior:") == 0) {
-                    fscanf(inputFile, " %f", &curObject->ior);
-                }
-                
-                // Check for existence of comma before optional ns property
-                if (i == numProperties - 2) {
-                    char curChar = fgetc(inputFile);
-
-                    // If there is no comma, there are only 4 (no ns)
-                    if (curChar != ',') {
-                        ungetc(curChar, inputFile);
-                        break;
-                    }
-                }
-                // Skip comma
-                else if (i != numProperties - 1)
-                    fscanf(inputFile, "%s", inputBuf);
+            for (size_t ray = 0; ray < packet.count; ray++) {
+                // Samples that hit nothing are black
+                if (packet.nearestIndex[ray] == GEOMETRY_NO_OBJECT)
+                    continue;
+
+                float Rd[3] = { packet.directionX[ray], packet.directionY[ray],
+                                packet.directionZ[ray] };
+                PixelN color = shadePixel(sceneData, &sceneData->objects[packet.nearestIndex[ray]],
+                                          camera->origin, Rd, packet.nearestT[ray]);
+
+                sum.r += color.r;
+                sum.g += color.g;
+                sum.b += color.b;
             }
 
-            // TODO: Causes problems (black screen)?
-            if (!hasNs)
-                curObject->ns = DEFAULT_NS;
-            hasNs = false;
-            
-            curObject->type = QUADRIC;
-            objIndex++;
+            sum.r /= packet.count;
+            sum.g /= packet.count;
+            sum.b /= packet.count;
+
+            image[index] = toPixel(sum);
 
-            // __builtin_dump_struct(curObject, &printf);
+            if (sceneData->pixelCosts) {
+                sceneData->pixelCosts[index] += heatmapCounter(sceneData->heatmapMetric)
+                                                - costStart;
+            }
         }
-        else if (strcmp(inputBuf, "light,") == 0) {
-            bool hasDirection = false;
-            
-            const int numProperties = 8;
-            for (int i = 0; i < numProperties; i++) {
-                fscanf(inputFile, "%s", inputBuf);
-
-                if (strcmp(inputBuf, "position:") == 0) {
-                    fscanf(inputFile, " [%f, %f, %f]", &curLight->position[0],
-                           &curLight->position[1], &curLight->position[2]);
-                }
-                else if (strcmp(inputBuf, "color:") == 0) {
-                    fscanf(inputFile, " [%f, %f, %f]", &curLight->color.r, &curLight->color.g,
-                           &curLight->color.b);
-                }
-                else if (strcmp(inputBuf, "direction:") == 0) {
-                    fscanf(inputFile, " [%f, %f, %f]", &curLight->direction[0],
-                           &curLight->direction[1], &curLight->direction[2]);
-                    hasDirection = true;
-                }
-                else if (strcmp(inputBuf, "theta:") == 0) {
-                    float theta;
-                    fscanf(inputFile, " %f", &theta);
-                    curLight->theta = f_to_radians(theta);
-                    curLight->cosTheta = cosf(curLight->theta);
-                }
-                else if (strcmp(inputBuf, "radial-a0:") == 0) {
-                    fscanf(inputFile, " %f", &curLight->radialA0);
-                }
-                else if (strcmp(inputBuf, "radial-a1:") == 0) {
-                    fscanf(inputFile, " %f", &curLight->radialA1);
-                }
-                else if (strcmp(inputBuf, "radial-a2:") == 0) {
-                    fscanf(inputFile, " %f", &curLight->radialA2);
-                }
-                else if (strcmp(inputBuf, "angular-a0:") == 0) {
-                    fscanf(inputFile, " %f", &curLight->angularA0);
-                }
+    }
+}
 
-                // Check for existence of comma at index 6 - 1 (8 - 3)
-                if (i == numProperties - 3) {
-                    char curChar = fgetc(inputFile);
+typedef struct {
+    SceneData *sceneData;
 
-                    // If there is no comma, there are only 6 properties -> point light
-                    if (curChar != ',') {
-                        ungetc(curChar, inputFile);
-                        break;
-                    }
-                }
-                // Skip comma
-                else if (i != numProperties - 1)
-                    fscanf(inputFile, "%s", inputBuf);
+    // Rows of the frame from firstRow on; tiles are numbered from tileRow
+    Pixel *image;
+    int firstRow, tileRow;
+
+    // Pixels rendered by the current pass, see renderTile()
+    int stride, coarserStride;
+
+    // Only used when supersampling, with the same rows as image
+    uint32_t *objectIds;
+    bool *edges;
+
+    // Tiles of the whole frame to work on (all of them when NULL), numbered row by row, and what
+    //   each depends on when not NULL
+    const bool *dirtyTiles;
+    int tileColumns;
+    TileDependencies *dependencies;
+
+    // Copy of the first pass kept for finding edges, whose pixels outside the rendered tiles are
+    //   not replaced by supersampling, when not NULL
+    Pixel *firstPass;
+
+    // Tiles outside these columns of the frame are skipped
+    int firstColumn, endColumn;
+} RenderJob;
+
+// Tile moved down to the rows of the frame the job is working on
+static inline Tile frameTile(const RenderJob *job, const Tile *tile) {
+    Tile shifted = *tile;
+    shifted.y += job->tileRow;
+
+    return shifted;
+}
+
+// Index of a tile of the whole frame in dirtyTiles and dependencies
+static inline size_t frameTileIndex(const RenderJob *job, const Tile *tile) {
+    return (size_t) (tile->y / TILE_SIZE) * job->tileColumns + tile->x / TILE_SIZE;
+}
+
+static inline bool isTileSkipped(const RenderJob *job, const Tile *tile) {
+    return tile->x + tile->width <= job->firstColumn || tile->x >= job->endColumn
+           || (job->dirtyTiles && !job->dirtyTiles[frameTileIndex(job, tile)]);
+}
+
+static void renderJobTile(void *context, const Tile *tile) {
+    RenderJob *job = context;
+    Tile shifted = frameTile(job, tile);
+
+    if (isTileSkipped(job, &shifted))
+        return;
+
+    // Dependencies are recorded afresh whenever a tile is rendered
+    if (job->dependencies) {
+        currentTileDependencies = &job->dependencies[frameTileIndex(job, &shifted)];
+        clearTileDependencies(currentTileDependencies);
+    }
+
+    renderTile(job->sceneData, job->image, job->firstRow, job->objectIds, &shifted, job->stride,
+               job->coarserStride);
+    currentTileDependencies = NULL;
+
+    if (job->firstPass) {
+        int width = job->sceneData->camera.imageWidth;
+
+        for (int y = shifted.y; y < shifted.y + shifted.height; y++) {
+            size_t index = (size_t) (y - job->firstRow) * width + shifted.x;
+            memcpy(&job->firstPass[index], &job->image[index], shifted.width * sizeof(Pixel));
+        }
+    }
+}
+
+static void findEdgeJobTile(void *context, const Tile *tile) {
+    RenderJob *job = context;
+    Tile shifted = frameTile(job, tile);
+
+    if (isTileSkipped(job, &shifted))
+        return;
+
+    findEdgeTile(job->sceneData, job->firstPass ? job->firstPass : job->image, job->firstRow,
+                 job->objectIds, job->edges, &shifted);
+}
+
+static void supersampleJobTile(void *context, const Tile *tile) {
+    RenderJob *job = context;
+    Tile shifted = frameTile(job, tile);
+
+    if (isTileSkipped(job, &shifted))
+        return;
+
+    if (job->dependencies)
+        currentTileDependencies = &job->dependencies[frameTileIndex(job, &shifted)];
+
+    supersampleTile(job->sceneData, job->image, job->firstRow, job->edges, &shifted);
+    currentTileDependencies = NULL;
+}
+
+// Edges are found on the finished first pass before any pixel is refined, so the result does not
+//   depend on the order tiles are processed in
+static void supersampleEdges(RenderJob *job, TileScheduler *scheduler, int numRows) {
+    int width = job->sceneData->camera.imageWidth;
+
+    STATS_PHASE_BEGIN(PHASE_EDGES);
+    runTiles(scheduler, width, numRows, findEdgeJobTile, job);
+    STATS_PHASE_END(PHASE_EDGES);
+
+    STATS_PHASE_BEGIN(PHASE_SUPERSAMPLE);
+    runTiles(scheduler, width, numRows, supersampleJobTile, job);
+    STATS_PHASE_END(PHASE_SUPERSAMPLE);
+}
+
+/**
+ Render the numRows rows of the frame from firstRow into image, which holds numImageRows rows
+ from imageFirstRow. When anti-aliasing, image must also hold the rows right above and below the
+ rendered ones (where the frame has them), which get one sample per pixel. Only the tiles
+ overlapping the columns from firstColumn to endColumn (exclusive) are rendered.
+ */
+static void renderRows(SceneData *sceneData, Pixel *image, int imageFirstRow, int numImageRows,
+                       int firstRow, int numRows, int firstColumn, int endColumn,
+                       TileScheduler *scheduler, PreviewFunction preview, void *previewContext) {
+    int width = sceneData->camera.imageWidth;
+    RenderJob job = { sceneData, image, imageFirstRow, imageFirstRow, 1, 0, NULL, NULL };
+    job.firstColumn = firstColumn;
+    job.endColumn = endColumn;
+
+    if (sceneData->maxSamples > 1) {
+        // Zeroed so edges found next to skipped tiles never read uninitialized memory
+        job.objectIds = calloc((size_t) width * numImageRows, sizeof(uint32_t));
+        job.edges = calloc((size_t) width * numImageRows, sizeof(bool));
+
+        // Either may have been allocated, which a daemon that goes on after the error would leak
+        if (!job.objectIds || !job.edges) {
+            free(job.edges);
+            free(job.objectIds);
+            checkError(true, "Error: Could not allocate memory for anti-aliasing!\n");
+        }
+    }
+
+    // An error on a render thread is freed of the buffers above before it is passed on. They are
+    //   copied out since job changes after setjmp(), which leaves its value undefined at the jump.
+    uint32_t *objectIds = job.objectIds;
+    bool *edges = job.edges;
+    jmp_buf jump;
+    jmp_buf *previousJump = errorJump;
+
+    if (setjmp(jump) != 0) {
+        errorJump = previousJump;
+        free(edges);
+        free(objectIds);
+        raiseError(errorMessage);
+    }
+
+    errorJump = &jump;
+
+    STATS_PHASE_BEGIN(PHASE_RENDER);
+
+    if (sceneData->progressive) {
+        // Every pass halves the stride, rendering only the pixels the coarser passes skipped, so
+        //   the finished image is the same as a normal render
+        for (job.stride = PROGRESSIVE_STRIDE; job.stride >= 1; job.stride /= 2) {
+            job.coarserStride = job.stride < PROGRESSIVE_STRIDE ? job.stride * 2 : 0;
+            runTiles(scheduler, width, numImageRows, renderJobTile, &job);
+
+            if (preview && job.stride > 1)
+                preview(previewContext, image);
+        }
+    }
+    else {
+        runTiles(scheduler, width, numImageRows, renderJobTile, &job);
+    }
+
+    STATS_PHASE_END(PHASE_RENDER);
+
+    if (sceneData->maxSamples > 1) {
+        job.tileRow = firstRow;
+        supersampleEdges(&job, scheduler, numRows);
+    }
+
+    errorJump = previousJump;
+    free(edges);
+    free(objectIds);
+}
+
+inline void renderScene(SceneData *sceneData, Pixel *image, TileScheduler *scheduler,
+                        PreviewFunction preview, void *previewContext) {
+    int width = sceneData->camera.imageWidth;
+    int height = sceneData->camera.imageHeight;
+
+    renderRows(sceneData, image, 0, height, 0, height, 0, width, scheduler, preview,
+               previewContext);
+
+#ifdef STATS
+    mergeRenderStats(scheduler);
+#endif
+}
+
+inline void dilateTiles(const bool *tiles, int columns, int rows, bool *dilated) {
+    memset(dilated, false, (size_t) columns * rows * sizeof(bool));
+
+    for (int row = 0; row < rows; row++) {
+        for (int column = 0; column < columns; column++) {
+            if (!tiles[(size_t) row * columns + column])
+                continue;
+
+            for (int y = row > 0 ? row - 1 : 0; y <= row + 1 && y < rows; y++) {
+                for (int x = column > 0 ? column - 1 : 0; x <= column + 1 && x < columns; x++)
+                    dilated[(size_t) y * columns + x] = true;
             }
-            
-            curLight->type = hasDirection ? SPOT : POINT;
-            hasDirection = false;
-            lightIndex++;
         }
     }
+}
+
+inline void renderSceneTiles(SceneData *sceneData, Pixel *image, Pixel *firstPass,
+                             uint32_t *objectIds, bool *edges, const bool *dirtyTiles,
+                             TileDependencies *dependencies, TileScheduler *scheduler) {
+    int width = sceneData->camera.imageWidth;
+    int height = sceneData->camera.imageHeight;
+    RenderJob job = { sceneData, image, 0, 0, 1, 0, objectIds, edges, dirtyTiles,
+                      (width + TILE_SIZE - 1) / TILE_SIZE, dependencies, firstPass, 0, width };
 
-    fclose(inputFile);
+    STATS_PHASE_BEGIN(PHASE_RENDER);
+    runTiles(scheduler, width, height, renderJobTile, &job);
+    STATS_PHASE_END(PHASE_RENDER);
 
-    float cameraOrigin[3] = { 0, 0, 0 };
+    if (sceneData->maxSamples > 1)
+        supersampleEdges(&job, scheduler, height);
 
-    sceneData->numObjects = objIndex;
-    sceneData->numLights = lightIndex;
-    sceneData->camera.origin[0] = cameraOrigin[0];
-    sceneData->camera.origin[1] = cameraOrigin[1];
-    sceneData->camera.origin[2] = cameraOrigin[2];
+#ifdef STATS
+    mergeRenderStats(scheduler);
+#endif
+}
+
+inline void renderSceneBands(SceneData *sceneData, int bandHeight, TileScheduler *scheduler,
+                             BandFunction output, void *outputContext) {
+    Tile frame = { 0, 0, sceneData->camera.imageWidth, sceneData->camera.imageHeight };
+
+    renderSceneRegion(sceneData, &frame, bandHeight, scheduler, output, outputContext);
+}
+
+inline void renderSceneRegion(SceneData *sceneData, const Tile *region, int bandHeight,
+                              TileScheduler *scheduler, BandFunction output, void *outputContext) {
+    int width = sceneData->camera.imageWidth;
+    int height = sceneData->camera.imageHeight;
+    int endRow = region->y + region->height;
+
+    // Edge detection compares every pixel with its four neighbors, so with anti-aliasing each
+    //   band also renders one row and column around it
+    int margin = sceneData->maxSamples > 1 ? 1 : 0;
+    int firstColumn = region->x - margin > 0 ? region->x - margin : 0;
+    int endColumn = region->x + region->width + margin < width ? region->x + region->width + margin
+                                                               : width;
+
+    Pixel *rows = calloc((size_t) width * (bandHeight + 2 * margin), sizeof(Pixel));
+    checkError(rows == NULL, "Error: Could not allocate memory for %i rows!\n",
+               bandHeight + 2 * margin);
+
+    // Errors while rendering or in output are passed on once the band buffer is freed, so a
+    //   daemon job that fails does not leak it
+    jmp_buf jump;
+    jmp_buf *previousJump = errorJump;
+
+    if (setjmp(jump) != 0) {
+        errorJump = previousJump;
+        free(rows);
+        raiseError(errorMessage);
+    }
+
+    errorJump = &jump;
+
+    for (int firstRow = region->y; firstRow < endRow; firstRow += bandHeight) {
+        int numRows = bandHeight < endRow - firstRow ? bandHeight : endRow - firstRow;
+        int imageFirstRow = firstRow - margin > 0 ? firstRow - margin : 0;
+        int imageEndRow = firstRow + numRows + margin < height ? firstRow + numRows + margin
+                                                               : height;
+
+        renderRows(sceneData, rows, imageFirstRow, imageEndRow - imageFirstRow, firstRow, numRows,
+                   firstColumn, endColumn, scheduler, NULL, NULL);
+        output(outputContext, rows + (size_t) (firstRow - imageFirstRow) * width, firstRow,
+               numRows);
+    }
+
+    errorJump = previousJump;
+    free(rows);
+
+#ifdef STATS
+    mergeRenderStats(scheduler);
+#endif
+}
+
+inline void reserveSceneStorage(SceneData *sceneData, size_t numObjects, size_t numLights) {
+    if (numObjects <= sceneData->objectCapacity && numLights <= sceneData->lightCapacity)
+        return;
+
+    // Object indices must stay below GEOMETRY_NO_OBJECT
+    checkError(numObjects >= GEOMETRY_NO_OBJECT, "Error: Too many objects in the scene!\n");
+
+    // Halved so the two sizes, rounded up to the alignment, can be added without wrapping
+    checkError(numObjects > SIZE_MAX / 2 / sizeof(Object)
+               || numLights > SIZE_MAX / 2 / sizeof(Light),
+               "Error: Could not allocate memory for %zu objects and %zu lights!\n", numObjects,
+               numLights);
+
+    numObjects = numObjects > sceneData->objectCapacity ? numObjects : sceneData->objectCapacity;
+    numLights = numLights > sceneData->lightCapacity ? numLights : sceneData->lightCapacity;
+
+    // Lights start on the cache line after the objects
+    size_t objectsSize = (numObjects * sizeof(Object) + GEOMETRY_ALIGNMENT - 1)
+                         / GEOMETRY_ALIGNMENT * GEOMETRY_ALIGNMENT;
+    size_t lightsSize = (numLights * sizeof(Light) + GEOMETRY_ALIGNMENT - 1)
+                        / GEOMETRY_ALIGNMENT * GEOMETRY_ALIGNMENT;
+    size_t storageSize = objectsSize + lightsSize > 0 ? objectsSize + lightsSize
+                                                      : GEOMETRY_ALIGNMENT;
+
+    char *storage = aligned_alloc(GEOMETRY_ALIGNMENT, storageSize);
+    checkError(storage == NULL,
+               "Error: Could not allocate memory for %zu objects and %zu lights!\n", numObjects,
+               numLights);
+
+    // Zeroed since the parser only sets the properties present in the scene file
+    memset(storage, 0, storageSize);
+
+    Object *objects = (Object *) storage;
+    Light *lights = (Light *) (storage + objectsSize);
+
+    if (sceneData->storage != NULL) {
+        memcpy(objects, sceneData->objects, sceneData->numObjects * sizeof(Object));
+        memcpy(lights, sceneData->lights, sceneData->numLights * sizeof(Light));
+        free(sceneData->storage);
+    }
+
+    sceneData->storage = storage;
+    sceneData->objects = objects;
+    sceneData->objectCapacity = numObjects;
+    sceneData->lights = lights;
+    sceneData->lightCapacity = numLights;
+}
+
+inline void freeSceneData(SceneData *sceneData) {
+    free(sceneData->storage);
+    sceneData->storage = NULL;
+    sceneData->objects = NULL;
+    sceneData->lights = NULL;
+    sceneData->numObjects = sceneData->objectCapacity = 0;
+    sceneData->numLights = sceneData->lightCapacity = 0;
+
+    freeBVH(&sceneData->bvh);
+    freeGrid(&sceneData->grid);
+    freeSceneGeometry(&sceneData->geometry);
+    freeSpecularTables(&sceneData->specularTables);
+}
+
+inline void compileScene(SceneData *sceneData) {
+    for (size_t index = 0; index < sceneData->numObjects; index++) {
+        Object *object = &sceneData->objects[index];
+
+        if (object->type == SPHERE) {
+            object->radius2 = object->radius * object->radius;
+        }
+        else if (object->type == QUADRIC) {
+            object->gradientA = 2 * object->quadricVars.a;
+            object->gradientB = 2 * object->quadricVars.b;
+            object->gradientC = 2 * object->quadricVars.c;
+        }
+    }
+
+    for (size_t index = 0; index < sceneData->numLights; index++) {
+        Light *light = &sceneData->lights[index];
+
+        // Spot lights point from their position toward their direction "point"
+        if (light->type == SPOT) {
+            f3_from_points(light->spotAxis, light->position, light->direction);
+            f3_normalize(light->spotAxis, light->spotAxis);
+        }
+    }
+
+    buildSpecularTables(sceneData);
+    buildSceneGeometry(sceneData);
+
+    double start = nowMs();
+
+    if (sceneData->accelerator == ACCEL_BVH) {
+        buildBVH(sceneData);
+        sceneData->accelMemory = bvhMemory(&sceneData->bvh);
+    }
+    else if (sceneData->accelerator == ACCEL_GRID) {
+        buildGrid(sceneData);
+        sceneData->accelMemory = gridMemory(&sceneData->grid);
+    }
+    else {
+        sceneData->accelMemory = 0;
+    }
+
+    sceneData->accelBuildMs = nowMs() - start;
+}
+
+typedef struct {
+    PPM *ppm;
+    const char *fileName;
+} PreviewOutput;
+
+static void writePreview(void *context, const Pixel *image) {
+    PreviewOutput *output = context;
+
+    writeImageAtomically(*output->ppm, output->ppm->format, output->fileName);
+}
+
+static void writeBand(void *context, const Pixel *rows, int firstRow, int numRows) {
+    STATS_PHASE_BEGIN(PHASE_WRITE);
+    writeImageRows(context, rows, numRows);
+    STATS_PHASE_END(PHASE_WRITE);
 }
 
 int main(int argc, const char *argv[]) {
-    if (argc != 5) {
-        fprintf(stderr, "Error: Wrong number of arguments!\n");
-        return EXIT_FAILURE;
+    RenderOptions options;
+    parseOptions(argc, argv, &options);
+
+    if (options.bench) {
+        runBenchmarks(&options);
+        return EXIT_SUCCESS;
     }
 
-    const int width = atoi(argv[1]);
-    const int height = atoi(argv[2]);
-    const char *inputFileName = argv[3];
-    const char *outputFileName = argv[4];
-    
-    Pixel *image = calloc(width * height, sizeof(Pixel));
-    FILE *inputFile = fopen(inputFileName, "r");
+    if (options.daemonSocketName) {
+        runDaemon(options.daemonSocketName, &options);
+        return EXIT_SUCCESS;
+    }
+
+    if (options.merge) {
+        mergePartialImages(options.partFileNames, options.numPartFileNames, options.outputFormat,
+                           options.outputFileName);
+        free(options.partFileNames);
+        return EXIT_SUCCESS;
+    }
+
+    if (options.convert) {
+        // Only the objects and lights are written, so no accelerator is built
+        SceneData sceneData = {};
+        sceneData.accelerator = ACCEL_LINEAR;
+        loadScene(options.inputFileName, &sceneData);
+        writeSceneFile(options.outputFileName, &sceneData);
+
+        printf("Wrote %zu objects and %zu lights to \"%s\"\n", sceneData.numObjects,
+               sceneData.numLights, options.outputFileName);
+        freeSceneData(&sceneData);
 
-    if (inputFile == NULL) {
-        fprintf(stderr, "Error: Could not open input file \"%s\"!\n", inputFileName);
-        return EXIT_FAILURE;
+        return EXIT_SUCCESS;
     }
 
+    const int width = options.width;
+    const int height = options.height;
+    const char *inputFileName = options.inputFileName;
+    const char *outputFileName = options.outputFileName;
+
     SceneData sceneData = {};
     sceneData.camera.imageWidth = width;
     sceneData.camera.imageHeight = height;
     sceneData.camera.vpDistance = 1;
-    parseSceneInput(inputFile, &sceneData);
-    
-    renderScene(&sceneData, image);
+    sceneData.minContribution = options.minContribution;
+    sceneData.maxSamples = options.maxSamples;
+    sceneData.progressive = options.progressive;
+    sceneData.heatmapMetric = options.heatmapMetric;
+    sceneData.specularMode = options.specularMode;
+    sceneData.accelerator = options.accelerator;
+
+    if (options.heatmapFileName) {
+        sceneData.pixelCosts = calloc((size_t) width * height, sizeof(float));
+        checkError(sceneData.pixelCosts == NULL,
+                   "Error: Could not allocate memory for the heatmap!\n");
+    }
+
+    // The path is read first so mistakes in it are reported before a long scene load
+    CameraPath cameraPath = {};
+
+    if (options.cameraPathFileName)
+        loadCameraPath(options.cameraPathFileName, &cameraPath);
+
+    STATS_PHASE_BEGIN(PHASE_PARSE);
+    loadScene(inputFileName, &sceneData);
+    STATS_PHASE_END(PHASE_PARSE);
+
+    TileScheduler scheduler;
+    createTileScheduler(&scheduler, options.numThreads);
 
-    PPM outputPpm;
-    outputPpm.format = 6;
-    outputPpm.maxColorVal = 255;
-    outputPpm.width = width;
-    outputPpm.height = height;
-    outputPpm.imageData = image;
+    // Set up when the output can be rendered into directly
+    MappedPPM mappedPpm;
 
-    writeImage(outputPpm, outputPpm.format, outputFileName);
+    if (options.cameraPathFileName) {
+        // The scene, its accelerator and the threads are shared by every frame
+        renderAnimation(&sceneData, &cameraPath, &scheduler, options.outputFormat,
+                        outputFileName);
+        freeCameraPath(&cameraPath);
+    }
+    else if (options.interactive) {
+        // Edits read from stdin re-render only the tiles they can change
+        runInteractive(&sceneData, &scheduler, options.outputFormat, outputFileName, stdin);
+    }
+    else if (options.hasRegion) {
+        // Rows of the region are written as soon as their band is done, like --stream
+        int bandRows = options.streamRows > 0 ? options.streamRows : PARTIAL_BAND_ROWS;
+        renderRegionImage(&sceneData, &options.region, bandRows, &scheduler,
+                          options.outputFormat, outputFileName);
+    }
+    else if (options.tiles) {
+        renderTileImage(&sceneData, options.tiles, options.tileList, &scheduler,
+                        options.outputFormat, outputFileName);
+        free(options.tiles);
+    }
+    else if (options.checkpointInterval > 0) {
+        // Finished rows of tiles are recorded next to the output, so a killed render can go on
+        renderCheckpointed(&sceneData, inputFileName, options.checkpointInterval, options.resume,
+                           &scheduler, outputFileName);
+    }
+    else if (options.streamRows > 0) {
+        // Rows are written as soon as their band is done, so the frame is never held in memory
+        PPMStream stream;
+        beginImageStream(&stream, width, height, 255, options.outputFormat, NULL, outputFileName,
+                         &scheduler);
+        renderSceneBands(&sceneData, options.streamRows, &scheduler, writeBand, &stream);
+        endImageStream(&stream);
+    }
+    else if (options.outputFormat == 6 && !sceneData.progressive
+             && mapImage(&mappedPpm, width, height, 255, outputFileName)) {
+        // Pixels are rendered straight into the mapped image, which then replaces the output
+        renderScene(&sceneData, mappedPpm.imageData, &scheduler, NULL, NULL);
+
+        STATS_PHASE_BEGIN(PHASE_WRITE);
+        unmapImage(&mappedPpm);
+        STATS_PHASE_END(PHASE_WRITE);
+    }
+    else {
+        Pixel *image = calloc((size_t) width * height, sizeof(Pixel));
+        checkError(image == NULL, "Error: Could not allocate memory for the image!\n");
+
+        PPM outputPpm;
+        outputPpm.format = options.outputFormat;
+        outputPpm.maxColorVal = 255;
+        outputPpm.width = width;
+        outputPpm.height = height;
+        outputPpm.imageData = image;
+
+        PreviewOutput previewOutput = { &outputPpm, outputFileName };
 
-    free(image);
+        renderScene(&sceneData, image, &scheduler, writePreview, &previewOutput);
 
-#ifndef NDEBUG
-    printf("Highest iterationNum: %i\n", highestIteration);
+        STATS_PHASE_BEGIN(PHASE_WRITE);
+
+        // Readers watching a progressive render must never see a half-written file
+        if (sceneData.progressive)
+            writeImageAtomically(outputPpm, outputPpm.format, outputFileName);
+        else
+            writeImageParallel(outputPpm, outputPpm.format, outputFileName, &scheduler);
+
+        STATS_PHASE_END(PHASE_WRITE);
+
+        free(image);
+    }
+
+    destroyTileScheduler(&scheduler);
+
+    if (options.heatmapFileName) {
+        writeHeatmap(sceneData.pixelCosts, width, height, sceneData.heatmapMetric,
+                     options.heatmapFileName);
+        free(sceneData.pixelCosts);
+    }
+
+#ifdef STATS
+    if (options.stats)
+        printRenderStats(stdout, &sceneData);
+
+    freeRenderStats();
 #endif
 
+    freeSceneData(&sceneData);
+
     return EXIT_SUCCESS;
 }
@@ -5,11 +5,17 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "bvh.h"
+#include "geometry.h"
+#include "grid.h"
+#include "heatmap.h"
 #include "ppmrw.h"
+#include "scheduler.h"
+#include "specular.h"
 #include "v3math.h"
 
-#define OBJECT_LIMIT 128
-#define INPUT_BUFFER_SIZE 32
+// Objects and lights allocated before the first one is parsed, doubled whenever they run out
+#define SCENE_INITIAL_CAPACITY 64
 
 #define DEFAULT_NS 20.0f
 
@@ -17,6 +23,18 @@
 
 #define RECURSION_DEPTH 32
 
+// Pixels whose color differs from a neighbor's by more than this in any channel (or that see a
+//   different object) are supersampled when anti-aliasing
+#define AA_CONTRAST_THRESHOLD 12
+
+// Samples per pixel are limited to one ray packet
+#define MAX_SAMPLES RAY_PACKET_SIZE
+
+// Pixel spacing of the first progressive pass (a power of two)
+#define PROGRESSIVE_STRIDE 8
+
+struct TileDependencies;
+
 typedef enum {
     PLANE   = 0,
     SPHERE  = 1,
@@ -38,10 +56,17 @@ typedef struct {
     float Rd[3];
 } Ray;
 
-typedef struct {
+typedef struct ReflectionHit {
+    struct Object *object;
+    float point[3];
+    float normal[3];
+} ReflectionHit;
+
+typedef struct Object {
     ObjectType type;
     PixelN diffuseColor, specularColor;
     float reflectivity, refractivity, ior, ns;
+    SpecularPower specularPower; // Set by compileScene()
     
     union {
         // Plane properties
@@ -54,11 +79,13 @@ typedef struct {
         struct {
             float center[3];
             float radius;
+            float radius2; // Set by compileScene()
         };
         
         // Quadric properties
         struct {
             QuadricVariables quadricVars;
+            float gradientA, gradientB, gradientC; // 2a, 2b, 2c, set by compileScene()
         };
     };
 } Object;
@@ -69,6 +96,9 @@ typedef struct {
     float direction[3];
     PixelN color;
     float radialA0, radialA1, radialA2, angularA0, theta, cosTheta;
+
+    // Normalized vector from position toward direction, set by compileScene()
+    float spotAxis[3];
 } Light;
 
 typedef struct {
@@ -76,20 +106,55 @@ typedef struct {
     float vpWidth, vpHeight;
     float vpDistance;
     float origin[3];
+
+    // Orthonormal view basis: the viewport is vpDistance along forward from the origin, with its
+    //   x axis along right and its y axis along up
+    float right[3], up[3], forward[3];
 } Camera;
 
-// TODO: Use realloc to dynamically resize objects? Should be fine on stack
-typedef struct {
+typedef struct SceneData {
     Camera camera;
-    
-    Object objects[OBJECT_LIMIT];
-    size_t numObjects;
-    
-    Light lights[OBJECT_LIMIT];
-    size_t numLights;
+
+    // Objects and lights share one cache-aligned allocation, grown by reserveSceneStorage()
+    Object *objects;
+    size_t numObjects, objectCapacity;
+
+    Light *lights;
+    size_t numLights, lightCapacity;
+
+    void *storage;
+
+    // Reflection chains stop once the weight of the next bounce drops below this (0 traces every
+    //   bounce that can change the image)
+    float minContribution;
+
+    // Samples per edge pixel (a square number); 1 shoots one ray through each pixel center
+    int maxSamples;
+
+    // Render in passes of decreasing pixel spacing, previewing the image after each
+    bool progressive;
+
+    // How specular highlights are evaluated, and the lookup tables they use
+    SpecularMode specularMode;
+    SpecularTables specularTables;
+
+    // When not NULL, the cost of every pixel in heatmapMetric units is stored here
+    float *pixelCosts;
+    HeatmapMetric heatmapMetric;
+
+    // Built from the objects by compileScene(), with only the structure chosen by accelerator
+    //   built besides the geometry
+    SceneGeometry geometry;
+    Accelerator accelerator;
+    BVH bvh;
+    Grid grid;
+
+    // Time taken to build the accelerator and the memory it holds
+    double accelBuildMs;
+    size_t accelMemory;
 } SceneData;
 
-extern inline float raycastQuadric(float *R0, float *Rd, QuadricVariables variables, bool largestT);
+float raycastQuadric(float *R0, float *Rd, QuadricVariables variables, bool largestT);
 
 /**
  Calculate ray-plane intersection where
@@ -98,36 +163,187 @@ extern inline float raycastQuadric(float *R0, float *Rd, QuadricVariables variab
  plane is the 3D array representing the plane's normal unit Pn (A, B, C), and
  d is the distance from the origin to the plane (D)
  */
-extern inline float raycastPlane(float *R0, float *Rd, float *pn, float d);
+float raycastPlane(float *R0, float *Rd, float *pn, float d);
 
 /**
  Calculate ray-sphere intersection where
  R0 is the 3D origin ray,
  Rd is the normalized 3D ray direction,
  sphereCenter is the 3D coordinates of the center of the sphere, and
- radius is the radius of the sphere
+ radius2 is the square of the radius of the sphere
  */
-extern inline float raycastSphere(float *R0, float *Rd, float *sphereCenter, float radius,
-                                  bool largestT);
+float raycastSphere(float *R0, float *Rd, float *sphereCenter, float radius2,
+                    bool largestT);
 
-extern inline void calculateNormalVector(Object *object, float *point, float *Rd, float *N);
+/**
+ Calculate the intersection t of the ray R0 + t * Rd with object, dispatching on its type
+ */
+float raycastObject(Object *object, float *R0, float *Rd, bool largestT);
+
+void calculateNormalVector(Object *object, float *point, float *Rd, float *N);
 
-extern inline void getIntersectionPoint(float *R0, float *Rd, float t, float *intersectionPoint);
+void getIntersectionPoint(float *R0, float *Rd, float t, float *intersectionPoint);
 
-extern inline float calculateIllumination(float radialAtt, float angularAtt, float diffuseColor,
-                                          float specularColor, float lightColor, float *L,
-                                          float *N, float *R, float *V, float ns);
+/**
+ Calculate the Phong illumination of a point by one light in all three color channels, where
+ attenuation is the product of the light's radial and angular attenuation, L is the normalized
+ vector to the light, N the surface normal, R the reflection of -L about N, V the normalized
+ vector to the viewer, and specularPower evaluates the specular exponent
+ */
+PixelN calculateIllumination(float attenuation, PixelN diffuseColor, PixelN specularColor,
+                             PixelN lightColor, float *L, float *N, float *R, float *V,
+                             const SpecularPower *specularPower);
 
-extern inline PixelN illuminate(SceneData *sceneData, Object *object, float *point,
-                                PixelN reflectionColor, PixelN refractionColor);
+PixelN illuminate(SceneData *sceneData, Object *object, float *point, float *N,
+                  PixelN reflectionColor, PixelN refractionColor);
 
-extern inline void raytrace(SceneData *sceneData, Object *object, float *point, float *Rd,
-                            int iterationNum, int x, int y, PixelN *reflectionColorOut,
-                            PixelN *refractionColorOut);
+/**
+ Follow the chain of mirror reflections starting where the ray R0 + t * Rd hits object at
+ nearestT. The hits are stored in hits (primary hit first, with room for RECURSION_DEPTH + 1) and
+ their number is returned. The chain ends at the first non-reflective object, the first reflection
+ that hits nothing, RECURSION_DEPTH bounces, or when its weight drops below
+ sceneData->minContribution.
+ */
+size_t traceReflections(SceneData *sceneData, Object *object, float *R0, float *Rd,
+                        float nearestT, ReflectionHit *hits);
 
-extern inline Object *raycast(SceneData *sceneData, float *R0, float *Rd, Object *ignoredObject,
-                              bool largestT, float *nearestT);
+Object *raycast(SceneData *sceneData, float *R0, float *Rd, Object *ignoredObject,
+                bool largestT, float *nearestT);
 
-extern inline void renderScene(SceneData *sceneData, Pixel *image);
+/**
+ Test whether the ray R0 + t * Rd hits any object other than ignoredObject with 0 < t < tMax.
+ Unlike raycast(), this returns on the first blocker found, which is all shadow rays need.
+ */
+bool raycastOccluded(SceneData *sceneData, float *R0, float *Rd, float tMax,
+                     Object *ignoredObject);
+
+/**
+ Find the nearest object hit by every ray of packet, all starting at R0, using the BVH when the
+ scene has one. Each ray gets the same result as raycast() with no ignored object.
+ */
+void raycastPacket(SceneData *sceneData, float *R0, RayPacket *packet);
+
+/**
+ Shade the primary ray R0 + t * Rd that hits nearestObject at nearestT. Its reflections and shadow
+ rays are traced one at a time, and every hit of the reflection chain is shaded once.
+ */
+PixelN shadePixel(SceneData *sceneData, Object *nearestObject, float *R0, float *Rd,
+                  float nearestT);
+
+Pixel toPixel(PixelN color);
+
+/**
+ Calculate the normalized direction Rd of the primary ray through the image position (x, y), where
+ pixel (i, j) covers [i, i + 1) x [j, j + 1)
+ */
+void primaryRayDirection(Camera *camera, float x, float y, float *Rd);
+
+/**
+ Place the camera at the origin looking down -z with +y up, the view of every loaded scene.
+ */
+void resetCameraView(Camera *camera);
+
+/**
+ Place the camera at position looking at target, with up (which need not be perpendicular to the
+ view direction) pointing toward the top of the image. Exits with an error if the view direction
+ is zero or parallel to up.
+ */
+void setCameraView(Camera *camera, const float *position, const float *target, const float *up);
+
+/**
+ Called with the partially rendered image after every progressive pass but the last
+ */
+typedef void (*PreviewFunction)(void *context, const Pixel *image);
+
+/**
+ Called with every band of numRows finished rows, from firstRow on, in order
+ */
+typedef void (*BandFunction)(void *context, const Pixel *rows, int firstRow, int numRows);
+
+/**
+ Render the pixels of tile into image, which holds the rows of the frame from row firstRow on (the
+ whole frame when it is 0), with one sample per pixel. Only pixels whose coordinates are both
+ multiples of stride are rendered, skipping those that are also multiples of coarserStride (unless
+ it is 0), and each fills the stride x stride block it starts. The index of the object seen by each
+ rendered pixel is stored in objectIds unless it is NULL.
+ */
+void renderTile(SceneData *sceneData, Pixel *image, int firstRow, uint32_t *objectIds,
+                const Tile *tile, int stride, int coarserStride);
+
+/**
+ Mark the pixels of tile whose color or object differs from a neighbor's in edges. image,
+ objectIds and edges start at row firstRow and must include the rows next to the tile.
+ */
+void findEdgeTile(SceneData *sceneData, Pixel *image, int firstRow, uint32_t *objectIds,
+                  bool *edges, const Tile *tile);
+
+/**
+ Replace the pixels of tile marked in edges by the average of sceneData->maxSamples stratified
+ samples. image and edges start at row firstRow.
+ */
+void supersampleTile(SceneData *sceneData, Pixel *image, int firstRow, bool *edges,
+                     const Tile *tile);
+
+/**
+ Render the whole frame into image, spreading its tiles over the threads of scheduler. In
+ progressive mode, preview(previewContext, image) is called after each coarse pass when preview
+ is not NULL.
+ */
+void renderScene(SceneData *sceneData, Pixel *image, TileScheduler *scheduler,
+                 PreviewFunction preview, void *previewContext);
+
+/**
+ Mark in dilated the tiles of a columns x rows grid (numbered row by row) that are in tiles or
+ next to one of them, diagonally included. Finding the edges of a set of tiles needs the first
+ pass of every dilated tile.
+ */
+void dilateTiles(const bool *tiles, int columns, int rows, bool *dilated);
+
+/**
+ Render only the tiles of the frame marked in dirtyTiles (one per TILE_SIZE square, row by row, or
+ every tile when it is NULL) into image, leaving the other pixels as they are. When
+ anti-aliasing, firstPass, objectIds and edges hold an entry per pixel and must be kept between
+ calls, since the edges of a tile are found by comparing the single-sample pixels around it; they
+ are not used otherwise. What each rendered tile depends on is recorded in dependencies unless it
+ is NULL. Progressive mode and heatmaps are not supported.
+ */
+void renderSceneTiles(SceneData *sceneData, Pixel *image, Pixel *firstPass, uint32_t *objectIds,
+                      bool *edges, const bool *dirtyTiles, struct TileDependencies *dependencies,
+                      TileScheduler *scheduler);
+
+/**
+ Render the frame in bands of bandHeight rows from the top, handing each to
+ output(outputContext, ...) as soon as it is finished, so only about one band is ever held in
+ memory. The image is the same as renderScene()'s; progressive mode and heatmaps are not supported.
+ */
+void renderSceneBands(SceneData *sceneData, int bandHeight, TileScheduler *scheduler,
+                      BandFunction output, void *outputContext);
+
+/**
+ Like renderSceneBands(), but only renders the pixels of the frame inside region, in bands of
+ bandHeight rows from its top. The rows handed to output span the width of the frame, of which only
+ the columns of region are set. Every pixel is the same as in a full render.
+ */
+void renderSceneRegion(SceneData *sceneData, const Tile *region, int bandHeight,
+                       TileScheduler *scheduler, BandFunction output, void *outputContext);
+
+/**
+ Make room for at least numObjects objects and numLights lights in sceneData, moving the existing
+ ones into a single new 64-byte aligned allocation if they do not fit. Slots past the existing
+ objects and lights are zeroed.
+ */
+void reserveSceneStorage(SceneData *sceneData, size_t numObjects, size_t numLights);
+
+/**
+ Free everything sceneData holds: its objects and lights, geometry, accelerators and specular
+ lookup tables.
+ */
+void freeSceneData(SceneData *sceneData);
+
+/**
+ Precompute the per-object and per-light constants used while rendering, then build the SoA
+ geometry and the accelerator chosen by sceneData->accelerator, recording its build time and
+ memory. Must be called once the objects and lights of sceneData are set (done by loadScene()).
+ */
+void compileScene(SceneData *sceneData);
 
-extern inline void parseSceneInput(FILE *inputFile, SceneData *sceneData);
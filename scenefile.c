@@ -0,0 +1,310 @@
+#include "scenefile.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "parser.h"
+#include "raytrace.h"
+#include "utils.h"
+
+_Static_assert(sizeof(SceneFileHeader) <= SCENE_FILE_HEADER_SIZE,
+               "The scene file header must fit before the first array");
+
+#define NUM_FIELDS(fields) (sizeof(fields) / sizeof(fields[0]))
+
+// Object and Light members stored as float arrays, in file order
+static const size_t planeFields[] = {
+    offsetof(Object, pn[0]), offsetof(Object, pn[1]), offsetof(Object, pn[2]), offsetof(Object, d)
+};
+
+static const size_t sphereFields[] = {
+    offsetof(Object, center[0]), offsetof(Object, center[1]), offsetof(Object, center[2]),
+    offsetof(Object, radius)
+};
+
+static const size_t quadricFields[] = {
+    offsetof(Object, quadricVars.a), offsetof(Object, quadricVars.b),
+    offsetof(Object, quadricVars.c), offsetof(Object, quadricVars.d),
+    offsetof(Object, quadricVars.e), offsetof(Object, quadricVars.f),
+    offsetof(Object, quadricVars.g), offsetof(Object, quadricVars.h),
+    offsetof(Object, quadricVars.i), offsetof(Object, quadricVars.j)
+};
+
+static const size_t materialFields[] = {
+    offsetof(Object, diffuseColor.r), offsetof(Object, diffuseColor.g),
+    offsetof(Object, diffuseColor.b), offsetof(Object, specularColor.r),
+    offsetof(Object, specularColor.g), offsetof(Object, specularColor.b),
+    offsetof(Object, reflectivity), offsetof(Object, refractivity), offsetof(Object, ior),
+    offsetof(Object, ns)
+};
+
+static const size_t lightFields[] = {
+    offsetof(Light, position[0]), offsetof(Light, position[1]), offsetof(Light, position[2]),
+    offsetof(Light, direction[0]), offsetof(Light, direction[1]), offsetof(Light, direction[2]),
+    offsetof(Light, color.r), offsetof(Light, color.g), offsetof(Light, color.b),
+    offsetof(Light, radialA0), offsetof(Light, radialA1), offsetof(Light, radialA2),
+    offsetof(Light, angularA0), offsetof(Light, theta)
+};
+
+typedef struct PrimitiveLayout {
+    ObjectType type;
+    const size_t *fields;
+    size_t numFields;
+} PrimitiveLayout;
+
+static const PrimitiveLayout primitiveLayouts[] = {
+    { PLANE, planeFields, NUM_FIELDS(planeFields) },
+    { SPHERE, sphereFields, NUM_FIELDS(sphereFields) },
+    { QUADRIC, quadricFields, NUM_FIELDS(quadricFields) }
+};
+
+static inline float *fieldOf(const void *record, size_t offset) {
+    return (float *) ((const char *) record + offset);
+}
+
+static size_t alignedSize(size_t size) {
+    return (size + SCENE_FILE_ALIGNMENT - 1) / SCENE_FILE_ALIGNMENT * SCENE_FILE_ALIGNMENT;
+}
+
+// Next array of count elements in the mapped file, checked against its size
+static const void *mappedArray(const char *file, size_t fileSize, size_t *cursor, size_t count,
+                               size_t elementSize, const char *fileName) {
+    const void *array = file + *cursor;
+
+    checkError(count > (fileSize - *cursor) / elementSize,
+               "Error: Scene file \"%s\" is truncated!\n", fileName);
+    *cursor += alignedSize(count * elementSize);
+    *cursor = *cursor < fileSize ? *cursor : fileSize;
+
+    return array;
+}
+
+static void loadSceneFile(const char *file, size_t fileSize, const char *fileName,
+                          SceneData *sceneData) {
+    checkError(fileSize < SCENE_FILE_HEADER_SIZE, "Error: Scene file \"%s\" is truncated!\n",
+               fileName);
+
+    SceneFileHeader header;
+    memcpy(&header, file, sizeof(header));
+
+    checkError(header.version != SCENE_FILE_VERSION,
+               "Error: Scene file \"%s\" has version %u, expected %u!\n", fileName,
+               header.version, SCENE_FILE_VERSION);
+    checkError(header.byteOrder != SCENE_FILE_BYTE_ORDER,
+               "Error: Scene file \"%s\" was written on a machine of a different byte order!\n",
+               fileName);
+    checkError(header.fileSize != fileSize, "Error: Scene file \"%s\" is corrupt!\n", fileName);
+
+    // Every element takes at least this many bytes after the header, so larger counts are
+    //   rejected before any storage is reserved for them
+    size_t payloadSize = fileSize - SCENE_FILE_HEADER_SIZE;
+    bool countsFit = header.numObjects <= payloadSize / (NUM_FIELDS(materialFields) * sizeof(float))
+                     && header.numLights <= payloadSize / (NUM_FIELDS(lightFields) * sizeof(float)
+                                                           + sizeof(uint32_t));
+
+    const uint64_t primitiveCounts[] = { header.numPlanes, header.numSpheres, header.numQuadrics };
+    uint64_t numPrimitives = 0;
+
+    for (size_t layout = 0; layout < NUM_FIELDS(primitiveLayouts); layout++) {
+        uint64_t count = primitiveCounts[layout];
+
+        countsFit = countsFit && count <= UINT64_MAX - numPrimitives
+                    && count <= payloadSize / (primitiveLayouts[layout].numFields * sizeof(float)
+                                               + sizeof(uint32_t));
+        numPrimitives += countsFit ? count : 0;
+    }
+
+    checkError(!countsFit || numPrimitives != header.numObjects,
+               "Error: Scene file \"%s\" is corrupt!\n", fileName);
+
+    size_t numObjects = header.numObjects, numLights = header.numLights;
+    reserveSceneStorage(sceneData, numObjects, numLights);
+
+    size_t cursor = SCENE_FILE_HEADER_SIZE;
+
+    for (size_t layout = 0; layout < NUM_FIELDS(primitiveLayouts); layout++) {
+        const PrimitiveLayout *primitive = &primitiveLayouts[layout];
+        size_t count = primitiveCounts[layout];
+        const float *arrays[NUM_FIELDS(quadricFields)];
+
+        for (size_t field = 0; field < primitive->numFields; field++)
+            arrays[field] = mappedArray(file, fileSize, &cursor, count, sizeof(float), fileName);
+
+        const uint32_t *objectIndices = mappedArray(file, fileSize, &cursor, count,
+                                                    sizeof(uint32_t), fileName);
+
+        for (size_t slot = 0; slot < count; slot++) {
+            checkError(objectIndices[slot] >= numObjects, "Error: Scene file \"%s\" is corrupt!\n",
+                       fileName);
+
+            Object *object = &sceneData->objects[objectIndices[slot]];
+            object->type = primitive->type;
+
+            for (size_t field = 0; field < primitive->numFields; field++)
+                *fieldOf(object, primitive->fields[field]) = arrays[field][slot];
+        }
+    }
+
+    for (size_t field = 0; field < NUM_FIELDS(materialFields); field++) {
+        const float *values = mappedArray(file, fileSize, &cursor, numObjects, sizeof(float),
+                                          fileName);
+
+        for (size_t index = 0; index < numObjects; index++)
+            *fieldOf(&sceneData->objects[index], materialFields[field]) = values[index];
+    }
+
+    for (size_t field = 0; field < NUM_FIELDS(lightFields); field++) {
+        const float *values = mappedArray(file, fileSize, &cursor, numLights, sizeof(float),
+                                          fileName);
+
+        for (size_t index = 0; index < numLights; index++)
+            *fieldOf(&sceneData->lights[index], lightFields[field]) = values[index];
+    }
+
+    const uint32_t *lightTypes = mappedArray(file, fileSize, &cursor, numLights,
+                                             sizeof(uint32_t), fileName);
+
+    for (size_t index = 0; index < numLights; index++) {
+        Light *light = &sceneData->lights[index];
+        light->type = lightTypes[index] == SPOT ? SPOT : POINT;
+        light->cosTheta = cosf(light->theta);
+    }
+
+    sceneData->numObjects = numObjects;
+    sceneData->numLights = numLights;
+    sceneData->camera.vpWidth = header.vpWidth;
+    sceneData->camera.vpHeight = header.vpHeight;
+    resetCameraView(&sceneData->camera);
+
+    compileScene(sceneData);
+}
+
+void loadScene(const char *fileName, SceneData *sceneData) {
+    int fd = open(fileName, O_RDONLY);
+    checkError(fd < 0, "Error: Could not open input file \"%s\"!\n", fileName);
+
+    struct stat fileStat;
+    checkError(fstat(fd, &fileStat) != 0, "Error: Could not read input file \"%s\"!\n", fileName);
+
+    // Both formats are read straight from the mapping, in one pass
+    size_t fileSize = fileStat.st_size;
+    const char *file = "";
+
+    if (fileSize > 0) {
+        file = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        checkError(file == MAP_FAILED, "Error: Could not map input file \"%s\"!\n", fileName);
+        madvise((void *) file, fileSize, MADV_SEQUENTIAL);
+    }
+
+    close(fd);
+
+    loadSceneData(file, fileSize, fileName, sceneData);
+
+    if (fileSize > 0)
+        munmap((void *) file, fileSize);
+}
+
+void loadSceneData(const char *data, size_t size, const char *fileName, SceneData *sceneData) {
+    if (size >= sizeof(SCENE_FILE_MAGIC)
+        && memcmp(data, SCENE_FILE_MAGIC, sizeof(SCENE_FILE_MAGIC)) == 0)
+        loadSceneFile(data, size, fileName, sceneData);
+    else
+        parseSceneInput(data, size, fileName, sceneData);
+}
+
+// Write count elements followed by zeros up to the next array boundary
+static void writeArray(FILE *file, const void *array, size_t count, size_t elementSize) {
+    static const char padding[SCENE_FILE_ALIGNMENT];
+    size_t size = count * elementSize;
+
+    fwrite(array, elementSize, count, file);
+    fwrite(padding, 1, alignedSize(size) - size, file);
+}
+
+void writeSceneFile(const char *fileName, const SceneData *sceneData) {
+    size_t numObjects = sceneData->numObjects, numLights = sceneData->numLights;
+    uint64_t primitiveCounts[NUM_FIELDS(primitiveLayouts)] = { 0 };
+
+    for (size_t index = 0; index < numObjects; index++)
+        primitiveCounts[sceneData->objects[index].type]++;
+
+    size_t bufferSize = numObjects > numLights ? numObjects : numLights;
+    float *values = malloc((bufferSize > 0 ? bufferSize : 1) * sizeof(float));
+    uint32_t *indices = malloc((bufferSize > 0 ? bufferSize : 1) * sizeof(uint32_t));
+    checkError(values == NULL || indices == NULL,
+               "Error: Could not allocate memory to write the scene file!\n");
+
+    FILE *file = fopen(fileName, "wb");
+    checkError(file == NULL, "Error: Could not open output file \"%s\"!\n", fileName);
+
+    SceneFileHeader header = {
+        .magic = SCENE_FILE_MAGIC,
+        .version = SCENE_FILE_VERSION,
+        .byteOrder = SCENE_FILE_BYTE_ORDER,
+        .numObjects = numObjects,
+        .numPlanes = primitiveCounts[PLANE],
+        .numSpheres = primitiveCounts[SPHERE],
+        .numQuadrics = primitiveCounts[QUADRIC],
+        .numLights = numLights,
+        .vpWidth = sceneData->camera.vpWidth,
+        .vpHeight = sceneData->camera.vpHeight
+    };
+
+    // The header is written once the file size is known
+    static const char headerSpace[SCENE_FILE_HEADER_SIZE];
+    fwrite(headerSpace, 1, SCENE_FILE_HEADER_SIZE, file);
+
+    for (size_t layout = 0; layout < NUM_FIELDS(primitiveLayouts); layout++) {
+        const PrimitiveLayout *primitive = &primitiveLayouts[layout];
+        size_t count = 0;
+
+        for (size_t index = 0; index < numObjects; index++) {
+            if (sceneData->objects[index].type == primitive->type)
+                indices[count++] = index;
+        }
+
+        for (size_t field = 0; field < primitive->numFields; field++) {
+            for (size_t slot = 0; slot < count; slot++)
+                values[slot] = *fieldOf(&sceneData->objects[indices[slot]],
+                                        primitive->fields[field]);
+
+            writeArray(file, values, count, sizeof(float));
+        }
+
+        writeArray(file, indices, count, sizeof(uint32_t));
+    }
+
+    for (size_t field = 0; field < NUM_FIELDS(materialFields); field++) {
+        for (size_t index = 0; index < numObjects; index++)
+            values[index] = *fieldOf(&sceneData->objects[index], materialFields[field]);
+
+        writeArray(file, values, numObjects, sizeof(float));
+    }
+
+    for (size_t field = 0; field < NUM_FIELDS(lightFields); field++) {
+        for (size_t index = 0; index < numLights; index++)
+            values[index] = *fieldOf(&sceneData->lights[index], lightFields[field]);
+
+        writeArray(file, values, numLights, sizeof(float));
+    }
+
+    for (size_t index = 0; index < numLights; index++)
+        indices[index] = sceneData->lights[index].type;
+
+    writeArray(file, indices, numLights, sizeof(uint32_t));
+
+    header.fileSize = ftell(file);
+    checkError(fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1
+               || fclose(file) != 0,
+               "Error: Could not write output file \"%s\"!\n", fileName);
+
+    free(values);
+    free(indices);
+}
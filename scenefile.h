@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// First bytes of every binary scene file
+#define SCENE_FILE_MAGIC "RTSCENE"
+
+// Bumped whenever the layout below changes; older files are rejected
+#define SCENE_FILE_VERSION 1
+
+// Written as a native uint32_t so files from a machine of the other byte order are rejected
+#define SCENE_FILE_BYTE_ORDER 0x01020304
+
+// Every array starts on a cache line, the first one right after the header
+#define SCENE_FILE_ALIGNMENT 64
+#define SCENE_FILE_HEADER_SIZE 128
+
+struct SceneData;
+
+/**
+ Header of a binary scene file. It is followed by float arrays with one entry per primitive of a
+ type, each starting on a SCENE_FILE_ALIGNMENT boundary:
+ - planes: normal x, y, z, d, then their uint32_t object indices
+ - spheres: center x, y, z, radius, then their uint32_t object indices
+ - quadrics: constants a to j, then their uint32_t object indices
+ - materials of every object in index order: diffuse r, g, b, specular r, g, b, reflectivity,
+   refractivity, ior, ns
+ - lights: position x, y, z, direction x, y, z, color r, g, b, radial a0, a1, a2, angular a0,
+   theta (radians), then their uint32_t types
+ */
+typedef struct SceneFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t fileSize;
+    uint64_t numObjects, numPlanes, numSpheres, numQuadrics, numLights;
+    float vpWidth, vpHeight;
+} SceneFileHeader;
+
+/**
+ Load the scene in fileName into sceneData, which is compiled and ready to render afterwards.
+ The file is memory-mapped; binary scene files are copied straight into the scene and anything
+ else is parsed as a text scene with parseSceneInput(). Exits with an error if the file cannot be
+ read.
+ */
+void loadScene(const char *fileName, struct SceneData *sceneData);
+
+/**
+ Load the scene in the size bytes at data, a binary scene file (4-byte aligned) or a text scene,
+ into sceneData like loadScene(). fileName names the scene in errors.
+ */
+void loadSceneData(const char *data, size_t size, const char *fileName,
+                   struct SceneData *sceneData);
+
+/**
+ Write the objects, lights and camera of sceneData to fileName as a binary scene file.
+ */
+void writeSceneFile(const char *fileName, const struct SceneData *sceneData);
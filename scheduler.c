@@ -0,0 +1,294 @@
+#include "scheduler.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+static inline uint64_t packRange(uint32_t front, uint32_t back) {
+    return ((uint64_t) back << 32) | front;
+}
+
+static bool takeFront(TileDeque *deque, uint32_t *tileIndex) {
+    uint64_t range = atomic_load(&deque->range);
+
+    for (;;) {
+        uint32_t front = (uint32_t) range;
+        uint32_t back = (uint32_t) (range >> 32);
+
+        if (front >= back)
+            return false;
+
+        // On failure range is reloaded and the loop retries with the new value
+        if (atomic_compare_exchange_weak(&deque->range, &range, packRange(front + 1, back))) {
+            *tileIndex = front;
+            return true;
+        }
+    }
+}
+
+static bool stealHalf(TileDeque *deque, uint32_t *first, uint32_t *last) {
+    uint64_t range = atomic_load(&deque->range);
+
+    for (;;) {
+        uint32_t front = (uint32_t) range;
+        uint32_t back = (uint32_t) (range >> 32);
+
+        if (front >= back)
+            return false;
+
+        // Round up so a single remaining tile can be stolen too
+        uint32_t newBack = back - (back - front + 1) / 2;
+
+        if (atomic_compare_exchange_weak(&deque->range, &range, packRange(front, newBack))) {
+            *first = newBack;
+            *last = back;
+            return true;
+        }
+    }
+}
+
+static void processTiles(TileScheduler *scheduler, int self) {
+    TileDeque *ownDeque = &scheduler->deques[self];
+    uint32_t tileIndex;
+
+    if (scheduler->everyThread) {
+        scheduler->function(scheduler->context, NULL);
+        return;
+    }
+
+    for (;;) {
+        if (atomic_load_explicit(&scheduler->failed, memory_order_relaxed))
+            return;
+
+        if (takeFront(ownDeque, &tileIndex)) {
+            scheduler->function(scheduler->context, &scheduler->tiles[tileIndex]);
+            continue;
+        }
+
+        // Out of work: move half of another thread's remaining range into our own deque. No
+        //   tiles are added during a job, so once every deque is empty the job is finished.
+        uint32_t first = 0, last = 0;
+        bool stolen = false;
+
+        for (int offset = 1; offset < scheduler->numThreads && !stolen; offset++) {
+            int victim = (self + offset) % scheduler->numThreads;
+            stolen = stealHalf(&scheduler->deques[victim], &first, &last);
+        }
+
+        if (!stolen)
+            return;
+
+        atomic_store(&ownDeque->range, packRange(first + 1, last));
+        scheduler->function(scheduler->context, &scheduler->tiles[first]);
+    }
+}
+
+// processTiles() with checkError() caught, so an error on a render thread neither exits the
+//   process nor leaves the job while other threads still work on it
+static void processTilesCaught(TileScheduler *scheduler, int self) {
+    jmp_buf jump;
+    jmp_buf *previousJump = errorJump;
+
+    if (setjmp(jump) == 0) {
+        errorJump = &jump;
+        processTiles(scheduler, self);
+    }
+    else {
+        pthread_mutex_lock(&scheduler->mutex);
+
+        if (!atomic_load(&scheduler->failed)) {
+            snprintf(scheduler->errorMessage, sizeof(scheduler->errorMessage), "%s",
+                     errorMessage);
+            atomic_store(&scheduler->failed, true);
+        }
+
+        pthread_mutex_unlock(&scheduler->mutex);
+    }
+
+    errorJump = previousJump;
+}
+
+static void *workerMain(void *argument) {
+    TileWorker *worker = argument;
+    TileScheduler *scheduler = worker->scheduler;
+    uint64_t seenGeneration = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&scheduler->mutex);
+
+        while (!scheduler->shuttingDown && scheduler->generation == seenGeneration)
+            pthread_cond_wait(&scheduler->jobReady, &scheduler->mutex);
+
+        if (scheduler->shuttingDown) {
+            pthread_mutex_unlock(&scheduler->mutex);
+            return NULL;
+        }
+
+        seenGeneration = scheduler->generation;
+        pthread_mutex_unlock(&scheduler->mutex);
+
+        processTilesCaught(scheduler, worker->index);
+
+        pthread_mutex_lock(&scheduler->mutex);
+
+        if (--scheduler->numBusy == 0)
+            pthread_cond_signal(&scheduler->jobDone);
+
+        pthread_mutex_unlock(&scheduler->mutex);
+    }
+}
+
+int defaultThreadCount(void) {
+    long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return numCpus > 0 ? (int) numCpus : 1;
+}
+
+void createTileScheduler(TileScheduler *scheduler, int numThreads) {
+    *scheduler = (TileScheduler) {};
+    scheduler->numThreads = numThreads > 0 ? numThreads : defaultThreadCount();
+
+    scheduler->workers = calloc(scheduler->numThreads, sizeof(TileWorker));
+    scheduler->deques = aligned_alloc(_Alignof(TileDeque),
+                                      scheduler->numThreads * sizeof(TileDeque));
+    checkError(!scheduler->workers || !scheduler->deques,
+               "Error: Could not allocate memory for %i threads!\n", scheduler->numThreads);
+
+    for (int index = 0; index < scheduler->numThreads; index++)
+        atomic_init(&scheduler->deques[index].range, 0);
+
+    atomic_init(&scheduler->failed, false);
+
+    pthread_mutex_init(&scheduler->mutex, NULL);
+    pthread_cond_init(&scheduler->jobReady, NULL);
+    pthread_cond_init(&scheduler->jobDone, NULL);
+
+    // Thread 0 is whichever thread calls runTiles()
+    for (int index = 1; index < scheduler->numThreads; index++) {
+        TileWorker *worker = &scheduler->workers[index];
+        worker->scheduler = scheduler;
+        worker->index = index;
+
+        checkError(pthread_create(&worker->thread, NULL, workerMain, worker) != 0,
+                   "Error: Could not start render thread %i!\n", index);
+    }
+}
+
+void destroyTileScheduler(TileScheduler *scheduler) {
+    pthread_mutex_lock(&scheduler->mutex);
+    scheduler->shuttingDown = true;
+    pthread_cond_broadcast(&scheduler->jobReady);
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    for (int index = 1; index < scheduler->numThreads; index++)
+        pthread_join(scheduler->workers[index].thread, NULL);
+
+    pthread_cond_destroy(&scheduler->jobDone);
+    pthread_cond_destroy(&scheduler->jobReady);
+    pthread_mutex_destroy(&scheduler->mutex);
+
+    free(scheduler->tiles);
+    free(scheduler->deques);
+    free(scheduler->workers);
+    *scheduler = (TileScheduler) {};
+}
+
+static void buildTiles(TileScheduler *scheduler, int width, int height) {
+    int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    size_t numTiles = (size_t) tilesX * tilesY;
+
+    if (numTiles > scheduler->tileCapacity) {
+        free(scheduler->tiles);
+        scheduler->tiles = malloc(numTiles * sizeof(Tile));
+        checkError(!scheduler->tiles, "Error: Could not allocate memory for %zu tiles!\n",
+                   numTiles);
+        scheduler->tileCapacity = numTiles;
+    }
+
+    // Walk the Morton curve of the smallest power-of-two square covering the tile grid,
+    //   skipping codes that fall outside of it
+    uint32_t side = 1;
+    while (side < (uint32_t) tilesX || side < (uint32_t) tilesY)
+        side <<= 1;
+
+    size_t count = 0;
+
+    for (uint64_t code = 0; code < (uint64_t) side * side && count < numTiles; code++) {
+        uint32_t tileX = 0, tileY = 0;
+
+        for (int bit = 0; bit < 16; bit++) {
+            tileX |= ((code >> (2 * bit)) & 1) << bit;
+            tileY |= ((code >> (2 * bit + 1)) & 1) << bit;
+        }
+
+        if (tileX >= (uint32_t) tilesX || tileY >= (uint32_t) tilesY)
+            continue;
+
+        Tile *tile = &scheduler->tiles[count++];
+        tile->x = tileX * TILE_SIZE;
+        tile->y = tileY * TILE_SIZE;
+        tile->width = width - tile->x < TILE_SIZE ? width - tile->x : TILE_SIZE;
+        tile->height = height - tile->y < TILE_SIZE ? height - tile->y : TILE_SIZE;
+    }
+
+    scheduler->numTiles = count;
+}
+
+// Hand the job set up in scheduler to every thread, work on it as thread 0 and wait for the rest,
+//   then raise the first error any of them hit
+static void runJob(TileScheduler *scheduler) {
+    pthread_mutex_lock(&scheduler->mutex);
+    scheduler->generation++;
+    scheduler->numBusy = scheduler->numThreads - 1;
+    pthread_cond_broadcast(&scheduler->jobReady);
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    processTilesCaught(scheduler, 0);
+
+    pthread_mutex_lock(&scheduler->mutex);
+
+    while (scheduler->numBusy > 0)
+        pthread_cond_wait(&scheduler->jobDone, &scheduler->mutex);
+
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    if (atomic_load(&scheduler->failed)) {
+        atomic_store(&scheduler->failed, false);
+        raiseError(scheduler->errorMessage);
+    }
+}
+
+void runTiles(TileScheduler *scheduler, int width, int height, TileFunction function,
+              void *context) {
+    if (width <= 0 || height <= 0)
+        return;
+
+    buildTiles(scheduler, width, height);
+    scheduler->function = function;
+    scheduler->context = context;
+    scheduler->everyThread = false;
+
+    // Give every thread an equal contiguous stretch of the curve to start with
+    size_t numTiles = scheduler->numTiles;
+    int numThreads = scheduler->numThreads;
+
+    for (int index = 0; index < numThreads; index++) {
+        uint32_t front = numTiles * index / numThreads;
+        uint32_t back = numTiles * (index + 1) / numThreads;
+        atomic_store(&scheduler->deques[index].range, packRange(front, back));
+    }
+
+    runJob(scheduler);
+}
+
+void runOnEveryThread(TileScheduler *scheduler, TileFunction function, void *context) {
+    scheduler->function = function;
+    scheduler->context = context;
+    scheduler->everyThread = true;
+
+    runJob(scheduler);
+}
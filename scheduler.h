@@ -0,0 +1,99 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "utils.h"
+
+// Side length in pixels of the square tiles an image is split into (a multiple of the ray packet
+//   width so packets never straddle tiles)
+#define TILE_SIZE 32
+
+typedef struct Tile {
+    int x, y;
+    int width, height;
+} Tile;
+
+/**
+ Work done for one tile, called by whichever thread claimed it
+ */
+typedef void (*TileFunction)(void *context, const Tile *tile);
+
+/**
+ Contiguous range of tiles owned by one thread. The owner takes tiles from the front while idle
+ threads steal the back half, each with a single compare-and-swap on the packed range (front in
+ the low 32 bits, back in the high 32 bits). Padded to a cache line to avoid false sharing.
+ */
+typedef struct TileDeque {
+    _Alignas(64) _Atomic uint64_t range;
+} TileDeque;
+
+typedef struct TileWorker {
+    struct TileScheduler *scheduler;
+    int index;
+    pthread_t thread;
+} TileWorker;
+
+/**
+ Persistent pool of threads rendering tiles. The calling thread of runTiles() works as thread 0,
+ so a scheduler with one thread starts no extra threads.
+ */
+typedef struct TileScheduler {
+    int numThreads;
+    TileWorker *workers;
+    TileDeque *deques;
+
+    // Current job, in Morton order so neighboring tiles (and their cache lines) stay together
+    Tile *tiles;
+    size_t numTiles, tileCapacity;
+    TileFunction function;
+    void *context;
+
+    // Set for jobs from runOnEveryThread(), which call function once per thread instead of per tile
+    bool everyThread;
+
+    // First checkError() raised by a thread during the current job, raised again by runTiles() or
+    //   runOnEveryThread() once every thread is done. The remaining tiles are skipped.
+    _Atomic bool failed;
+    char errorMessage[ERROR_MESSAGE_LENGTH];
+
+    pthread_mutex_t mutex;
+    pthread_cond_t jobReady, jobDone;
+    uint64_t generation;
+    int numBusy;
+    bool shuttingDown;
+} TileScheduler;
+
+/**
+ Number of online CPUs, used when no thread count is given
+ */
+int defaultThreadCount(void);
+
+/**
+ Start a scheduler with numThreads threads (including the caller). A numThreads of 0 uses
+ defaultThreadCount().
+ */
+void createTileScheduler(TileScheduler *scheduler, int numThreads);
+
+/**
+ Stop and join the threads of scheduler and free its memory.
+ */
+void destroyTileScheduler(TileScheduler *scheduler);
+
+/**
+ Split a width x height image into TILE_SIZE tiles and call function(context, tile) once for every
+ tile, spread over all threads of scheduler. Returns when every tile is done. A checkError() in
+ function on any thread ends the job early and is raised on the calling thread once all threads
+ have stopped.
+ */
+void runTiles(TileScheduler *scheduler, int width, int height, TileFunction function,
+              void *context);
+
+/**
+ Call function(context, NULL) exactly once on every thread of scheduler, for example to collect
+ thread-local data. Returns when every call is done. Errors are raised like in runTiles().
+ */
+void runOnEveryThread(TileScheduler *scheduler, TileFunction function, void *context);
@@ -0,0 +1,102 @@
+#include "specular.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "raytrace.h"
+#include "utils.h"
+
+// Samples per table interval when measuring the error
+#define ERROR_SAMPLES_PER_INTERVAL 4
+
+float maxSpecularError(const SpecularPower *power) {
+    float maxError = 0;
+
+    for (int index = 1; index <= SPECULAR_TABLE_SIZE * ERROR_SAMPLES_PER_INTERVAL; index++) {
+        float x = (float) index / (SPECULAR_TABLE_SIZE * ERROR_SAMPLES_PER_INTERVAL);
+        float error = fabsf(evaluateSpecular(power, x) - powf(x, power->ns));
+
+        // NaN errors count as too large
+        if (!(error <= maxError))
+            maxError = error;
+    }
+
+    return maxError;
+}
+
+static SpecularTable *findSpecularTable(SpecularTables *tables, float ns) {
+    for (size_t index = 0; index < tables->count; index++) {
+        if (tables->tables[index].ns == ns)
+            return &tables->tables[index];
+    }
+
+    return NULL;
+}
+
+static SpecularTable *addSpecularTable(SpecularTables *tables, float ns, SpecularMode mode) {
+    SpecularTable *grown = realloc(tables->tables, (tables->count + 1) * sizeof(SpecularTable));
+    checkError(grown == NULL, "Error: Could not allocate memory for specular tables!\n");
+    tables->tables = grown;
+
+    SpecularTable *table = &tables->tables[tables->count++];
+    table->ns = ns;
+    table->values = NULL;
+
+    if (mode == SPECULAR_TABLE) {
+        table->values = malloc((SPECULAR_TABLE_SIZE + 1) * sizeof(float));
+        checkError(table->values == NULL,
+                   "Error: Could not allocate memory for specular tables!\n");
+
+        for (int index = 0; index <= SPECULAR_TABLE_SIZE; index++)
+            table->values[index] = powf((float) index / SPECULAR_TABLE_SIZE, ns);
+    }
+
+    SpecularPower power = { mode, ns, table->values };
+    float maxError = maxSpecularError(&power);
+    table->accurate = maxError <= SPECULAR_MAX_ERROR;
+
+#ifndef NDEBUG
+    printf("buildSpecularTables: ns %g, max error %g%s\n", ns, maxError,
+           table->accurate ? "" : " (using powf)");
+#endif
+
+    return table;
+}
+
+void buildSpecularTables(SceneData *sceneData) {
+    SpecularTables *tables = &sceneData->specularTables;
+    SpecularMode mode = sceneData->specularMode;
+
+    freeSpecularTables(tables);
+
+    for (size_t index = 0; index < sceneData->numObjects; index++) {
+        Object *object = &sceneData->objects[index];
+        SpecularPower *power = &object->specularPower;
+
+        power->mode = SPECULAR_EXACT;
+        power->ns = object->ns;
+        power->table = NULL;
+
+        if (mode == SPECULAR_EXACT)
+            continue;
+
+        SpecularTable *table = findSpecularTable(tables, object->ns);
+
+        if (table == NULL)
+            table = addSpecularTable(tables, object->ns, mode);
+
+        if (table->accurate) {
+            power->mode = mode;
+            power->table = table->values;
+        }
+    }
+}
+
+void freeSpecularTables(SpecularTables *tables) {
+    for (size_t index = 0; index < tables->count; index++)
+        free(tables->tables[index].values);
+
+    free(tables->tables);
+    tables->tables = NULL;
+    tables->count = 0;
+}
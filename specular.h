@@ -0,0 +1,128 @@
+#pragma once
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Intervals of the lookup tables over [0, 1]
+#define SPECULAR_TABLE_SIZE 4096
+
+// Largest absolute error in x^ns allowed for tables and approximations. Materials whose exponent
+//   cannot meet it fall back to powf().
+#define SPECULAR_MAX_ERROR 1e-4f
+
+struct SceneData;
+
+typedef enum {
+    SPECULAR_EXACT  = 0, // powf()
+    SPECULAR_TABLE  = 1, // Linear interpolation in a per-exponent lookup table
+    SPECULAR_APPROX = 2  // fastPowf()
+} SpecularMode;
+
+/**
+ How an object evaluates its specular term x^ns, set up by buildSpecularTables()
+ */
+typedef struct SpecularPower {
+    SpecularMode mode;
+    float ns;
+
+    // SPECULAR_TABLE_SIZE + 1 samples of x^ns at x = i / SPECULAR_TABLE_SIZE
+    const float *table;
+} SpecularPower;
+
+/**
+ Exponent shared by one or more objects, with its lookup table (SPECULAR_TABLE only) and whether
+ the chosen mode meets SPECULAR_MAX_ERROR for it
+ */
+typedef struct SpecularTable {
+    float ns;
+    float *values;
+    bool accurate;
+} SpecularTable;
+
+typedef struct SpecularTables {
+    SpecularTable *tables;
+    size_t count;
+} SpecularTables;
+
+/**
+ Approximate x^y for x > 0 as 2^(y * log2(x)) with polynomial log2 and exp2. The relative error is
+ around 1e-6 times y for x <= 1.
+ */
+static inline float fastPowf(float x, float y) {
+    uint32_t xBits;
+    memcpy(&xBits, &x, sizeof(float));
+
+    // x = m * 2^e with m in [sqrt(1/2), sqrt(2)), so log2(m) is small on both sides of zero
+    int32_t e = ((int32_t) xBits - 0x3F3504F3) >> 23;
+    uint32_t mBits = xBits - ((uint32_t) e << 23);
+    float m;
+    memcpy(&m, &mBits, sizeof(float));
+
+    // log2(m) = 2 / ln(2) * atanh(t), using the odd series of atanh up to t^7
+    float t = (m - 1) / (m + 1);
+    float t2 = t * t;
+    float log2m = t * (2.88539008f + t2 * (0.961796694f + t2 * (0.577078016f
+                                                                + t2 * 0.412198583f)));
+    float exponent = y * (e + log2m);
+
+    if (exponent < -126)
+        return 0;
+
+    // 2^exponent = 2^n * e^(f * ln(2)) with f in (-0.5, 0.5] for the exponents of x <= 1
+    int n = (int) (exponent - 0.5f);
+    float u = (exponent - n) * 0.693147181f;
+    float p = 1 + u * (1 + u * (0.5f + u * (0.166666667f + u * (0.0416666667f
+                                                                + u * (0.00833333333f
+                                                                       + u * 0.00138888889f)))));
+
+    uint32_t scaleBits = (uint32_t) (n + 127) << 23;
+    float scale;
+    memcpy(&scale, &scaleBits, sizeof(float));
+
+    return p * scale;
+}
+
+/**
+ Evaluate x^ns for 0 < x <= 1 as set up in power
+ */
+static inline float evaluateSpecular(const SpecularPower *power, float x) {
+    switch (power->mode) {
+        case SPECULAR_TABLE: {
+            float position = x * SPECULAR_TABLE_SIZE;
+
+            if (!(position < SPECULAR_TABLE_SIZE))
+                return power->table[SPECULAR_TABLE_SIZE];
+
+            int index = (int) position;
+            float fraction = position - index;
+
+            return power->table[index] + (power->table[index + 1] - power->table[index])
+                                         * fraction;
+        }
+        case SPECULAR_APPROX:
+            return fastPowf(x, power->ns);
+        default:
+            return powf(x, power->ns);
+    }
+}
+
+/**
+ Largest absolute difference between evaluateSpecular(power, x) and powf(x, power->ns) over a
+ grid of x in (0, 1] that includes the midpoints between table samples
+ */
+float maxSpecularError(const SpecularPower *power);
+
+/**
+ Set up the SpecularPower of every object of sceneData for sceneData->specularMode, building one
+ lookup table per distinct exponent in tables mode. Exponents for which the mode does not meet
+ SPECULAR_MAX_ERROR use powf() instead.
+ */
+void buildSpecularTables(struct SceneData *sceneData);
+
+/**
+ Free the lookup tables of tables.
+ */
+void freeSpecularTables(SpecularTables *tables);
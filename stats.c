@@ -0,0 +1,119 @@
+#include "stats.h"
+
+#ifdef STATS
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+_Thread_local RenderStats threadStats;
+RenderStats renderStats;
+
+static pthread_mutex_t renderStatsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *phaseNames[NUM_PHASES] = { "parse", "render", "edges", "supersample", "write" };
+static const char *objectTypeNames[NUM_OBJECT_TYPES] = { "plane", "sphere", "quadric" };
+
+static void growObjectHits(RenderStats *stats, size_t numObjectHits) {
+    uint64_t *objectHits = realloc(stats->objectHits, numObjectHits * sizeof(uint64_t));
+    checkError(objectHits == NULL, "Error: Could not allocate memory for statistics!\n");
+
+    memset(objectHits + stats->numObjectHits, 0,
+           (numObjectHits - stats->numObjectHits) * sizeof(uint64_t));
+    stats->objectHits = objectHits;
+    stats->numObjectHits = numObjectHits;
+}
+
+void countObjectHit(size_t objectIndex) {
+    if (objectIndex >= threadStats.numObjectHits)
+        growObjectHits(&threadStats, objectIndex + 1);
+
+    threadStats.objectHits[objectIndex]++;
+}
+
+// Runs on every thread of the scheduler, so each adds its own thread-local counters
+static void mergeThreadStats(void *context, const Tile *tile) {
+    RenderStats *stats = &threadStats;
+
+    pthread_mutex_lock(&renderStatsMutex);
+
+    renderStats.primaryRays += stats->primaryRays;
+    renderStats.reflectionRays += stats->reflectionRays;
+    renderStats.shadowRays += stats->shadowRays;
+
+    for (int type = 0; type < NUM_OBJECT_TYPES; type++)
+        renderStats.intersectionTests[type] += stats->intersectionTests[type];
+
+    for (int bounce = 0; bounce <= RECURSION_DEPTH; bounce++)
+        renderStats.bounces[bounce] += stats->bounces[bounce];
+
+    if (stats->numObjectHits > renderStats.numObjectHits)
+        growObjectHits(&renderStats, stats->numObjectHits);
+
+    for (size_t index = 0; index < stats->numObjectHits; index++)
+        renderStats.objectHits[index] += stats->objectHits[index];
+
+    pthread_mutex_unlock(&renderStatsMutex);
+
+    // Freed here since pool threads may exit before the end of the program
+    free(stats->objectHits);
+    *stats = (RenderStats) {};
+}
+
+void mergeRenderStats(TileScheduler *scheduler) {
+    runOnEveryThread(scheduler, mergeThreadStats, NULL);
+}
+
+void printRenderStats(FILE *file, SceneData *sceneData) {
+    RenderStats *stats = &renderStats;
+    uint64_t totalTests = 0;
+
+    fprintf(file, "Rays: %llu total, %llu primary, %llu reflection, %llu shadow\n",
+            (unsigned long long) (stats->primaryRays + stats->reflectionRays + stats->shadowRays),
+            (unsigned long long) stats->primaryRays, (unsigned long long) stats->reflectionRays,
+            (unsigned long long) stats->shadowRays);
+
+    for (int type = 0; type < NUM_OBJECT_TYPES; type++)
+        totalTests += stats->intersectionTests[type];
+
+    fprintf(file, "Intersection tests: %llu total", (unsigned long long) totalTests);
+
+    for (int type = 0; type < NUM_OBJECT_TYPES; type++) {
+        fprintf(file, ", %llu %s", (unsigned long long) stats->intersectionTests[type],
+                objectTypeNames[type]);
+    }
+
+    fprintf(file, "\nBounces per reflection chain:\n");
+
+    for (int bounce = 0; bounce <= RECURSION_DEPTH; bounce++) {
+        if (stats->bounces[bounce] > 0) {
+            fprintf(file, "  %2i: %llu\n", bounce, (unsigned long long) stats->bounces[bounce]);
+        }
+    }
+
+    fprintf(file, "Hits per object:\n");
+
+    for (size_t index = 0; index < sceneData->numObjects; index++) {
+        uint64_t hits = index < stats->numObjectHits ? stats->objectHits[index] : 0;
+
+        fprintf(file, "  %3zu (%s): %llu\n", index, objectTypeNames[sceneData->objects[index].type],
+                (unsigned long long) hits);
+    }
+
+    fprintf(file, "Accelerator: %s, built in %.3f ms, %zu bytes\n",
+            acceleratorNames[sceneData->accelerator], sceneData->accelBuildMs,
+            sceneData->accelMemory);
+    fprintf(file, "Phase times:\n");
+
+    for (int phase = 0; phase < NUM_PHASES; phase++)
+        fprintf(file, "  %-12s %10.3f ms\n", phaseNames[phase], stats->phaseMs[phase]);
+}
+
+void freeRenderStats(void) {
+    free(renderStats.objectHits);
+    renderStats = (RenderStats) {};
+}
+
+#endif
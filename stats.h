@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "raytrace.h"
+#include "scheduler.h"
+
+#define NUM_OBJECT_TYPES 3
+
+typedef enum {
+    PHASE_PARSE       = 0,
+    PHASE_RENDER      = 1,
+    PHASE_EDGES       = 2,
+    PHASE_SUPERSAMPLE = 3,
+    PHASE_WRITE       = 4,
+    NUM_PHASES        = 5
+} RenderPhase;
+
+/**
+ Counters of where the rays of a render go. Every thread counts into its own threadStats, which
+ are summed into renderStats at the end of renderScene().
+ */
+typedef struct RenderStats {
+    uint64_t primaryRays, reflectionRays, shadowRays;
+
+    // Ray-primitive intersection tests, indexed by ObjectType
+    uint64_t intersectionTests[NUM_OBJECT_TYPES];
+
+    // Number of reflection chains that ended after each number of bounces
+    uint64_t bounces[RECURSION_DEPTH + 1];
+
+    // Primary and reflection hits per object index, grown as objects are hit
+    uint64_t *objectHits;
+    size_t numObjectHits;
+
+    // Wall time of each phase, only kept in renderStats
+    double phaseMs[NUM_PHASES];
+} RenderStats;
+
+// Statistics are only compiled in with -D STATS (make stats), otherwise the macros below expand
+//   to nothing and counting costs nothing
+#ifdef STATS
+
+extern _Thread_local RenderStats threadStats;
+extern RenderStats renderStats;
+
+#define STATS_ADD(counter, amount) (threadStats.counter += (amount))
+#define STATS_OBJECT_HIT(objectIndex) countObjectHit(objectIndex)
+#define STATS_PHASE_BEGIN(phase) double phase##Start = nowMs()
+#define STATS_PHASE_END(phase) (renderStats.phaseMs[phase] += nowMs() - phase##Start)
+
+/**
+ Count a hit on the object at objectIndex in threadStats
+ */
+void countObjectHit(size_t objectIndex);
+
+/**
+ Add the threadStats of every thread of scheduler (including the caller) to renderStats and reset
+ them. Called by renderScene() once all of its tiles are done.
+ */
+void mergeRenderStats(TileScheduler *scheduler);
+
+/**
+ Print renderStats for the objects of sceneData to file in a readable form.
+ */
+void printRenderStats(FILE *file, SceneData *sceneData);
+
+/**
+ Free the memory held by renderStats.
+ */
+void freeRenderStats(void);
+
+#else
+
+#define STATS_ADD(counter, amount) ((void) 0)
+#define STATS_OBJECT_HIT(objectIndex) ((void) 0)
+#define STATS_PHASE_BEGIN(phase)
+#define STATS_PHASE_END(phase) ((void) 0)
+
+#endif
@@ -1,18 +1,60 @@
 #include "utils.h"
 
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+
+// 64-bit FNV-1a parameters
+#define FNV_OFFSET_BASIS 0xCBF29CE484222325u
+#define FNV_PRIME 0x100000001B3u
+
+_Thread_local jmp_buf *errorJump;
+_Thread_local char errorMessage[ERROR_MESSAGE_LENGTH];
 
 void checkError(bool error, const char *errorFormat, ...) {
     va_list args;
     va_start(args, errorFormat);
 
     if (error) {
+        if (errorJump) {
+            vsnprintf(errorMessage, sizeof(errorMessage), errorFormat, args);
+            va_end(args);
+            longjmp(*errorJump, 1);
+        }
+
         vfprintf(stderr, errorFormat, args);
         exit(EXIT_FAILURE);
     }
 
     va_end(args);
 }
+
+void raiseError(const char *message) {
+    // message is usually errorMessage itself, which checkError() writes to
+    char copy[ERROR_MESSAGE_LENGTH];
+    snprintf(copy, sizeof(copy), "%s", message);
+
+    checkError(true, "%s", copy);
+}
+
+uint64_t hashBytes(const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    for (size_t index = 0; index < size; index++) {
+        hash ^= bytes[index];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+double nowMs(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return time.tv_sec * 1e3 + time.tv_nsec * 1e-6;
+}
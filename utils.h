@@ -1,8 +1,13 @@
 #pragma once
 
+#include <setjmp.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+// Longest message kept by checkError() for a thread with an errorJump, including the NUL
+#define ERROR_MESSAGE_LENGTH 1024
+
 typedef uint8_t PXCHANNEL;
 
 typedef struct Pixel {
@@ -20,4 +25,31 @@ typedef struct PixelN {
     PXNCHANNEL b;
 } PixelN;
 
+/**
+ When error is true, print the message formatted from errorFormat to stderr and exit, or, on a
+ thread whose errorJump is set, keep it in errorMessage and longjmp() there instead.
+ */
 void checkError(bool error, const char *errorFormat, ...);
+
+/**
+ Per-thread recovery point for checkError(), so a long-running process can fail one request and
+ go on with the next. Whatever the failed request allocated is left to the code at the jump.
+ */
+extern _Thread_local jmp_buf *errorJump;
+extern _Thread_local char errorMessage[ERROR_MESSAGE_LENGTH];
+
+/**
+ Raise message, kept from an error caught at an errorJump, again with checkError(), so code that
+ caught it to clean up can pass it on to the errorJump in place before it.
+ */
+void raiseError(const char *message);
+
+/**
+ 64-bit FNV-1a hash of size bytes at data
+ */
+uint64_t hashBytes(const void *data, size_t size);
+
+/**
+ Milliseconds on a monotonic clock, for measuring wall time
+ */
+double nowMs(void);
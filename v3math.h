@@ -11,72 +11,84 @@ typedef struct Vec3 {
 /**
  Form v3 from a to b
  */
-void f3_from_points(float *dst, float *a, float *b);
+static inline void f3_from_points(float *dst, float *a, float *b);
 
 /**
  Add vectors a and b and store result in dst
  */
-void f3_add(float *dst, float *a, float *b);
+static inline void f3_add(float *dst, float *a, float *b);
 
 /**
  Subtract vectors b from a and store result in dst
  */
-void f3_subtract(float *dst, float *a, float *b);
+static inline void f3_subtract(float *dst, float *a, float *b);
 
 /**
  Dot product of vectors a and b
  */
-float f3_dot(float *a, float *b);
+static inline float f3_dot(float *a, float *b);
 
 /**
  Cross product of vectors a and b, with the result stored in dst
  */
-void f3_cross(float *dst, float *a, float *b);
+static inline void f3_cross(float *dst, float *a, float *b);
 
 /**
  Scale the vector dst by s amount
  */
-void f3_scale(float *dst, float s);
+static inline void f3_scale(float *dst, float s);
 
 /**
  Angle between a and b
  */
-float f3_angle(float *a, float *b);
+static inline float f3_angle(float *a, float *b);
 
 /**
  Reflection v about n
  */
-void f3_reflect(float *dst, float *v, float *n);
+static inline void f3_reflect(float *dst, float *v, float *n);
 
 /**
  Length of vector a
  */
-float f3_length(float *a);
+static inline float f3_length(float *a);
 
 /**
  Normalize vector dst to length of 1
  */
-void f3_normalize(float *dst, float *a);
+static inline void f3_normalize(float *dst, float *a);
 
 /**
  Test if two vectors, a and b, are equal within the specified tolerance
  */
-bool f3_equals(float *a, float *b, float tolerance);
+static inline bool f3_equals(float *a, float *b, float tolerance);
 
 /**
  Test if two floats, a and b, are equal within the specified tolerance
  */
-bool f_equals(float a, float b, float tolerance);
+static inline bool f_equals(float a, float b, float tolerance);
+
+/**
+ Minimum of a and b. Unlike fminf(), this compiles to a single instruction without -ffast-math,
+ but does not handle NaN specially.
+ */
+static inline float f_min(float a, float b);
+
+/**
+ Maximum of a and b. Unlike fmaxf(), this compiles to a single instruction without -ffast-math,
+ but does not handle NaN specially.
+ */
+static inline float f_max(float a, float b);
 
 /**
  Clamps value d between the values min and max
  */
-float f_clamp(float d, float min, float max);
+static inline float f_clamp(float d, float min, float max);
 
 /**
  Converts degrees to radians
  */
-float f_to_radians(float degrees);
+static inline float f_to_radians(float degrees);
 
 
 
@@ -84,23 +96,23 @@ float f_to_radians(float degrees);
 // ##################    Inlined function definitions    ##################
 // ########################################################################
 
-inline void f3_from_points(float *dst, float *a, float *b) {
+static inline void f3_from_points(float *dst, float *a, float *b) {
     f3_subtract(dst, b, a);
 }
 
-inline void f3_add(float *dst, float *a, float *b) {
+static inline void f3_add(float *dst, float *a, float *b) {
     dst[0] = a[0] + b[0];
     dst[1] = a[1] + b[1];
     dst[2] = a[2] + b[2];
 }
 
-inline void f3_subtract(float *dst, float *a, float *b) {
+static inline void f3_subtract(float *dst, float *a, float *b) {
     dst[0] = a[0] - b[0];
     dst[1] = a[1] - b[1];
     dst[2] = a[2] - b[2];
 }
 
-inline float f3_dot(float *a, float *b) {
+static inline float f3_dot(float *a, float *b) {
     float result;
 
     result =  a[0] * b[0];
@@ -110,7 +122,7 @@ inline float f3_dot(float *a, float *b) {
     return result;
 }
 
-inline void f3_cross(float *dst, float *a, float *b) {
+static inline void f3_cross(float *dst, float *a, float *b) {
     int x = 0, y = 1, z = 2;
     float dstTmp[3] = {};
     
@@ -123,17 +135,17 @@ inline void f3_cross(float *dst, float *a, float *b) {
     dst[2] = dstTmp[2];
 }
 
-inline void f3_scale(float *dst, float s) {
+static inline void f3_scale(float *dst, float s) {
     dst[0] *= s;
     dst[1] *= s;
     dst[2] *= s;
 }
 
-inline float f3_angle(float *a, float *b) {
+static inline float f3_angle(float *a, float *b) {
     return acosf(f3_dot(a, b) / (f3_length(a) * f3_length(b)));
 }
 
-inline void f3_reflect(float *dst, float *v, float *n) {
+static inline void f3_reflect(float *dst, float *v, float *n) {
     float nTmp[3] = { n[0], n[1], n[2] };
 
     float scale = -2 * f3_dot(v, nTmp);
@@ -141,13 +153,13 @@ inline void f3_reflect(float *dst, float *v, float *n) {
     f3_add(dst, nTmp, v);
 }
 
-inline float f3_length(float *a) {
+static inline float f3_length(float *a) {
     int x = 0, y = 1, z = 2;
 
     return sqrtf(a[x]*a[x] + a[y]*a[y] + a[z]*a[z]);
 }
 
-inline void f3_normalize(float *dst, float *a) {
+static inline void f3_normalize(float *dst, float *a) {
     float lengthInverse = 1 / f3_length(a);
     
     dst[0] = a[0] * lengthInverse;
@@ -155,7 +167,7 @@ inline void f3_normalize(float *dst, float *a) {
     dst[2] = a[2] * lengthInverse;
 }
 
-inline bool f3_equals(float *a, float *b, float tolerance) {
+static inline bool f3_equals(float *a, float *b, float tolerance) {
     float dst[3] = {};
     
     f3_subtract(dst, a, b);
@@ -167,16 +179,24 @@ inline bool f3_equals(float *a, float *b, float tolerance) {
     return dst[0] <= tolerance && dst[1] <= tolerance && dst[2] <= tolerance;
 }
 
-inline bool f_equals(float a, float b, float tolerance) {
+static inline bool f_equals(float a, float b, float tolerance) {
     return fabsf(a - b) <= tolerance;
 }
 
-inline float f_clamp(float d, float min, float max) {
+static inline float f_min(float a, float b) {
+    return a < b ? a : b;
+}
+
+static inline float f_max(float a, float b) {
+    return a > b ? a : b;
+}
+
+static inline float f_clamp(float d, float min, float max) {
     float clampedMin = d < min ? min : d;
 
     return clampedMin > max ? max : clampedMin;
 }
 
-inline float f_to_radians(float degrees) {
+static inline float f_to_radians(float degrees) {
     return degrees * (M_PI / 180);
 }